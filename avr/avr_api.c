@@ -23,6 +23,7 @@
 #include <stdio.h>
 
 #include "libgieditor.h"
+#include "midi_transport.h"
 #include "midi_jack.h"
 #define CONTROL_NODE
 #include "../avr/per_node.h"
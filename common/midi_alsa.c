@@ -0,0 +1,489 @@
+/* SysEx message handler, ALSA rawmidi transport
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Talks to a rawmidi device directly, so nothing needs jackd. One I/O
+ * thread reads the device and writes queued messages as soon as they're
+ * queued, rather than once per process cycle. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <alsa/asoundlib.h>
+
+#include "libgieditor.h"
+#include "midi_transport.h"
+#include "sysex_assembler.h"
+#include "../avr/per_node.h"
+
+#define allocate(t, num) __common_allocate(sizeof(t) * num, "libgieditor")
+
+#define MIDI_CMD_REALTIME	    0xf8
+#define ACK_CONTROL_CHANNEL	    0xB1
+#define MAX_POLL_FDS		    8
+#define READ_CHUNK		    256
+
+typedef struct s_sysex_list *Sysex_list;
+struct s_sysex_list {
+	int		size;
+	int		ack_required;
+	uint64_t	time;	/* Usecs. Send no earlier, or when received */
+	Sysex_ticket	ticket;
+	Sysex_list	next;
+	uint8_t		data[];	/* SIZE bytes */
+};
+
+/* Only access with midi_lock */
+static Sysex_list sysex_in_list;
+static Sysex_list sysex_out_list[SYSEX_LANES];
+static Sysex_ticket last_ticket[SYSEX_LANES] = {
+	SYSEX_LANE_REALTIME, SYSEX_LANE_BULK };
+static Sysex_ticket written_ticket[SYSEX_LANES] = {
+	SYSEX_LANE_REALTIME, SYSEX_LANE_BULK };
+static int waiting_for_ack;
+static int bulk_budget = DEFAULT_BULK_BUDGET;	/* Bytes in the driver */
+static int running;
+
+static int sysex_timeout_ms;
+static enum init_flags init_flags;
+static const char *device_name = "default";
+
+static snd_rawmidi_t *midi_in;
+static snd_rawmidi_t *midi_out;
+static size_t out_buffer_size;
+static pthread_t io_thread;
+static int wake_fds[2] = { -1, -1 };
+
+static pthread_mutex_t midi_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t read_data_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t write_data_ready = PTHREAD_COND_INITIALIZER;
+
+/* Input parser state, only touched by the I/O thread */
+static int max_sysex_size = DEFAULT_MAX_SYSEX_SIZE;
+static Sysex_assembler in_assembler;
+static uint8_t running_status;
+static int status_bytes;
+
+static Sysex_list add_sysex_event(Sysex_list *global_sysex_list,
+		uint8_t *data, int size, int ack_required, uint64_t time) {
+	Sysex_list cur_sysex = allocate(uint8_t,
+			(sizeof(struct s_sysex_list) + size));
+
+	cur_sysex->next = NULL;
+	cur_sysex->size = size;
+	cur_sysex->ack_required = ack_required;
+	cur_sysex->time = time;
+	memcpy(cur_sysex->data, data, size);
+
+	while (*global_sysex_list)
+	    global_sysex_list = &(*global_sysex_list)->next;
+	*global_sysex_list = cur_sysex;
+	return cur_sysex;
+}
+
+/* Called with midi_lock held */
+static Sysex_ticket next_ticket(enum sysex_lane lane) {
+	last_ticket[lane] += SYSEX_QUEUES;
+	if (!last_ticket[lane]) last_ticket[lane] += SYSEX_QUEUES;
+	return last_ticket[lane];
+}
+
+static void flush_sysex_list(Sysex_list *global_sysex_list) {
+	Sysex_list cur_sysex;
+	while (*global_sysex_list) {
+	    cur_sysex = *global_sysex_list;
+	    *global_sysex_list = (*global_sysex_list)->next;
+	    free(cur_sysex);
+	}
+}
+
+static void wake_io_thread(void) {
+	uint8_t c = 0;
+	if (write(wake_fds[1], &c, 1) < 0) { /* Already awake */ }
+}
+
+uint64_t alsa_sysex_get_time(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void alsa_sysex_set_max_size(int max_size) {
+	max_sysex_size = max_size;
+}
+
+unsigned int alsa_sysex_dropped(void) {
+	unsigned int dropped;
+
+	pthread_mutex_lock(&midi_lock);
+	dropped = in_assembler.dropped;
+	pthread_mutex_unlock(&midi_lock);
+	return dropped;
+}
+
+void alsa_sysex_set_bulk_budget(int bytes) {
+	pthread_mutex_lock(&midi_lock);
+	bulk_budget = bytes > 0 ? bytes : 0;
+	pthread_mutex_unlock(&midi_lock);
+}
+
+void alsa_sysex_set_device(const char *device) {
+	device_name = device;
+}
+
+/* There's only device 0 */
+void alsa_flush_sysex_in_list(int device) {
+	pthread_mutex_lock(&midi_lock);
+	flush_sysex_list(&sysex_in_list);
+	pthread_mutex_unlock(&midi_lock);
+}
+
+/* Called with midi_lock held. Complete SysEx messages go on the in list,
+ * and an ACK control change releases the out list */
+static void parse_byte(uint8_t c, uint64_t now) {
+	int size;
+
+	if (c >= MIDI_CMD_REALTIME) return;
+
+	size = sysex_assembler_feed(&in_assembler, c);
+	if (size) {
+	    add_sysex_event(&sysex_in_list, in_assembler.buf, size, 0, now);
+	    pthread_cond_signal(&read_data_ready);
+	    return;
+	}
+
+	if (c & 0x80) {
+	    running_status = c;
+	    status_bytes = 0;
+	    return;
+	}
+
+	if (sysex_assembler_busy(&in_assembler)) return;
+
+	if (running_status == ACK_CONTROL_CHANNEL) {
+	    if (status_bytes++ == 0 && c == ACK_CHANNEL &&
+			    (init_flags & LIBGIEDITOR_ACK))
+		waiting_for_ack = 0;
+	    if (status_bytes == 2) status_bytes = 0;
+	}
+}
+
+static void read_input(void) {
+	uint8_t buf[READ_CHUNK];
+	ssize_t i, bytes;
+	uint64_t now;
+
+	while ((bytes = snd_rawmidi_read(midi_in, buf, sizeof(buf))) > 0) {
+	    now = alsa_sysex_get_time();
+	    pthread_mutex_lock(&midi_lock);
+	    for (i = 0; i < bytes; i++) parse_byte(buf[i], now);
+	    pthread_mutex_unlock(&midi_lock);
+	}
+}
+
+/* Bytes written but still in the driver's buffer */
+static size_t out_pending(void) {
+	snd_rawmidi_status_t *status;
+
+	snd_rawmidi_status_alloca(&status);
+	if (snd_rawmidi_status(midi_out, status) < 0) return 0;
+	return out_buffer_size - snd_rawmidi_status_get_avail(status);
+}
+
+/* Called with midi_lock held. The next message to write: the head of the
+ * realtime lane if it's due, otherwise the head of the bulk lane if it's
+ * due and the driver has drained far enough. Lowers *WAIT to the number of
+ * milliseconds until a message held back can go. */
+static Sysex_list next_output(int *wait, enum sysex_lane *lane) {
+	Sysex_list cur_sysex;
+	uint64_t now = alsa_sysex_get_time();
+	size_t pending;
+	int ms;
+
+	for (*lane = 0; *lane < SYSEX_LANES; (*lane)++) {
+	    cur_sysex = sysex_out_list[*lane];
+	    if (!cur_sysex) continue;
+	    if (cur_sysex->time > now) {
+		/* Round up, so we don't wake up just before it's due */
+		ms = (cur_sysex->time - now + 999) / 1000;
+		if (*wait < 0 || ms < *wait) *wait = ms;
+		continue;
+	    }
+	    if (*lane == SYSEX_LANE_BULK && bulk_budget) {
+		pending = out_pending();
+		if (pending && pending + cur_sysex->size > bulk_budget) {
+		    /* Nothing says when it drains, so look again soon */
+		    *wait = 1;
+		    continue;
+		}
+	    }
+	    return cur_sysex;
+	}
+	return NULL;
+}
+
+/* Writes everything queued that is due, up to the next message that needs
+ * an ACK. Returns how many milliseconds until the next one is due, or -1 if
+ * there's nothing to wait for */
+static int write_output(void) {
+	Sysex_list cur_sysex;
+	enum sysex_lane lane;
+	int wait = -1;
+
+	pthread_mutex_lock(&midi_lock);
+	while (!waiting_for_ack) {
+	    wait = -1;
+	    cur_sysex = next_output(&wait, &lane);
+	    if (!cur_sysex) break;
+	    sysex_out_list[lane] = cur_sysex->next;
+	    if (cur_sysex->ack_required) waiting_for_ack = 1;
+	    pthread_mutex_unlock(&midi_lock);
+
+	    snd_rawmidi_write(midi_out, cur_sysex->data, cur_sysex->size);
+
+	    pthread_mutex_lock(&midi_lock);
+	    written_ticket[lane] = cur_sysex->ticket;
+	    free(cur_sysex);
+	    pthread_cond_broadcast(&write_data_ready);
+	}
+	pthread_mutex_unlock(&midi_lock);
+	return wait;
+}
+
+static void *io_thread_main(void *arg) {
+	struct pollfd fds[MAX_POLL_FDS];
+	uint8_t buf[READ_CHUNK];
+	int nfds = 1, wait = -1;
+
+	fds[0].fd = wake_fds[0];
+	fds[0].events = POLLIN;
+	if (midi_in)
+	    nfds += snd_rawmidi_poll_descriptors(midi_in, &fds[1],
+			    MAX_POLL_FDS - 1);
+
+	while (running) {
+	    if (poll(fds, nfds, wait) < 0 && errno != EINTR) break;
+	    while (read(wake_fds[0], buf, sizeof(buf)) > 0);
+	    if (midi_in) read_input();
+	    if (midi_out) wait = write_output();
+	}
+	return NULL;
+}
+
+void alsa_sysex_set_timeout(int timeout_time) {
+	sysex_timeout_ms = timeout_time;
+}
+
+/* Timeouts are already in milliseconds */
+int alsa_sysex_ms_to_timeout(int ms) {
+	return ms;
+}
+
+int alsa_sysex_init(const char *client_name, int timeout_time,
+						enum init_flags flags) {
+	sysex_timeout_ms = timeout_time;
+	init_flags = flags;
+
+	if (flags & (LIBGIEDITOR_READ | LIBGIEDITOR_ACK)) {
+	    sysex_assembler_init(&in_assembler, max_sysex_size);
+	    if (snd_rawmidi_open(&midi_in, NULL, device_name,
+				    SND_RAWMIDI_NONBLOCK) < 0) return -1;
+	}
+
+	if (flags & LIBGIEDITOR_WRITE) {
+	    snd_rawmidi_params_t *params;
+
+	    if (snd_rawmidi_open(NULL, &midi_out, device_name, 0) < 0)
+		return -1;
+	    snd_rawmidi_params_alloca(&params);
+	    if (snd_rawmidi_params_current(midi_out, params) < 0) return -1;
+	    out_buffer_size = snd_rawmidi_params_get_buffer_size(params);
+	}
+
+	if (pipe(wake_fds)) return -1;
+	fcntl(wake_fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(wake_fds[1], F_SETFL, O_NONBLOCK);
+
+	running = 1;
+	if (pthread_create(&io_thread, NULL, io_thread_main, NULL)) {
+	    running = 0;
+	    return -1;
+	}
+
+	return 0;
+}
+
+int alsa_sysex_close(void) {
+	int lane;
+
+	if (running) {
+	    running = 0;
+	    wake_io_thread();
+	    pthread_join(io_thread, NULL);
+	}
+	if (wake_fds[0] >= 0) {
+	    close(wake_fds[0]);
+	    close(wake_fds[1]);
+	    wake_fds[0] = wake_fds[1] = -1;
+	}
+	if (midi_in) {
+	    snd_rawmidi_close(midi_in);
+	    sysex_assembler_free(&in_assembler);
+	}
+	if (midi_out) {
+	    snd_rawmidi_drain(midi_out);
+	    snd_rawmidi_close(midi_out);
+	}
+	midi_in = midi_out = NULL;
+
+	pthread_mutex_lock(&midi_lock);
+	flush_sysex_list(&sysex_in_list);
+	for (lane = 0; lane < SYSEX_LANES; lane++)
+	    flush_sysex_list(&sysex_out_list[lane]);
+	pthread_mutex_unlock(&midi_lock);
+	return 0;
+}
+
+/* There's only the one link */
+Sysex_ticket alsa_sysex_send_event(uint32_t sysex_size, uint8_t *data,
+		uint64_t time, enum sysex_lane lane, int link) {
+	Sysex_ticket ticket;
+
+	pthread_mutex_lock(&midi_lock);
+	ticket = add_sysex_event(&sysex_out_list[lane], data, sysex_size, 0,
+			time)->ticket = next_ticket(lane);
+	pthread_mutex_unlock(&midi_lock);
+	wake_io_thread();
+	return ticket;
+}
+
+Sysex_ticket alsa_sysex_send_event_ack(uint32_t sysex_size, uint8_t *data) {
+	Sysex_ticket ticket;
+
+	pthread_mutex_lock(&midi_lock);
+	ticket = add_sysex_event(&sysex_out_list[SYSEX_LANE_REALTIME], data,
+			sysex_size, 1, 0)->ticket =
+		next_ticket(SYSEX_LANE_REALTIME);
+	pthread_mutex_unlock(&midi_lock);
+	wake_io_thread();
+	return ticket;
+}
+
+void alsa_sysex_wait_ticket(Sysex_ticket ticket) {
+	pthread_mutex_lock(&midi_lock);
+
+	while (!ticket_written(written_ticket[ticket_lane(ticket)], ticket)) {
+	    pthread_cond_wait(&write_data_ready, &midi_lock);
+	}
+
+	pthread_mutex_unlock(&midi_lock);
+}
+
+void alsa_sysex_wait_write(void) {
+	Sysex_ticket tickets[SYSEX_LANES];
+	int lane;
+
+	pthread_mutex_lock(&midi_lock);
+	memcpy(tickets, last_ticket, sizeof(tickets));
+	pthread_mutex_unlock(&midi_lock);
+
+	for (lane = 0; lane < SYSEX_LANES; lane++)
+	    alsa_sysex_wait_ticket(tickets[lane]);
+}
+
+int alsa_sysex_listen_event(int device, uint8_t **data, uint64_t *time) {
+	Sysex_list cur_sysex;
+	struct timespec deadline;
+	int data_bytes, retval = 0;
+
+	pthread_mutex_lock(&midi_lock);
+
+	if (sysex_timeout_ms > 0) {
+	    clock_gettime(CLOCK_REALTIME, &deadline);
+	    deadline.tv_sec += sysex_timeout_ms / 1000;
+	    deadline.tv_nsec += (sysex_timeout_ms % 1000) * 1000000L;
+	    if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	    }
+	}
+
+	/* A negative timeout waits forever */
+	while (sysex_in_list == NULL && sysex_timeout_ms != 0 &&
+			retval != ETIMEDOUT) {
+	    if (sysex_timeout_ms < 0)
+		pthread_cond_wait(&read_data_ready, &midi_lock);
+	    else retval = pthread_cond_timedwait(&read_data_ready,
+			    &midi_lock, &deadline);
+	}
+
+	*data = NULL;
+
+	if (sysex_in_list == NULL) {
+	    pthread_mutex_unlock(&midi_lock);
+	    return -1;
+	}
+
+	cur_sysex = sysex_in_list;
+	sysex_in_list = sysex_in_list->next;
+
+	data_bytes = cur_sysex->size;
+	if (time) *time = cur_sysex->time;
+	*data = allocate(uint8_t, data_bytes);
+	memcpy(*data, cur_sysex->data, data_bytes);
+
+	free(cur_sysex);
+
+	pthread_mutex_unlock(&midi_lock);
+
+	return data_bytes;
+}
+
+const Midi_transport midi_alsa_transport = {
+	.name		= "alsa",
+	.init		= alsa_sysex_init,
+	.close		= alsa_sysex_close,
+	.set_timeout	= alsa_sysex_set_timeout,
+	.ms_to_timeout	= alsa_sysex_ms_to_timeout,
+	.set_pacing	= NULL,
+	.set_link_pacing = NULL,
+	.set_links	= NULL,
+	.add_device	= NULL,
+	.remove_device	= NULL,
+	.set_bulk_budget = alsa_sysex_set_bulk_budget,
+	.set_max_size	= alsa_sysex_set_max_size,
+	.dropped	= alsa_sysex_dropped,
+	.get_time	= alsa_sysex_get_time,
+	.wait_write	= alsa_sysex_wait_write,
+	.wait_ticket	= alsa_sysex_wait_ticket,
+	.flush_in_list	= alsa_flush_sysex_in_list,
+	.listen_event	= alsa_sysex_listen_event,
+	.send_event	= alsa_sysex_send_event,
+	.send_event_ack	= alsa_sysex_send_event_ack,
+};
@@ -0,0 +1,422 @@
+/* SysEx message handler, gieditord client transport
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Reaches the Juno through gieditord rather than opening it, so several
+ * programmes can share it. One thread reads what the daemon sends back;
+ * sending is a write to the socket. Pacing, the bulk budget and links are
+ * the daemon's business. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "libgieditor.h"
+#include "midi_transport.h"
+#include "sysex_assembler.h"
+#include "gieditord.h"
+
+#define allocate(t, num) __common_allocate(sizeof(t) * num, "libgieditor")
+
+typedef struct s_sysex_list *Sysex_list;
+struct s_sysex_list {
+	int		size;
+	uint64_t	time;	/* Usecs, when received */
+	Sysex_list	next;
+	uint8_t		data[];	/* SIZE bytes */
+};
+
+/* Only access with midi_lock */
+static Sysex_list sysex_in_list;
+static Sysex_ticket last_ticket[SYSEX_LANES] = {
+	SYSEX_LANE_REALTIME, SYSEX_LANE_BULK };
+static Sysex_ticket written_ticket[SYSEX_LANES] = {
+	SYSEX_LANE_REALTIME, SYSEX_LANE_BULK };
+/* The last ticket WAIT has been sent for on each lane */
+static Sysex_ticket asked_ticket[SYSEX_LANES] = {
+	SYSEX_LANE_REALTIME, SYSEX_LANE_BULK };
+static unsigned int dropped;
+static int connected;
+
+static int sysex_timeout_ms;
+static int max_sysex_size = DEFAULT_MAX_SYSEX_SIZE;
+static const char *socket_name;
+
+static int sock = -1;
+static pthread_t read_thread;
+
+static pthread_mutex_t midi_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t read_data_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t write_data_ready = PTHREAD_COND_INITIALIZER;
+
+char *daemon_socket_path(void) {
+	char *path, *dir;
+
+	if ((path = getenv(DAEMON_SOCKET_ENV))) return strdup(path);
+
+	dir = getenv("XDG_RUNTIME_DIR");
+	if (dir && *dir) {
+	    if (asprintf(&path, "%s/%s", dir, DAEMON_SOCKET_NAME) < 0)
+		return NULL;
+	} else if (asprintf(&path, "/tmp/%s-%d", DAEMON_SOCKET_NAME,
+				(int) getuid()) < 0) return NULL;
+	return path;
+}
+
+static void flush_sysex_list(Sysex_list *global_sysex_list) {
+	Sysex_list cur_sysex;
+	while (*global_sysex_list) {
+	    cur_sysex = *global_sysex_list;
+	    *global_sysex_list = (*global_sysex_list)->next;
+	    free(cur_sysex);
+	}
+}
+
+/* One whole packet, or -1 */
+static int send_msg(uint8_t type, uint8_t lane, uint32_t ticket,
+		uint32_t arg, const uint8_t *data, int size) {
+	uint8_t buf[sizeof(Daemon_msg) + DAEMON_MAX_DATA];
+	Daemon_msg *msg = (Daemon_msg *) buf;
+
+	if (size > DAEMON_MAX_DATA) return -1;
+	msg->type = type;
+	msg->lane = lane;
+	msg->size = size;
+	msg->ticket = ticket;
+	msg->arg = arg;
+	if (size) memcpy(buf + sizeof(Daemon_msg), data, size);
+
+	if (send(sock, buf, sizeof(Daemon_msg) + size, MSG_NOSIGNAL) < 0)
+	    return -1;
+	return 0;
+}
+
+uint64_t daemon_sysex_get_time(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void daemon_sysex_set_max_size(int max_size) {
+	max_sysex_size = max_size;
+}
+
+unsigned int daemon_sysex_dropped(void) {
+	unsigned int retval;
+
+	pthread_mutex_lock(&midi_lock);
+	retval = dropped;
+	pthread_mutex_unlock(&midi_lock);
+	return retval;
+}
+
+/* The daemon keeps its own */
+void daemon_sysex_set_bulk_budget(int bytes) {
+}
+
+void daemon_sysex_set_socket(const char *path) {
+	socket_name = path;
+}
+
+void daemon_flush_sysex_in_list(int device) {
+	Sysex_list old;
+
+	pthread_mutex_lock(&midi_lock);
+	while ((old = sysex_in_list)) {
+	    sysex_in_list = old->next;
+	    free(old);
+	}
+	pthread_mutex_unlock(&midi_lock);
+}
+
+static void add_event(uint8_t *data, int size) {
+	Sysex_list cur_sysex, *list;
+
+	if (size < 2 || size > max_sysex_size || data[0] != 0xf0 ||
+			data[size - 1] != 0xf7) {
+	    dropped++;
+	    return;
+	}
+	cur_sysex = allocate(uint8_t, sizeof(struct s_sysex_list) + size);
+	cur_sysex->next = NULL;
+	cur_sysex->size = size;
+	cur_sysex->time = daemon_sysex_get_time();
+	memcpy(cur_sysex->data, data, size);
+
+	for (list = &sysex_in_list; *list; list = &(*list)->next);
+	*list = cur_sysex;
+	pthread_cond_signal(&read_data_ready);
+}
+
+static void *read_thread_main(void *arg) {
+	uint8_t buf[sizeof(Daemon_msg) + DAEMON_MAX_DATA];
+	Daemon_msg *msg = (Daemon_msg *) buf;
+	ssize_t bytes;
+
+	while (1) {
+	    bytes = recv(sock, buf, sizeof(buf), 0);
+	    if (bytes < 0 && errno == EINTR) continue;
+	    if (bytes < (ssize_t) sizeof(Daemon_msg)) break;
+
+	    pthread_mutex_lock(&midi_lock);
+	    switch (msg->type) {
+		case DAEMON_EVENT:
+		    add_event(buf + sizeof(Daemon_msg),
+				    bytes - sizeof(Daemon_msg));
+		    break;
+		case DAEMON_WRITTEN:
+		    if (msg->lane < SYSEX_LANES &&
+				    !ticket_written(written_ticket[msg->lane],
+					    msg->ticket)) {
+			written_ticket[msg->lane] = msg->ticket;
+			pthread_cond_broadcast(&write_data_ready);
+		    }
+		    break;
+	    }
+	    pthread_mutex_unlock(&midi_lock);
+	}
+
+	/* The daemon has gone, so nobody waits for it */
+	pthread_mutex_lock(&midi_lock);
+	connected = 0;
+	pthread_cond_broadcast(&read_data_ready);
+	pthread_cond_broadcast(&write_data_ready);
+	pthread_mutex_unlock(&midi_lock);
+	return NULL;
+}
+
+void daemon_sysex_set_timeout(int timeout_time) {
+	sysex_timeout_ms = timeout_time;
+}
+
+/* Timeouts are already in milliseconds */
+int daemon_sysex_ms_to_timeout(int ms) {
+	return ms;
+}
+
+int daemon_sysex_init(const char *client_name, int timeout_time,
+						enum init_flags flags) {
+	uint8_t buf[sizeof(Daemon_msg) + DAEMON_MAX_DATA];
+	Daemon_msg *msg = (Daemon_msg *) buf;
+	struct sockaddr_un addr;
+	char *path;
+
+	sysex_timeout_ms = timeout_time;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (socket_name) path = strdup(socket_name);
+	else path = daemon_socket_path();
+	if (!path) return -1;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+	    free(path);
+	    return -1;
+	}
+	strcpy(addr.sun_path, path);
+	free(path);
+
+	sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (sock < 0) return -1;
+	if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+	    goto failed;
+
+	if (send_msg(DAEMON_HELLO, 0, 0, flags, (const uint8_t *) client_name,
+				strlen(client_name)) < 0) goto failed;
+	if (recv(sock, buf, sizeof(buf), 0) < (ssize_t) sizeof(Daemon_msg) ||
+			msg->type != DAEMON_HELLO ||
+			msg->arg != DAEMON_VERSION) goto failed;
+
+	/* Like a Jack client, a reader sees everything the Juno sends */
+	if ((flags & LIBGIEDITOR_READ) && send_msg(DAEMON_SUBSCRIBE, 0, 0,
+				DAEMON_ALL_ADDRESSES, NULL, 0) < 0)
+	    goto failed;
+
+	connected = 1;
+	if (pthread_create(&read_thread, NULL, read_thread_main, NULL)) {
+	    connected = 0;
+	    goto failed;
+	}
+	return 0;
+
+failed:
+	close(sock);
+	sock = -1;
+	return -1;
+}
+
+int daemon_sysex_close(void) {
+	if (sock >= 0) {
+	    shutdown(sock, SHUT_RDWR);
+	    pthread_join(read_thread, NULL);
+	    close(sock);
+	    sock = -1;
+	}
+
+	pthread_mutex_lock(&midi_lock);
+	flush_sysex_list(&sysex_in_list);
+	pthread_mutex_unlock(&midi_lock);
+	return 0;
+}
+
+/* Called with midi_lock held */
+static Sysex_ticket next_ticket(enum sysex_lane lane) {
+	last_ticket[lane] += SYSEX_QUEUES;
+	if (!last_ticket[lane]) last_ticket[lane] += SYSEX_QUEUES;
+	return last_ticket[lane];
+}
+
+/* The lock is held across the send so the daemon sees each lane's tickets
+ * in order. If the daemon has gone, the message is lost and counts as
+ * written */
+static Sysex_ticket send_sysex(uint8_t type, uint32_t sysex_size,
+		uint8_t *data, uint64_t time, enum sysex_lane lane) {
+	Sysex_ticket ticket;
+	uint64_t now;
+
+	pthread_mutex_lock(&midi_lock);
+	ticket = next_ticket(lane);
+	now = daemon_sysex_get_time();
+	if (!connected || send_msg(type, lane, ticket,
+				time > now ? time - now : 0, data,
+				sysex_size) < 0)
+	    written_ticket[lane] = ticket;
+	pthread_mutex_unlock(&midi_lock);
+	return ticket;
+}
+
+/* There's only the one link, as far as we know */
+Sysex_ticket daemon_sysex_send_event(uint32_t sysex_size, uint8_t *data,
+		uint64_t time, enum sysex_lane lane, int link) {
+	return send_sysex(DAEMON_SEND, sysex_size, data, time, lane);
+}
+
+Sysex_ticket daemon_sysex_send_event_ack(uint32_t sysex_size,
+		uint8_t *data) {
+	return send_sysex(DAEMON_SEND_ACK, sysex_size, data, 0,
+			SYSEX_LANE_REALTIME);
+}
+
+void daemon_sysex_wait_ticket(Sysex_ticket ticket) {
+	enum sysex_lane lane = ticket_lane(ticket);
+
+	pthread_mutex_lock(&midi_lock);
+
+	if (connected && !ticket_written(written_ticket[lane], ticket) &&
+			!ticket_written(asked_ticket[lane], ticket)) {
+	    if (send_msg(DAEMON_WAIT, lane, ticket, 0, NULL, 0) == 0)
+		asked_ticket[lane] = ticket;
+	}
+	while (connected && !ticket_written(written_ticket[lane], ticket)) {
+	    pthread_cond_wait(&write_data_ready, &midi_lock);
+	}
+
+	pthread_mutex_unlock(&midi_lock);
+}
+
+void daemon_sysex_wait_write(void) {
+	Sysex_ticket tickets[SYSEX_LANES];
+	int lane;
+
+	pthread_mutex_lock(&midi_lock);
+	memcpy(tickets, last_ticket, sizeof(tickets));
+	pthread_mutex_unlock(&midi_lock);
+
+	for (lane = 0; lane < SYSEX_LANES; lane++)
+	    daemon_sysex_wait_ticket(tickets[lane]);
+}
+
+int daemon_sysex_listen_event(int device, uint8_t **data, uint64_t *time) {
+	Sysex_list cur_sysex;
+	struct timespec deadline;
+	int data_bytes, retval = 0;
+
+	pthread_mutex_lock(&midi_lock);
+
+	if (sysex_timeout_ms > 0) {
+	    clock_gettime(CLOCK_REALTIME, &deadline);
+	    deadline.tv_sec += sysex_timeout_ms / 1000;
+	    deadline.tv_nsec += (sysex_timeout_ms % 1000) * 1000000L;
+	    if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	    }
+	}
+
+	/* A negative timeout waits forever */
+	while (sysex_in_list == NULL && connected && sysex_timeout_ms != 0 &&
+			retval != ETIMEDOUT) {
+	    if (sysex_timeout_ms < 0)
+		pthread_cond_wait(&read_data_ready, &midi_lock);
+	    else retval = pthread_cond_timedwait(&read_data_ready,
+			    &midi_lock, &deadline);
+	}
+
+	*data = NULL;
+
+	if (sysex_in_list == NULL) {
+	    pthread_mutex_unlock(&midi_lock);
+	    return -1;
+	}
+
+	cur_sysex = sysex_in_list;
+	sysex_in_list = sysex_in_list->next;
+
+	data_bytes = cur_sysex->size;
+	if (time) *time = cur_sysex->time;
+	*data = allocate(uint8_t, data_bytes);
+	memcpy(*data, cur_sysex->data, data_bytes);
+
+	free(cur_sysex);
+
+	pthread_mutex_unlock(&midi_lock);
+
+	return data_bytes;
+}
+
+const Midi_transport midi_daemon_transport = {
+	.name		= "daemon",
+	.init		= daemon_sysex_init,
+	.close		= daemon_sysex_close,
+	.set_timeout	= daemon_sysex_set_timeout,
+	.ms_to_timeout	= daemon_sysex_ms_to_timeout,
+	.set_pacing	= NULL,
+	.set_link_pacing = NULL,
+	.set_links	= NULL,
+	.add_device	= NULL,
+	.remove_device	= NULL,
+	.set_bulk_budget = daemon_sysex_set_bulk_budget,
+	.set_max_size	= daemon_sysex_set_max_size,
+	.dropped	= daemon_sysex_dropped,
+	.get_time	= daemon_sysex_get_time,
+	.wait_write	= daemon_sysex_wait_write,
+	.wait_ticket	= daemon_sysex_wait_ticket,
+	.flush_in_list	= daemon_flush_sysex_in_list,
+	.listen_event	= daemon_sysex_listen_event,
+	.send_event	= daemon_sysex_send_event,
+	.send_event_ack	= daemon_sysex_send_event_ack,
+};
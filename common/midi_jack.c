@@ -27,66 +27,114 @@
 #include <jack/midiport.h>
 
 #include "libgieditor.h"
+#include "midi_transport.h"
+#include "midi_jack.h"
+#include "sysex_assembler.h"
+#include "rt_stats.h"
 #include "../avr/per_node.h"
 
 #define allocate(t, num) __common_allocate(sizeof(t) * num, "libgieditor")
 
-#define MAX_SYSEX_SIZE		    512
-#define MIDI_CMD_COMMON_SYSEX       0xf0
-#define MIDI_CMD_COMMON_SYSEX_END   0xf7
 #define ACK_CONTROL_CHANNEL	    0xB1
 
 typedef struct s_sysex_list *Sysex_list;
 struct s_sysex_list {
-	uint8_t		data[MAX_SYSEX_SIZE];
 	int		size;
 	int		ack_required;
+	jack_time_t	time;	/* Usecs. Send no earlier, or when received */
+	Sysex_ticket	ticket;
 	Sysex_list	next;
+	uint8_t		data[];	/* SIZE bytes */
 };
 
+/* A pair of ports to a Juno. Link 0 is sysex_midi_in and
+ * sysex_midi_out, device 0's others have their number after, and other
+ * devices' are named after the device */
+typedef struct s_link {
+	int		used;
+	int		device;
+	jack_port_t	*in_port;
+	jack_port_t	*out_port;
+	Sysex_assembler	assembler;
+	Sysex_list	out_list[SYSEX_LANES];
+	int		pacing;		/* Bytes per second, 0 for no limit */
+	jack_nframes_t	wire_free;	/* Frame the last paced message ends */
+} Link;
+
+/* One Juno. Device 0 is the one init opens, on the first first_links
+ * links, and each one added has a link of its own */
+typedef struct s_device {
+	int		used;
+	Sysex_list	in_list;
+	uint32_t	in_depth;
+	int		timeout;	/* Cycles left for its reader */
+} Device;
+
 /* Only access with midi_lock */
-static Sysex_list sysex_in_list;
-static Sysex_list sysex_out_list;
-static int sysex_timeout;
+static Device devices[MAX_SYSEX_DEVICES];
+static Link links[MAX_SYSEX_LINKS];
+static int first_links = 1;
+static int num_links;		/* Links in use are all below this */
+static enum init_flags init_flags;
 static int waiting_for_ack;
+/* Indexed by sysex_queue(), and set up by init */
+static Sysex_ticket last_ticket[SYSEX_QUEUES];
+static Sysex_ticket written_ticket[SYSEX_QUEUES];
+static int bulk_budget = DEFAULT_BULK_BUDGET;	/* Bytes per cycle, a link */
 
 static int sysex_timeout_loops;
 
+/* Queue lengths for the statistics */
+static uint32_t out_depth[SYSEX_LANES];
+static Rt_stats *stats;
+static const char *queue_names[] = { "in", "realtime", "bulk", NULL };
+
+static int max_sysex_size = DEFAULT_MAX_SYSEX_SIZE;
+
 static jack_client_t *jack_client;
-static jack_port_t *midi_in_port;
 static jack_port_t *midi_ack_port;
-static jack_port_t *midi_out_port;
 
 static pthread_mutex_t midi_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t read_data_ready = PTHREAD_COND_INITIALIZER;
 static pthread_cond_t write_data_ready = PTHREAD_COND_INITIALIZER;
 
-static void add_sysex_event_priv(Sysex_list *global_sysex_list, uint8_t *data, 
-					    int size, int ack_required) {
+static Sysex_list add_sysex_event_priv(Sysex_list *global_sysex_list,
+		uint8_t *data, int size, int ack_required, jack_time_t time) {
 	Sysex_list cur_sysex;
 	if (!*global_sysex_list) {
-	    *global_sysex_list = allocate(struct s_sysex_list, 1);
+	    *global_sysex_list = allocate(uint8_t,
+			    (sizeof(struct s_sysex_list) + size));
 	    cur_sysex = *global_sysex_list;
 	} else {
 	    cur_sysex = *global_sysex_list;
 	    while (cur_sysex->next) cur_sysex = cur_sysex->next;
-	    cur_sysex->next = allocate(struct s_sysex_list, 1);
+	    cur_sysex->next = allocate(uint8_t,
+			    (sizeof(struct s_sysex_list) + size));
 	    cur_sysex = cur_sysex->next;
 	}
 	cur_sysex->next = NULL;
 	cur_sysex->size = size;
 	cur_sysex->ack_required = ack_required;
+	cur_sysex->time = time;
 	memcpy(cur_sysex->data, data, size);
+	return cur_sysex;
+}
+
+static Sysex_list add_sysex_event_ack(Sysex_list *global_sysex_list,
+		uint8_t *data, int size) {
+	return add_sysex_event_priv(global_sysex_list, data, size, 1, 0);
 }
 
-static void add_sysex_event_ack(Sysex_list *global_sysex_list, uint8_t *data,
-					    int size) {
-	add_sysex_event_priv(global_sysex_list, data, size, 1);
+static Sysex_list add_sysex_event(Sysex_list *global_sysex_list,
+		uint8_t *data, int size, jack_time_t time) {
+	return add_sysex_event_priv(global_sysex_list, data, size, 0, time);
 }
 
-static void add_sysex_event(Sysex_list *global_sysex_list, uint8_t *data,
-					    int size) {
-	add_sysex_event_priv(global_sysex_list, data, size, 0);
+/* Called with midi_lock held */
+static Sysex_ticket next_ticket(int queue) {
+	last_ticket[queue] += SYSEX_QUEUES;
+	if (!last_ticket[queue]) last_ticket[queue] += SYSEX_QUEUES;
+	return last_ticket[queue];
 }
 
 static void flush_sysex_list(Sysex_list *global_sysex_list) {
@@ -98,54 +146,129 @@ static void flush_sysex_list(Sysex_list *global_sysex_list) {
         }
 }
 
-void jack_flush_sysex_in_list(void) {
+void jack_flush_device_in_list(int device) {
 	pthread_mutex_lock(&midi_lock);
-	flush_sysex_list(&sysex_in_list);
+	flush_sysex_list(&devices[device].in_list);
+	devices[device].in_depth = 0;
 	pthread_mutex_unlock(&midi_lock);
 }
 
-static int jack_callback(jack_nframes_t nframes, void *arg) {
-	jack_midi_event_t jack_midi_event;
-	jack_nframes_t event_index = 0;
-	Sysex_list cur_sysex;
+void jack_flush_sysex_in_list(void) {
+	jack_flush_device_in_list(0);
+}
 
-	pthread_mutex_lock(&midi_lock);
+/* Frame offset into this period for CUR_SYSEX: when it was asked for, but
+ * not before the last paced message on LINK has gone out, nor before AFTER.
+ * NFRAMES or more if it isn't due yet. */
+static jack_nframes_t out_offset(Link *link, Sysex_list cur_sysex,
+		jack_nframes_t cycle_start, jack_nframes_t nframes,
+		jack_nframes_t after) {
+	jack_nframes_t offset = after;
+	int32_t due;
+
+	if (cur_sysex->time) {
+	    due = jack_time_to_frames(jack_client, cur_sysex->time) -
+		    cycle_start;
+	    if (due >= (int32_t) nframes) return nframes;
+	    if (due > (int32_t) offset) offset = due;
+	}
+	if (link->pacing) {
+	    due = link->wire_free - cycle_start;
+	    if (due >= (int32_t) nframes) return nframes;
+	    if (due > (int32_t) offset) offset = due;
+	}
+	return offset;
+}
 
-	
-	if (midi_out_port) {
-	    void *midi_out_buf = jack_port_get_buffer(midi_out_port, nframes);
-	    jack_midi_clear_buffer(midi_out_buf);
-
-	    if (!sysex_out_list)
-		pthread_cond_signal(&write_data_ready);
-
-	    while (sysex_out_list && !waiting_for_ack) {
-		cur_sysex = sysex_out_list;
-		sysex_out_list = sysex_out_list->next;
-		jack_midi_event_write(midi_out_buf, event_index++,
-				cur_sysex->data,
-				cur_sysex->size);
+/* The realtime lane goes first. Within a lane messages go out in order, so
+ * one that isn't due yet holds back the rest */
+static void write_link(int link_num, jack_nframes_t nframes,
+		jack_nframes_t cycle_start) {
+	Link *link = &links[link_num];
+	void *midi_out_buf = jack_port_get_buffer(link->out_port, nframes);
+	jack_nframes_t offset = 0;
+	Sysex_list cur_sysex;
+	int lane, written;
+
+	jack_midi_clear_buffer(midi_out_buf);
+
+	/* Keep it from falling behind, or after half the frame counter's
+	 * range idle the difference would wrap and hold everything back */
+	if ((int32_t) (link->wire_free - cycle_start) < 0)
+	    link->wire_free = cycle_start;
+
+	for (lane = 0; lane < SYSEX_LANES; lane++) {
+	    written = 0;
+	    while ((cur_sysex = link->out_list[lane]) && !waiting_for_ack) {
+		if (lane == SYSEX_LANE_BULK && bulk_budget && written &&
+			written + cur_sysex->size > bulk_budget) break;
+		offset = out_offset(link, cur_sysex, cycle_start, nframes,
+				offset);
+		if (offset >= nframes) break;
+		if (jack_midi_event_write(midi_out_buf, offset,
+				cur_sysex->data, cur_sysex->size)) break;
+		link->out_list[lane] = cur_sysex->next;
+		if (link->pacing) link->wire_free = cycle_start + offset +
+			(uint64_t) cur_sysex->size * jack_get_sample_rate(
+				jack_client) / link->pacing;
 		if (cur_sysex->ack_required) waiting_for_ack = 1;
+		written += cur_sysex->size;
+		out_depth[lane]--;
+		rt_stats_add(stats, events_out, 1);
+		written_ticket[sysex_queue(lane, link_num)] = cur_sysex->ticket;
 		free(cur_sysex);
+		pthread_cond_broadcast(&write_data_ready);
 	    }
-	    event_index = 0;
 	}
+}
 
-	if (midi_in_port) {
-	    void *midi_in_buf = jack_port_get_buffer(midi_in_port, nframes);
-
-	    while (jack_midi_event_get(&jack_midi_event, midi_in_buf, 
-					event_index++) == 0) {
-		if (( jack_midi_event.buffer[0] == MIDI_CMD_COMMON_SYSEX ) &&
-			( jack_midi_event.buffer[jack_midi_event.size - 1] == 
-			  MIDI_CMD_COMMON_SYSEX_END )) {
-		    add_sysex_event(&sysex_in_list, jack_midi_event.buffer,
-				    jack_midi_event.size);
-		    pthread_cond_signal(&read_data_ready);
-		}
+/* Some drivers split SysEx over several events */
+static void read_link(Link *link, jack_nframes_t nframes,
+		jack_nframes_t cycle_start) {
+	void *midi_in_buf = jack_port_get_buffer(link->in_port, nframes);
+	Device *device = &devices[link->device];
+	jack_midi_event_t jack_midi_event;
+	jack_nframes_t event_index = 0;
+	size_t i;
+	int size;
+
+	while (jack_midi_event_get(&jack_midi_event, midi_in_buf,
+				event_index++) == 0) {
+	    for (i = 0; i < jack_midi_event.size; i++) {
+		size = sysex_assembler_feed(&link->assembler,
+				jack_midi_event.buffer[i]);
+		if (!size) continue;
+		add_sysex_event(&device->in_list, link->assembler.buf, size,
+				jack_frames_to_time(jack_client,
+				    cycle_start + jack_midi_event.time));
+		device->in_depth++;
+		rt_stats_add(stats, events_in, 1);
+		pthread_cond_signal(&read_data_ready);
 	    }
-	    event_index = 0;
 	}
+}
+
+static int jack_callback(jack_nframes_t nframes, void *arg) {
+	jack_midi_event_t jack_midi_event;
+	jack_nframes_t event_index = 0;
+	jack_nframes_t cycle_start = jack_last_frame_time(jack_client);
+	uint64_t stats_begin = rt_stats_cycle_begin(stats);
+	uint32_t in_depth = 0;
+	int lane, link, device, deferred = 0, wake = 0;
+
+	rt_stats_lock(stats, &midi_lock);
+
+	for (link = 0; link < num_links; link++) {
+	    if (!links[link].used || !links[link].out_port) continue;
+	    write_link(link, nframes, cycle_start);
+	    for (lane = 0; lane < SYSEX_LANES; lane++)
+		if (waiting_for_ack && links[link].out_list[lane]) deferred = 1;
+	}
+	if (deferred) rt_stats_add(stats, ack_deferred, 1);
+
+	for (link = 0; link < num_links; link++)
+	    if (links[link].used && links[link].in_port)
+		read_link(&links[link], nframes, cycle_start);
 
 	if (midi_ack_port) {
 	    void *midi_ack_buf = jack_port_get_buffer(midi_ack_port, nframes);
@@ -159,11 +282,28 @@ static int jack_callback(jack_nframes_t nframes, void *arg) {
 	    }
 	}
 
-	if (sysex_timeout > 0) sysex_timeout--;
-	if (sysex_timeout == 0) pthread_cond_signal(&read_data_ready);
+	/* Readers of every device share the condition */
+	for (device = 0; device < MAX_SYSEX_DEVICES; device++) {
+	    if (!devices[device].used) continue;
+	    if (devices[device].timeout > 0) devices[device].timeout--;
+	    if (devices[device].timeout == 0) wake = 1;
+	    in_depth += devices[device].in_depth;
+	}
+	if (wake) pthread_cond_broadcast(&read_data_ready);
+
+	rt_stats_depth(stats, 0, in_depth);
+	for (lane = 0; lane < SYSEX_LANES; lane++)
+	    rt_stats_depth(stats, lane + 1, out_depth[lane]);
 
 	pthread_mutex_unlock(&midi_lock);
 
+	rt_stats_cycle_end(stats, stats_begin, (uint64_t) nframes * 1000000 /
+			jack_get_sample_rate(jack_client));
+	return 0;
+}
+
+static int xrun_callback(void *arg) {
+	rt_stats_add(stats, xruns, 1);
 	return 0;
 }
 
@@ -171,27 +311,200 @@ void jack_sysex_set_timeout(int timeout_time) {
 	sysex_timeout_loops = timeout_time;
 }
 
+/* Rounds up to whole cycles */
+int jack_sysex_ms_to_timeout(int ms) {
+	uint64_t cycle_ms = (uint64_t) jack_get_buffer_size(jack_client) * 1000;
+	return ((uint64_t) ms * jack_get_sample_rate(jack_client) +
+			cycle_ms - 1) / cycle_ms;
+}
+
+void jack_sysex_set_max_size(int max_size) {
+	max_sysex_size = max_size;
+}
+
+unsigned int jack_sysex_dropped(void) {
+	unsigned int dropped = 0;
+	int link;
+
+	pthread_mutex_lock(&midi_lock);
+	for (link = 0; link < num_links; link++)
+	    if (links[link].used) dropped += links[link].assembler.dropped;
+	pthread_mutex_unlock(&midi_lock);
+	return dropped;
+}
+
+void jack_sysex_set_link_pacing(int link, int bytes_per_second) {
+	if (link < 0 || link >= MAX_SYSEX_LINKS) return;
+	pthread_mutex_lock(&midi_lock);
+	links[link].pacing = bytes_per_second > 0 ? bytes_per_second : 0;
+	pthread_mutex_unlock(&midi_lock);
+}
+
+void jack_sysex_set_pacing(int bytes_per_second) {
+	int link;
+
+	for (link = 0; link < MAX_SYSEX_LINKS; link++)
+	    jack_sysex_set_link_pacing(link, bytes_per_second);
+}
+
+/* Device 0's links. Call before init */
+int jack_sysex_set_links(int num) {
+	if (num < 1 || num > MAX_SYSEX_LINKS) return -1;
+	first_links = num;
+	return 0;
+}
+
+void jack_sysex_set_bulk_budget(int bytes) {
+	pthread_mutex_lock(&midi_lock);
+	bulk_budget = bytes > 0 ? bytes : 0;
+	pthread_mutex_unlock(&midi_lock);
+}
+
+uint64_t jack_sysex_get_time(void) {
+	return jack_get_time();
+}
+
+static jack_port_t *register_port(const char *name, unsigned long flags) {
+	return jack_port_register(jack_client, name, JACK_DEFAULT_MIDI_TYPE,
+			flags | JackPortIsTerminal, 0);
+}
+
+/* Unregisters LINK's ports and drops what's queued on it. Anyone waiting
+ * for a ticket on it is let go */
+static void release_link(int link) {
+	jack_port_t *in_port, *out_port;
+	Sysex_list cur_sysex;
+	int lane, queue;
+
+	pthread_mutex_lock(&midi_lock);
+	in_port = links[link].in_port;
+	out_port = links[link].out_port;
+	links[link].in_port = links[link].out_port = NULL;
+	for (lane = 0; lane < SYSEX_LANES; lane++) {
+	    while ((cur_sysex = links[link].out_list[lane])) {
+		links[link].out_list[lane] = cur_sysex->next;
+		out_depth[lane]--;
+		free(cur_sysex);
+	    }
+	    queue = sysex_queue(lane, link);
+	    written_ticket[queue] = last_ticket[queue];
+	}
+	links[link].used = 0;
+	pthread_cond_broadcast(&write_data_ready);
+	pthread_mutex_unlock(&midi_lock);
+
+	if (in_port) {
+	    jack_port_unregister(jack_client, in_port);
+	    sysex_assembler_free(&links[link].assembler);
+	}
+	if (out_port) jack_port_unregister(jack_client, out_port);
+}
+
+/* Sets up LINK for DEVICE. NAME names the ports of devices other than 0 */
+static int open_link(int link, int device, const char *name) {
+	char in_name[64], out_name[64];
+	jack_port_t *in_port = NULL, *out_port = NULL;
+
+	if (device) {
+	    snprintf(in_name, sizeof(in_name), "%s_midi_in", name);
+	    snprintf(out_name, sizeof(out_name), "%s_midi_out", name);
+	} else if (link) {
+	    snprintf(in_name, sizeof(in_name), "sysex_midi_in_%d", link + 1);
+	    snprintf(out_name, sizeof(out_name), "sysex_midi_out_%d",
+			    link + 1);
+	} else {
+	    strcpy(in_name, "sysex_midi_in");
+	    strcpy(out_name, "sysex_midi_out");
+	}
+
+	if (init_flags & LIBGIEDITOR_READ) {
+	    in_port = register_port(in_name, JackPortIsInput);
+	    if (!in_port) return -1;
+	}
+	if (init_flags & LIBGIEDITOR_WRITE) {
+	    out_port = register_port(out_name, JackPortIsOutput);
+	    if (!out_port) {
+		if (in_port) jack_port_unregister(jack_client, in_port);
+		return -1;
+	    }
+	}
+
+	/* The process callback may be running, so the ports go in last */
+	pthread_mutex_lock(&midi_lock);
+	links[link].device = device;
+	if (in_port) sysex_assembler_init(&links[link].assembler,
+			max_sysex_size);
+	links[link].in_port = in_port;
+	links[link].out_port = out_port;
+	pthread_mutex_unlock(&midi_lock);
+	return 0;
+}
+
+/* Another Juno, on ports NAME_midi_in and NAME_midi_out. Returns its
+ * device number, and its link in *LINK */
+int jack_sysex_add_device(const char *name, int *link) {
+	int device;
+
+	pthread_mutex_lock(&midi_lock);
+	for (device = 1; device < MAX_SYSEX_DEVICES; device++)
+	    if (!devices[device].used) break;
+	for (*link = 0; *link < MAX_SYSEX_LINKS; (*link)++)
+	    if (!links[*link].used) break;
+	if (device == MAX_SYSEX_DEVICES || *link == MAX_SYSEX_LINKS) {
+	    pthread_mutex_unlock(&midi_lock);
+	    return -1;
+	}
+	/* Spoken for, but with no ports the callback leaves them alone */
+	links[*link].used = 1;
+	devices[device].used = 1;
+	devices[device].timeout = 0;
+	if (*link >= num_links) num_links = *link + 1;
+	pthread_mutex_unlock(&midi_lock);
+
+	if (open_link(*link, device, name) < 0) {
+	    pthread_mutex_lock(&midi_lock);
+	    links[*link].used = 0;
+	    devices[device].used = 0;
+	    pthread_mutex_unlock(&midi_lock);
+	    return -1;
+	}
+	return device;
+}
+
+void jack_sysex_remove_device(int device) {
+	int link;
+
+	if (device <= 0 || device >= MAX_SYSEX_DEVICES) return;
+	for (link = 0; link < num_links; link++)
+	    if (links[link].used && links[link].device == device)
+		release_link(link);
+
+	pthread_mutex_lock(&midi_lock);
+	flush_sysex_list(&devices[device].in_list);
+	devices[device].in_depth = 0;
+	devices[device].used = 0;
+	pthread_mutex_unlock(&midi_lock);
+}
+
 int jack_sysex_init(const char *client_name, int timeout_time,
 						enum init_flags flags) {
 	jack_status_t jack_status;
+	int link, queue;
+
 	jack_client = 
 		jack_client_open(client_name, JackNoStartServer, &jack_status);
 	if (!jack_client) return -1;
 
 	sysex_timeout_loops = timeout_time;
-
-	if (flags & LIBGIEDITOR_READ) {
-	    midi_in_port = jack_port_register(jack_client, "sysex_midi_in",
-			JACK_DEFAULT_MIDI_TYPE,
-			JackPortIsInput | JackPortIsTerminal, 0);
-	    if (!midi_in_port) return -1;
-	}
-	
-	if (flags & LIBGIEDITOR_WRITE) {
-	    midi_out_port = jack_port_register(jack_client, "sysex_midi_out",
-			JACK_DEFAULT_MIDI_TYPE,
-			JackPortIsOutput | JackPortIsTerminal, 0);
-	    if (!midi_out_port) return -1;
+	init_flags = flags;
+	for (queue = 0; queue < SYSEX_QUEUES; queue++)
+	    last_ticket[queue] = written_ticket[queue] = queue;
+
+	devices[0].used = 1;
+	num_links = first_links;
+	for (link = 0; link < num_links; link++) {
+	    links[link].used = 1;
+	    if (open_link(link, 0, NULL) < 0) return -1;
 	}
 	
 	if (flags & LIBGIEDITOR_ACK) {
@@ -203,66 +516,111 @@ int jack_sysex_init(const char *client_name, int timeout_time,
 	
 	jack_set_process_callback(jack_client, jack_callback, 0);
 
+	stats = rt_stats_open(client_name, queue_names);
+	if (stats) jack_set_xrun_callback(jack_client, xrun_callback, 0);
+
 	if (jack_activate(jack_client)) return -1;
 
 	return 0;
 }
 
 int jack_sysex_close(void) {
+	int link, device;
+
 	jack_deactivate(jack_client);
-	if (midi_in_port)
-	    jack_port_unregister(jack_client, midi_in_port);
-	if (midi_out_port)
-	    jack_port_unregister(jack_client, midi_out_port);
+	for (link = 0; link < num_links; link++)
+	    if (links[link].used) release_link(link);
+	for (device = 0; device < MAX_SYSEX_DEVICES; device++) {
+	    flush_sysex_list(&devices[device].in_list);
+	    devices[device].in_depth = 0;
+	    devices[device].used = 0;
+	}
 	if (midi_ack_port)
 	    jack_port_unregister(jack_client, midi_ack_port);
+	rt_stats_close(stats);
+	stats = NULL;
 	return jack_client_close(jack_client);
 }
 
-void jack_sysex_send_event(uint32_t sysex_size, uint8_t *data) {
+/* A link that isn't set up goes to link 0 */
+Sysex_ticket jack_sysex_send_event_at(uint32_t sysex_size, uint8_t *data,
+		uint64_t time, enum sysex_lane lane, int link) {
+	Sysex_ticket ticket;
+
 	pthread_mutex_lock(&midi_lock);
-	add_sysex_event(&sysex_out_list, data, sysex_size); 
+	if (link < 0 || link >= num_links || !links[link].used) link = 0;
+	ticket = add_sysex_event(&links[link].out_list[lane], data,
+			sysex_size, time)->ticket =
+		next_ticket(sysex_queue(lane, link));
+	out_depth[lane]++;
 	pthread_mutex_unlock(&midi_lock);
+	return ticket;
+}
+
+Sysex_ticket jack_sysex_send_event(uint32_t sysex_size, uint8_t *data) {
+	return jack_sysex_send_event_at(sysex_size, data, 0,
+			SYSEX_LANE_REALTIME, 0);
 }
 
-void jack_sysex_send_event_ack(uint32_t sysex_size, uint8_t *data) {
+Sysex_ticket jack_sysex_send_event_ack(uint32_t sysex_size, uint8_t *data) {
+	Sysex_ticket ticket;
+
 	pthread_mutex_lock(&midi_lock);
-	add_sysex_event_ack(&sysex_out_list, data, sysex_size); 
+	ticket = add_sysex_event_ack(&links[0].out_list[SYSEX_LANE_REALTIME],
+			data, sysex_size)->ticket =
+		next_ticket(sysex_queue(SYSEX_LANE_REALTIME, 0));
+	out_depth[SYSEX_LANE_REALTIME]++;
 	pthread_mutex_unlock(&midi_lock);
+	return ticket;
 }
 
-void jack_sysex_wait_write(void) {
+void jack_sysex_wait_ticket(Sysex_ticket ticket) {
 	pthread_mutex_lock(&midi_lock);
 
-	while (sysex_out_list != NULL) {
+	while (!ticket_written(written_ticket[ticket_queue(ticket)], ticket)) {
 	    pthread_cond_wait(&write_data_ready, &midi_lock);
 	}
 
 	pthread_mutex_unlock(&midi_lock);
 }
 
-int jack_sysex_listen_event(uint8_t **data) {
+void jack_sysex_wait_write(void) {
+	Sysex_ticket tickets[SYSEX_QUEUES];
+	int queue;
+
+	pthread_mutex_lock(&midi_lock);
+	memcpy(tickets, last_ticket, sizeof(tickets));
+	pthread_mutex_unlock(&midi_lock);
+
+	for (queue = 0; queue < SYSEX_QUEUES; queue++)
+	    jack_sysex_wait_ticket(tickets[queue]);
+}
+
+int jack_sysex_listen_device(int device, uint8_t **data, uint64_t *time) {
         Sysex_list cur_sysex;
+        Device *cur_device = &devices[device];
         int data_bytes;
 
         pthread_mutex_lock(&midi_lock);
 
-        sysex_timeout = sysex_timeout_loops;
-        while (sysex_in_list == NULL && sysex_timeout != 0) {
+        cur_device->timeout = sysex_timeout_loops;
+        while (cur_device->in_list == NULL && cur_device->timeout != 0) {
             pthread_cond_wait(&read_data_ready, &midi_lock);
         }
 
         *data = NULL;
 
-        if (sysex_timeout == 0) {
+        if (cur_device->in_list == NULL) {
             pthread_mutex_unlock(&midi_lock);
             return -1;
         }
 
-        cur_sysex = sysex_in_list;
-        sysex_in_list = sysex_in_list->next;
+        cur_sysex = cur_device->in_list;
+        cur_device->in_list = cur_device->in_list->next;
+        cur_device->in_depth--;
 
         data_bytes = cur_sysex->size;
+        if (time) *time = cur_sysex->time;
 
         if (data_bytes > 0) {
             *data = allocate(uint8_t, data_bytes);
@@ -275,3 +633,34 @@ int jack_sysex_listen_event(uint8_t **data) {
 
         return data_bytes;
 }
+
+int jack_sysex_listen_event_time(uint8_t **data, uint64_t *time) {
+	return jack_sysex_listen_device(0, data, time);
+}
+
+int jack_sysex_listen_event(uint8_t **data) {
+	return jack_sysex_listen_event_time(data, NULL);
+}
+
+const Midi_transport midi_jack_transport = {
+	.name		= "jack",
+	.init		= jack_sysex_init,
+	.close		= jack_sysex_close,
+	.set_timeout	= jack_sysex_set_timeout,
+	.ms_to_timeout	= jack_sysex_ms_to_timeout,
+	.set_pacing	= jack_sysex_set_pacing,
+	.set_link_pacing = jack_sysex_set_link_pacing,
+	.set_links	= jack_sysex_set_links,
+	.add_device	= jack_sysex_add_device,
+	.remove_device	= jack_sysex_remove_device,
+	.set_bulk_budget = jack_sysex_set_bulk_budget,
+	.set_max_size	= jack_sysex_set_max_size,
+	.dropped	= jack_sysex_dropped,
+	.get_time	= jack_sysex_get_time,
+	.wait_write	= jack_sysex_wait_write,
+	.wait_ticket	= jack_sysex_wait_ticket,
+	.flush_in_list	= jack_flush_device_in_list,
+	.listen_event	= jack_sysex_listen_device,
+	.send_event	= jack_sysex_send_event_at,
+	.send_event_ack	= jack_sysex_send_event_ack,
+};
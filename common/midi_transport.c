@@ -0,0 +1,42 @@
+/* Transport selection
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ * 
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ * 
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "libgieditor.h"
+#include "midi_transport.h"
+
+const Midi_transport *midi_transport_find(const char *spec) {
+	if (!strcmp(spec, "jack")) return &midi_jack_transport;
+	if (!strncmp(spec, "daemon", 6) && (!spec[6] || spec[6] == ':')) {
+	    if (spec[6]) daemon_sysex_set_socket(&spec[7]);
+	    return &midi_daemon_transport;
+	}
+#ifdef HAVE_ALSA
+	if (!strncmp(spec, "alsa", 4) && (!spec[4] || spec[4] == ':')) {
+	    if (spec[4]) alsa_sysex_set_device(&spec[5]);
+	    return &midi_alsa_transport;
+	}
+#endif
+	return NULL;
+}
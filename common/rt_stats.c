@@ -0,0 +1,193 @@
+/* Process callback statistics
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rt_stats.h"
+#include "shm_segment.h"
+
+#define SHM_NAME_SIZE		(RT_STATS_NAME_SIZE + 32)
+
+Rt_stats *rt_stats_open(const char *name, const char **queue_names) {
+	char path[SHM_NAME_SIZE];
+	Rt_stats *stats;
+	int fd, i;
+
+	if (!getenv(STATS_ENV)) return NULL;
+
+	shm_segment_name(path, sizeof(path), RT_STATS_PREFIX, name, getpid());
+	fd = shm_open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return NULL;
+	if (ftruncate(fd, sizeof(Rt_stats)) < 0) {
+	    close(fd);
+	    shm_unlink(path);
+	    return NULL;
+	}
+	stats = mmap(NULL, sizeof(Rt_stats), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	close(fd);
+	if (stats == MAP_FAILED) {
+	    shm_unlink(path);
+	    return NULL;
+	}
+
+	/* ftruncate has zeroed it */
+	strncpy(stats->name, name, RT_STATS_NAME_SIZE - 1);
+	for (i = 0; queue_names && i < RT_STATS_QUEUES && queue_names[i]; i++)
+	    strncpy(stats->queue_names[i], queue_names[i],
+			    RT_STATS_QUEUE_NAME_SIZE - 1);
+	stats->pid = getpid();
+	__atomic_store_n(&stats->version, RT_STATS_VERSION, __ATOMIC_RELEASE);
+	return stats;
+}
+
+void rt_stats_close(Rt_stats *stats) {
+	char path[SHM_NAME_SIZE];
+
+	if (!stats) return;
+	shm_segment_name(path, sizeof(path), RT_STATS_PREFIX, stats->name,
+			stats->pid);
+	shm_unlink(path);
+	munmap(stats, sizeof(Rt_stats));
+}
+
+static uint64_t now_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t rt_stats_cycle_begin(Rt_stats *stats) {
+	return stats ? now_us() : 0;
+}
+
+/* Only the process callback writes, so plain load and store is enough for
+ * the maxima */
+void rt_stats_cycle_end(Rt_stats *stats, uint64_t begin, uint32_t period_us) {
+	uint32_t us;
+	int bucket;
+
+	if (!stats) return;
+	us = now_us() - begin;
+
+	for (bucket = 0; bucket < RT_STATS_BUCKETS - 1 && us >> (bucket + 1);)
+	    bucket++;
+	rt_stats_add(stats, hist[bucket], 1);
+	rt_stats_add(stats, busy_us, us);
+	rt_stats_add(stats, cycles, 1);
+	if (period_us && us > period_us) rt_stats_add(stats, overruns, 1);
+
+	__atomic_store_n(&stats->last_us, us, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->period_us, period_us, __ATOMIC_RELAXED);
+	if (us > __atomic_load_n(&stats->max_us, __ATOMIC_RELAXED))
+	    __atomic_store_n(&stats->max_us, us, __ATOMIC_RELAXED);
+}
+
+/* Counts the times the callback finds LOCK taken, which is when it may
+ * have to wait on a thread that isn't realtime */
+void rt_stats_lock(Rt_stats *stats, pthread_mutex_t *lock) {
+	if (stats && pthread_mutex_trylock(lock) == 0) return;
+	rt_stats_add(stats, contended, 1);
+	pthread_mutex_lock(lock);
+}
+
+void rt_stats_depth(Rt_stats *stats, int queue, uint32_t depth) {
+	if (!stats) return;
+	__atomic_store_n(&stats->depth[queue], depth, __ATOMIC_RELAXED);
+	if (depth > __atomic_load_n(&stats->max_depth[queue],
+				__ATOMIC_RELAXED))
+	    __atomic_store_n(&stats->max_depth[queue], depth,
+			    __ATOMIC_RELAXED);
+}
+
+int rt_stats_list(void (*func)(const char *shm_name, void *arg), void *arg) {
+	return shm_segment_list(RT_STATS_PREFIX, func, arg);
+}
+
+const Rt_stats *rt_stats_map(const char *shm_name) {
+	char path[SHM_NAME_SIZE];
+	const Rt_stats *stats;
+	struct stat st;
+	int fd;
+
+	snprintf(path, sizeof(path), "/%s", shm_name);
+	fd = shm_open(path, O_RDONLY, 0);
+	if (fd < 0) return NULL;
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(Rt_stats)) {
+	    close(fd);
+	    return NULL;
+	}
+	stats = mmap(NULL, sizeof(Rt_stats), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (stats == MAP_FAILED) return NULL;
+
+	if (__atomic_load_n(&stats->version, __ATOMIC_ACQUIRE) !=
+			RT_STATS_VERSION) {
+	    rt_stats_unmap(stats);
+	    return NULL;
+	}
+	return stats;
+}
+
+void rt_stats_unmap(const Rt_stats *stats) {
+	munmap((void *) stats, sizeof(Rt_stats));
+}
+
+#define LOAD(field) copy->field = __atomic_load_n(&stats->field, \
+		__ATOMIC_RELAXED)
+
+void rt_stats_read(const Rt_stats *stats, Rt_stats *copy) {
+	int i;
+
+	/* Written once, before the version */
+	memcpy(copy->name, stats->name, sizeof(copy->name));
+	memcpy(copy->queue_names, stats->queue_names,
+			sizeof(copy->queue_names));
+	copy->version = stats->version;
+	copy->pid = stats->pid;
+
+	LOAD(cycles);
+	LOAD(busy_us);
+	LOAD(last_us);
+	LOAD(max_us);
+	LOAD(period_us);
+	LOAD(overruns);
+	for (i = 0; i < RT_STATS_BUCKETS; i++) LOAD(hist[i]);
+	LOAD(events_in);
+	LOAD(events_out);
+	LOAD(contended);
+	LOAD(ack_deferred);
+	LOAD(xruns);
+	for (i = 0; i < RT_STATS_QUEUES; i++) {
+	    LOAD(depth[i]);
+	    LOAD(max_depth[i]);
+	}
+}
@@ -0,0 +1,70 @@
+/* Per-process shared memory segments
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#include "shm_segment.h"
+
+void shm_segment_name(char *buf, size_t size, const char *prefix,
+		const char *name, int pid) {
+	char *c;
+
+	snprintf(buf, size, "/%s%s.%d", prefix, name, pid);
+	/* Jack client names can have slashes, shm names can't */
+	for (c = buf + 1; *c; c++) if (*c == '/') *c = '_';
+}
+
+int shm_segment_list(const char *prefix,
+		void (*func)(const char *shm_name, void *arg), void *arg) {
+	char path[NAME_MAX + 2];
+	DIR *dir;
+	struct dirent *entry;
+	char *pid_str;
+	int num = 0;
+
+	dir = opendir(SHM_DIR);
+	if (!dir) return -1;
+
+	while ((entry = readdir(dir))) {
+	    if (strncmp(entry->d_name, prefix, strlen(prefix))) continue;
+	    pid_str = strrchr(entry->d_name, '.');
+	    if (kill(atoi(pid_str + 1), 0) < 0 && errno == ESRCH) {
+		/* Left behind by a client that didn't close */
+		snprintf(path, sizeof(path), "/%s", entry->d_name);
+		shm_unlink(path);
+		continue;
+	    }
+	    func(entry->d_name, arg);
+	    num++;
+	}
+	closedir(dir);
+	return num;
+}
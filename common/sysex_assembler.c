@@ -0,0 +1,88 @@
+/* SysEx reassembly
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ * 
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ * 
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libgieditor.h"
+#include "sysex_assembler.h"
+
+#define allocate(t, num) __common_allocate(sizeof(t) * num, "libgieditor")
+
+#define MIDI_CMD_COMMON_SYSEX       0xf0
+#define MIDI_CMD_COMMON_SYSEX_END   0xf7
+#define MIDI_CMD_REALTIME	    0xf8
+
+#define OUTSIDE		-1
+#define SKIPPING	-2
+
+void sysex_assembler_init(Sysex_assembler *assembler, int max_size) {
+	if (max_size < 2) max_size = DEFAULT_MAX_SYSEX_SIZE;
+	assembler->buf = allocate(uint8_t, max_size);
+	assembler->size = OUTSIDE;
+	assembler->max_size = max_size;
+	assembler->dropped = 0;
+}
+
+void sysex_assembler_free(Sysex_assembler *assembler) {
+	free(assembler->buf);
+	assembler->buf = NULL;
+}
+
+int sysex_assembler_feed(Sysex_assembler *assembler, uint8_t c) {
+	int size;
+
+	if (c >= MIDI_CMD_REALTIME) return 0;
+
+	if (c == MIDI_CMD_COMMON_SYSEX) {
+	    if (assembler->size >= 0) assembler->dropped++;
+	    assembler->buf[0] = c;
+	    assembler->size = 1;
+	    return 0;
+	}
+
+	if (c == MIDI_CMD_COMMON_SYSEX_END) {
+	    size = assembler->size;
+	    assembler->size = OUTSIDE;
+	    if (size < 0) return 0;
+	    assembler->buf[size++] = c;
+	    return size;
+	}
+
+	if (c & 0x80) {
+	    /* Any other status byte ends a message early */
+	    if (assembler->size >= 0) assembler->dropped++;
+	    assembler->size = OUTSIDE;
+	    return 0;
+	}
+
+	if (assembler->size < 0) return 0;
+
+	/* Leave room for the 0xf7 */
+	if (assembler->size >= assembler->max_size - 1) {
+	    assembler->dropped++;
+	    assembler->size = SKIPPING;
+	    return 0;
+	}
+	assembler->buf[assembler->size++] = c;
+	return 0;
+}
@@ -0,0 +1,70 @@
+/* gieditord protocol
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* gieditord owns the transport to the Juno and shares it between local
+ * clients, which reach it through the "daemon" transport. They talk over a
+ * Unix SOCK_SEQPACKET socket, so each packet is one Daemon_msg followed by
+ * its SIZE data bytes, and is never split or run together with another.
+ *
+ * A client starts with HELLO, giving its init flags in ARG and its name as
+ * the data, and the daemon answers HELLO with DAEMON_VERSION in ARG.
+ * SEND and SEND_ACK carry a whole SysEx message for the Juno, on LANE,
+ * DELAY (in ARG) microseconds from when the daemon gets it. TICKET is the
+ * client's own, and WAIT asks for WRITTEN to come back with the same
+ * TICKET once that message and everything before it on the lane has gone
+ * out. The daemon answers RQ1s from its cache where it can, and otherwise
+ * sends each reply only to the clients that asked for it, as EVENT.
+ * Anything else from the Juno goes to clients that have SUBSCRIBEd to it:
+ * DT1s that overlap the range from ADDR (in TICKET) for ARG bytes, and
+ * everything that isn't a DT1 to any client with a subscription.
+ * Addresses are the Juno's, 7 bits a byte. */
+
+#define DAEMON_SOCKET_ENV	"GIEDITORD_SOCKET"
+#define DAEMON_SOCKET_NAME	"gieditord"
+#define DAEMON_VERSION		1
+
+/* The largest packet either way */
+#define DAEMON_MAX_DATA		1024
+
+enum daemon_msg_type {
+	DAEMON_HELLO,
+	DAEMON_SEND,
+	DAEMON_SEND_ACK,
+	DAEMON_WAIT,
+	DAEMON_WRITTEN,
+	DAEMON_EVENT,
+	DAEMON_SUBSCRIBE,
+};
+
+typedef struct s_daemon_msg {
+	uint8_t		type;
+	uint8_t		lane;
+	uint16_t	size;
+	uint32_t	ticket;
+	uint32_t	arg;
+} Daemon_msg;
+
+/* Everything from the Juno, for SUBSCRIBE */
+#define DAEMON_ALL_ADDRESSES	0xffffffff
+
+/* Newly allocated path of the socket: $GIEDITORD_SOCKET if set, otherwise
+ * DAEMON_SOCKET_NAME in $XDG_RUNTIME_DIR, or /tmp with the user ID */
+extern char *daemon_socket_path(void);
@@ -45,12 +45,18 @@ typedef const struct s_midi_class MidiClass;
 typedef struct s_midi_class_member MidiClassMember;
 
 struct s_midi_class_member {
-	const char	    *name;
+	const uint32_t	    name_offset;
 	const uint32_t	    sysex_addr_base;
 	const MidiClass	    *class;
 	int		    blacklisted;
 };
 
+/* Member names are kept once each in one generated string, which
+ * NAME_OFFSET indexes */
+extern const char libgieditor_midi_names[];
+#define libgieditor_member_name(member) \
+	(libgieditor_midi_names + (member)->name_offset)
+
 struct s_midi_class {
 	const char		*name;
 	MidiClassMember		*members;
@@ -87,10 +93,67 @@ enum init_flags {
 	LIBGIEDITOR_ACK			= 0x04,
 };
 
+/* Picks how to reach the Juno: "jack" (the default), "daemon" or
+ * "daemon:<socket>" to share gieditord's, or where built with ALSA, "alsa"
+ * or "alsa:<rawmidi device>". Call before libgieditor_init,
+ * which otherwise takes it from $GIEDITOR_TRANSPORT if that is set.
+ * Returns -1 if the transport isn't available */
+#define TRANSPORT_ENV "GIEDITOR_TRANSPORT"
+extern int libgieditor_set_transport(const char *spec);
+
+/* Talks to the Juno over NUM links at once (the USB port and a DIN
+ * interface, say), each with its own pair of ports, and spreads bulk reads
+ * across them. Edits and writes still go over the first. Call before
+ * libgieditor_init, which otherwise takes it from $GIEDITOR_LINKS if that
+ * is set, and fails if the transport can't have that many. Jack can have
+ * up to MAX_SYSEX_LINKS, ALSA only one */
+#define LINKS_ENV "GIEDITOR_LINKS"
+extern void libgieditor_set_links(int num);
+
 extern int libgieditor_init(const char *client_name, enum init_flags flags);
 extern int libgieditor_close(void);
 
+/* Another Juno, on the client libgieditor_init opened, with its own pair of
+ * ports (NAME_midi_in and NAME_midi_out) and device ID ID. It has its own
+ * address table, patch names and queues, so values fetched from one
+ * Juno don't show up in another, and threads using different devices
+ * don't wait for each other. Jack only, and up to MAX_SYSEX_DEVICES in
+ * all. Returns NULL on failure */
+typedef struct s_gi_device GiDevice;
+extern GiDevice *libgieditor_open_device(const char *name, uint8_t id);
+extern void libgieditor_close_device(GiDevice *device);
+/* Everything the calling thread does after this goes to DEVICE, or with
+ * NULL, to the Juno libgieditor_init opened, which is where every thread
+ * starts. Only edits to that one are recorded for undo */
+extern void libgieditor_use_device(GiDevice *device);
+
 extern void libgieditor_set_timeout(int timeout_time);
+/* As above, in milliseconds whichever transport is in use. Call after
+ * libgieditor_init */
+extern void libgieditor_set_timeout_ms(int ms);
+
+/* Spaces output so it leaves no faster than BYTES_PER_SECOND (3125 for a
+ * 5 pin DIN cable), 0 for as fast as the transport goes */
+extern void libgieditor_set_pacing(int bytes_per_second);
+/* As above, for one link only */
+extern void libgieditor_set_link_pacing(int link, int bytes_per_second);
+
+/* Bulk transfers (libgieditor_send_bulk_sysex, bulk reads, and the copies,
+ * pastes and backups built on them) queue behind single edits, so an edit
+ * made during one goes out next. BYTES limits how much bulk data can be
+ * ahead of it: per Jack period, or buffered in the ALSA driver. 128 unless
+ * set, 0 for no limit */
+extern void libgieditor_set_bulk_budget(int bytes);
+
+/* Incoming SysEx longer than MAX_SIZE bytes (512 unless set, counting the
+ * 0xf0 and 0xf7) is dropped. Call before libgieditor_init. */
+extern void libgieditor_set_max_sysex_size(int max_size);
+
+/* Incoming messages dropped for being too long, or cut short */
+extern unsigned int libgieditor_sysex_dropped(void);
+
+/* Microseconds, on the clock used by the timed send and listen calls */
+extern uint64_t libgieditor_get_time(void);
 
 extern midi_address *libgieditor_match_midi_address(uint32_t sysex_addr);
 extern MidiClass *libgieditor_match_class_name(char *class_name);
@@ -100,6 +163,28 @@ extern const char *libgieditor_get_desc(uint32_t sysex_addr);
 extern uint32_t libgieditor_add_addresses(uint32_t address1,
 				uint32_t address2);
 
+/* The Juno's addresses use 7 bits of each byte. A linear address squeezes
+ * the gaps out, so addresses can be subtracted and counted through */
+extern uint32_t libgieditor_linear_addr(uint32_t sysex_addr);
+extern uint32_t libgieditor_roland_addr(uint32_t linear_addr);
+
+/* The Roland checksum of LEN bytes of DATA, the address and data of a DT1
+ * or RQ1 */
+extern int libgieditor_checksum(int len, const uint8_t *data);
+
+/* libgieditor_midi_addresses is generated in address order, so an entry's
+ * index is a dense ID for its parameter, from 0 to libgieditor_num_addresses,
+ * and the parameters starting in any range of addresses have consecutive
+ * IDs. Arrays and bitmaps over every parameter can be indexed by ID.
+ * libgieditor_param_id returns -1 if no parameter starts at SYSEX_ADDR,
+ * and libgieditor_param_addr returns -1 for an ID out of range */
+extern int libgieditor_param_id(uint32_t sysex_addr);
+extern uint32_t libgieditor_param_addr(int id);
+/* Sets FIRST and END (one past the last) to the IDs of the parameters
+ * starting in the SYSEX_SIZE bytes from SYSEX_ADDR, and returns how many */
+extern int libgieditor_param_span(uint32_t sysex_addr, uint32_t sysex_size,
+		int *first, int *end);
+
 extern char **libgieditor_get_parents(uint32_t sysex_addr, int *num);
 
 extern uint32_t libgieditor_get_sysex_size(uint32_t sysex_addr);
@@ -114,19 +199,40 @@ extern uint32_t libgieditor_get_sysex_value(uint8_t *data, uint32_t size);
  * On timeout, libgieditor_listen_sysex_event returns -1 */
 extern int libgieditor_listen_sysex_event(uint8_t *command_id, 
 		                uint32_t *address, uint8_t **data);
-
-extern void libgieditor_send_bulk_sysex(midi_address m_addresses[],
+/* As above, storing when the event arrived in *TIME */
+extern int libgieditor_listen_sysex_event_time(uint8_t *command_id, 
+		uint32_t *address, uint8_t **data, uint64_t *time);
+
+/* The send functions return a ticket for the queued message (for bulk
+ * sends, the last block), or 0 if nothing was queued. Pass it to
+ * libgieditor_wait_ticket to block until that message has been written */
+extern uint32_t libgieditor_send_bulk_sysex(midi_address m_addresses[],
 		const int num);
 
-extern void libgieditor_send_sysex(uint32_t sysex_addr,
+extern uint32_t libgieditor_send_sysex(uint32_t sysex_addr,
 		                uint32_t sysex_size, uint8_t *data);
+/* Holds the message back until TIME. Messages still go out in order, so
+ * anything sent after it waits too */
+extern uint32_t libgieditor_send_sysex_at(uint32_t sysex_addr,
+		uint32_t sysex_size, uint8_t *data, uint64_t time);
 
-extern void libgieditor_send_sysex_value(uint32_t sysex_addr,
+extern uint32_t libgieditor_send_sysex_value(uint32_t sysex_addr,
 				uint32_t sysex_size, uint32_t sysex_value);
 
+/* Blocks until the message with TICKET, and everything queued before it,
+ * has been written. Other threads' later sends aren't waited for */
+extern void libgieditor_wait_ticket(uint32_t ticket);
+/* As above, for the last message sent from the calling thread */
+extern void libgieditor_wait_sent(void);
+
 extern int libgieditor_get_bulk_sysex(midi_address m_addresses[],
 		const int num);
 
+/* Bulk reads (and copies) keep up to WINDOW requests in flight, matching
+ * each reply to its request by address. The default of 1 waits for every
+ * reply before sending the next request */
+extern void libgieditor_set_read_window(int window);
+
 /* Requests sysex data and blocks waiting for a response.
  * If a response is received, DATA points to a newly allocated buffer
  * containing the raw sysex data.
@@ -136,6 +242,20 @@ extern int libgieditor_get_bulk_sysex(midi_address m_addresses[],
  * will result in a return value of -2 with DATA set to NULL */
 extern int libgieditor_get_sysex(uint32_t sysex_addr,
 		                uint32_t sysex_size, uint8_t **data);
+/* As above, into BUF. Also fails if the reply is short */
+extern int libgieditor_get_sysex_buf(uint32_t sysex_addr,
+				uint32_t sysex_size, uint8_t *buf);
+
+/* Bulk transfers are split into blocks of at most SIZE data bytes, 120
+ * unless set (0 goes back to that) */
+extern void libgieditor_set_block_size(int size);
+extern int libgieditor_get_block_size(void);
+/* A block size for the region SYSEX_ADDR is in, by the top byte of the
+ * address, used instead of the one above (0 goes back to it). A read that
+ * fails with a block bigger than the default forgets the region's size and
+ * tries again */
+extern void libgieditor_set_region_block_size(uint32_t sysex_addr, int size);
+extern int libgieditor_get_region_block_size(uint32_t sysex_addr);
 
 extern char *libgieditor_get_patch_name(uint32_t sysex_addr);
 extern char *libgieditor_get_copy_patch_name(void);
@@ -146,15 +266,288 @@ extern int libgieditor_copy_class(MidiClass *class, uint32_t sysex_addr,
 				int *depth);
 extern int libgieditor_paste_class(MidiClass *class, uint32_t sysex_addr,
 		                int *depth);
+/* The same paste to each of DEVICES (NULL for the first) at once, from a
+ * thread each. Returns the first failure in the order of DEVICES, as
+ * above, if any. Only the first device's paste is recorded for undo */
+extern int libgieditor_paste_class_to_devices(GiDevice *devices[], int num,
+		MidiClass *class, uint32_t sysex_addr, int *depth);
 extern int libgieditor_paste_layer_to_part(MidiClass *class,
 		uint32_t sysex_addr, int *depth, int layer, int part);
 extern void libgieditor_flush_copy_data(int *depth);
+
+/* Keeps the last MAX_ENTRIES values written to the device, 0 turns history
+ * off. Values written between begin_group and end_group are undone as one
+ * edit, as are quick repeated writes to the same address and pastes */
+extern void libgieditor_undo_enable(int max_entries);
+extern void libgieditor_undo_begin_group(void);
+extern void libgieditor_undo_end_group(void);
+
+/* Both return the number of values written back, 0 if there was nothing
+ * to undo or redo */
+extern int libgieditor_undo(void);
+extern int libgieditor_redo(void);
+
+enum patch_format {
+	PATCH_FORMAT_KEYFILE,
+	PATCH_FORMAT_BINARY,
+};
+
+/* The writers take the oldest entry off the copy list. They return -1 if
+ * there is nothing to write and -2 if the file can't be written. The binary
+ * writer returns -3 if the data doesn't match its class layout.
+ * The reader accepts either format and returns -1 if the file can't be
+ * opened, -2 if it can't be parsed */
 extern int libgieditor_write_copy_data_to_file(char *filename, int *depth);
+extern int libgieditor_write_copy_data_to_binary_file(char *filename,
+				int *depth);
 extern int libgieditor_read_copy_data_from_file(char *filename, int *depth);
+extern int libgieditor_convert_patch_file(char *in_filename,
+		char *out_filename, enum patch_format format);
+
+/* Remembers the class and set name of every patch in a directory, keyed by
+ * filename and checked against the file's size and modification time, so
+ * listings don't have to parse each file. Kept in DIR/.manifest */
+typedef struct s_patch_manifest PatchManifest;
+
+typedef struct s_manifest_entry {
+	char			*filename;
+	uint64_t		size;
+	int64_t			mtime;		/* Nanoseconds */
+	const MidiClass		*class;		/* NULL if unparseable */
+	char			name[MAX_SET_NAME_SIZE + 1];
+} ManifestEntry;
+
+extern PatchManifest *libgieditor_manifest_open(const char *dir);
+/* Returns NULL if FILENAME doesn't exist. A missing or stale entry is
+ * refreshed from the file if PARSE is set, otherwise NULL is returned.
+ * NAME is empty unless the patch is a studio or live set */
+extern const ManifestEntry *libgieditor_manifest_lookup(
+		PatchManifest *manifest, const char *filename, int parse);
+extern int libgieditor_manifest_save(PatchManifest *manifest);
+extern void libgieditor_manifest_close(PatchManifest *manifest);
+
+/* Brings a manifest up to date in the background, with one worker thread
+ * per CPU. Only the class and name of each file are read. Finished entries
+ * are handed back one at a time by libgieditor_scan_poll(), which (like the
+ * rest of the manifest API) must be called from the manifest's own thread.
+ * libgieditor_scan_stop() may be called before the scan is done. */
+typedef struct s_patch_scan PatchScan;
+
+extern PatchScan *libgieditor_scan_start(PatchManifest *manifest,
+		char **filenames, int num);
+extern const ManifestEntry *libgieditor_scan_poll(PatchScan *scan);
+extern int libgieditor_scan_done(PatchScan *scan);
+extern void libgieditor_scan_stop(PatchScan *scan);
+
+/* Content addressed patch library. Each distinct set of values is stored
+ * once, named by a hash of its class and values. An index of names,
+ * classes, tags and a few chosen parameter values is kept alongside, so
+ * queries never have to open the patches themselves. */
+#define STORE_HASH_SIZE 16
+#define STORE_NO_PARAM UINT32_MAX
+
+typedef struct s_patch_store PatchStore;
+
+typedef struct s_store_entry {
+	char			hash[STORE_HASH_SIZE + 1];
+	const MidiClass		*class;
+	uint32_t		sysex_addr_base;
+	char			name[MAX_SET_NAME_SIZE + 1];
+	char			*tags;		/* Comma separated, or NULL */
+	uint32_t		*params;	/* Or STORE_NO_PARAM */
+} StoreEntry;
+
+/* Unset (NULL) fields match anything. PARAM indexes the store's
+ * parameters, -1 to ignore them */
+typedef struct s_store_query {
+	const MidiClass		*class;
+	const char		*name;		/* Substring, any case */
+	const char		*tag;
+	int			param;
+	uint32_t		param_min;
+	uint32_t		param_max;
+} StoreQuery;
+
+/* PARAMS are the addresses (relative to the class) whose values are
+ * indexed. If NUM_PARAMS is 0, the ones the store already has are used */
+extern PatchStore *libgieditor_store_open(const char *dir,
+		const uint32_t *params, int num_params);
+extern int libgieditor_store_save(PatchStore *store);
+extern void libgieditor_store_close(PatchStore *store);
+/* Both return the existing entry if the patch is already stored, with TAGS
+ * (comma separated) added to it. The copy data is taken off the copy
+ * list. NULL is returned on failure */
+extern const StoreEntry *libgieditor_store_add_copy_data(PatchStore *store,
+		int *depth, const char *tags);
+extern const StoreEntry *libgieditor_store_import_file(PatchStore *store,
+		const char *filename, const char *tags);
+extern int libgieditor_store_add_tag(PatchStore *store, const char *hash,
+		const char *tag);
+/* RESULTS is newly allocated, the return value is the number of matches */
+extern int libgieditor_store_query(PatchStore *store,
+		const StoreQuery *query, const StoreEntry ***results);
+/* Puts a stored patch on the copy list */
+extern int libgieditor_store_load(PatchStore *store, const char *hash,
+		int *depth);
+
+/* Nearest neighbour search over the stored patches of one class. Values
+ * are scaled to 0..1 and compared by weighted squared distance, every
+ * parameter weighing 1 except set names, which weigh nothing. If COARSE is
+ * set, large libraries are clustered and only the nearest clusters are
+ * searched. The index is a snapshot, rebuild it after adding patches. */
+typedef struct s_similarity_index SimilarityIndex;
+
+typedef struct s_similar_match {
+	const StoreEntry	*entry;
+	float			distance;
+} SimilarMatch;
+
+extern SimilarityIndex *libgieditor_similar_build(PatchStore *store,
+		MidiClass *class, int coarse);
+/* SYSEX_ADDR is relative to the class */
+extern int libgieditor_similar_set_weight(SimilarityIndex *index,
+		uint32_t sysex_addr, float weight);
+/* Compares against the oldest entry on the copy list (as left by
+ * libgieditor_copy_class()), which stays there. Fills in up to K MATCHES,
+ * nearest first, and returns how many. Returns -1 if the copy list is
+ * empty, -2 if the copied class doesn't match */
+extern int libgieditor_similar_query(SimilarityIndex *index, int k,
+		SimilarMatch *matches);
+extern void libgieditor_similar_free(SimilarityIndex *index);
+
+/* Whole device backups: every member of the top level class (setup,
+ * system, the temporary sets and all the user live sets) goes into one
+ * archive, with a checksum per member. Each member is synced to disk as
+ * soon as it's read, and if RESUME is set, members already in an existing
+ * archive are kept and skipped. Returns -1 if FILENAME can't be opened, -2
+ * if it can't be written or resumed, -4 if the device can't be read.
+ * PROGRESS, if given, is called after each member */
+typedef void (*BackupProgress)(int done, int total, const char *name,
+		void *arg);
+
+extern int libgieditor_backup(const char *filename, int resume,
+		BackupProgress progress, void *arg);
+/* Only values that differ from the device are sent, and each member is read
+ * back afterwards. Returns the number of members that didn't verify, -1 if
+ * FILENAME can't be opened, -2 if it's damaged (nothing is sent) or -4 if
+ * the device stops answering */
+extern int libgieditor_restore(const char *filename,
+		BackupProgress progress, void *arg);
+
+/* Listens for DT1 messages from the device (edits made on its panel, and
+ * patches written) and appends each one to the journal FILENAME. Every
+ * record is flushed as it arrives, so it's safe to kill. Only returns if
+ * the journal can't be opened (-1) or written (-2). It can keep running
+ * through a backup, though it will log the replies to the backup's own
+ * requests, so the next backup rereads those members too */
+extern int libgieditor_journal(const char *filename);
+/* NAMES (newly allocated) gets the names of the top level members the
+ * journal has seen changes to, the return value is how many */
+extern int libgieditor_journal_changes(const char *filename,
+		const char ***names);
+/* Rereads only the members named in JOURNAL (and any missing from the
+ * archive), takes everything else from the archive FILENAME and replaces
+ * it with the result. The records the backup has covered are then dropped
+ * from the journal, and any logged since are kept. If FILENAME
+ * doesn't exist yet, a full backup is made and the journal started.
+ * Returns as libgieditor_backup(), or -1 if the journal can't be opened */
+extern int libgieditor_backup_incremental(const char *filename,
+		const char *journal, BackupProgress progress, void *arg);
+
+#define MAX_PROFILE_REGIONS 16
+
+typedef struct s_region_block_size {
+	uint32_t		sysex_addr;
+	int			block_size;
+} RegionBlockSize;
+
+/* What gi_probe measured of the Juno and the link to it. -1 in any field
+ * means not known, and leaves the setting alone. BLOCK_SIZE is the
+ * smallest of the regions', for regions not listed */
+typedef struct s_device_profile {
+	int			block_size;
+	int			timeout_ms;
+	int			pacing;
+	int			bulk_budget;
+	int			num_regions;
+	RegionBlockSize		regions[MAX_PROFILE_REGIONS];
+} DeviceProfile;
+
+/* libgieditor_init loads $GIEDITOR_PROFILE, or if that isn't set, the
+ * default profile if there is one. Set it empty to load nothing */
+#define PROFILE_ENV "GIEDITOR_PROFILE"
+
+/* Newly allocated path of the default profile */
+extern char *libgieditor_default_profile(void);
+/* Return -1 if FILENAME can't be read, -2 if it isn't a profile */
+extern int libgieditor_read_profile(const char *filename,
+		DeviceProfile *profile);
+extern void libgieditor_apply_profile(const DeviceProfile *profile);
+extern int libgieditor_load_profile(const char *filename);
+/* NOTES, if given, goes at the top as comments */
+extern int libgieditor_save_profile(const char *filename,
+		const DeviceProfile *profile, const char *notes);
+
+/* With $GIEDITOR_MIRROR set, libgieditor_init publishes every value read
+ * from or written to the first Juno in shared memory, at its index in
+ * libgieditor_midi_addresses, so other processes can read them without
+ * asking the Juno or making a system call. */
+#define MIRROR_ENV "GIEDITOR_MIRROR"
+/* Values are consistent with each other in blocks this long */
+#define MIRROR_BLOCK 64
+
+typedef struct s_param_mirror Param_mirror;
+
+/* For readers. libgieditor_mirror_list calls FUNC with the shared memory
+ * name of each mirror whose process is still running, and returns how many
+ * there were. libgieditor_mirror_map maps one read only, returning NULL if
+ * it's gone or was built from a different address table */
+extern int libgieditor_mirror_list(
+		void (*func)(const char *shm_name, void *arg), void *arg);
+extern const Param_mirror *libgieditor_mirror_map(const char *shm_name);
+extern void libgieditor_mirror_unmap(const Param_mirror *mirror);
+/* Changes whenever a value may have, so a poller can tell there's nothing
+ * new without reading any */
+extern uint32_t libgieditor_mirror_generation(const Param_mirror *mirror);
+/* Copies NUM values from index FIRST into VALUES, and if KNOWN isn't NULL,
+ * whether each has been read or written yet. Returns -1 if the range is
+ * out of the table */
+extern int libgieditor_mirror_read(const Param_mirror *mirror, int first,
+		int num, uint32_t *values, uint8_t *known);
+
+/* Called from libgieditor_listen_sysex_event for each parameter a DT1 from
+ * the Juno changes, or gives for the first time, after its entry in the
+ * address table has been updated. OLD_VALUE is what the entry held, and
+ * means nothing unless OLD_KNOWN */
+typedef void (*ParamCallback)(midi_address *m_address, uint32_t old_value,
+		int old_known, void *arg);
+
+/* Calls CALLBACK for changes to any parameter overlapping SYSEX_SIZE bytes
+ * from SYSEX_ADDR. Returns an ID for libgieditor_unsubscribe, or -1 */
+extern int libgieditor_subscribe(uint32_t sysex_addr, uint32_t sysex_size,
+		ParamCallback callback, void *arg);
+/* The same, for everything libgieditor_copy_class would copy from the
+ * member of CLASS at SYSEX_ADDR */
+extern int libgieditor_subscribe_class(MidiClass *class, uint32_t sysex_addr,
+		ParamCallback callback, void *arg);
+/* A DT1 already being passed on may still reach the callback once */
+extern void libgieditor_unsubscribe(int id);
 
 #ifdef LIBGIEDITOR_PRIVATE
 
 #define MAX_SYSEX_PACKET_SIZE 120
+/* The largest DT1 reply, at 13 bytes besides the data, still within the
+ * 512 byte incoming message limit */
+#define MAX_BLOCK_SIZE 499
+#define BLOCK_REGION_SHIFT 24
+#define NUM_BLOCK_REGIONS 256
+
+/* The calling thread's device's copy of libgieditor_midi_addresses */
+extern midi_address *libgieditor_address_table(void);
+/* FIRST and END (just past the last byte) of everything under the member
+ * of CLASS at SYSEX_ADDR. Returns -1 if there isn't one */
+extern int libgieditor_class_range(MidiClass *class, uint32_t sysex_addr,
+		uint32_t *first, uint32_t *end);
 
 #define FIRST_USER_PATCH_ADDR 0x20000000
 #define USER_PATCH_DELTA 0x10000 
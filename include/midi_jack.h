@@ -23,9 +23,31 @@ extern int jack_sysex_init(const char *client_name, int timeout_time,
 		enum init_flags flags);
 extern int jack_sysex_close(void);
 extern void jack_sysex_set_timeout(int timeout_time);
+extern int jack_sysex_ms_to_timeout(int ms);
+extern void jack_sysex_set_pacing(int bytes_per_second);
+extern void jack_sysex_set_link_pacing(int link, int bytes_per_second);
+extern int jack_sysex_set_links(int num);
+extern int jack_sysex_add_device(const char *name, int *link);
+extern void jack_sysex_remove_device(int device);
+extern void jack_sysex_set_bulk_budget(int bytes);
+extern void jack_sysex_set_max_size(int max_size);
+extern unsigned int jack_sysex_dropped(void);
+extern uint64_t jack_sysex_get_time(void);
 extern void jack_sysex_wait_write(void);
+extern void jack_sysex_wait_ticket(uint32_t ticket);
 
+/* These are for device 0 */
 extern void jack_flush_sysex_in_list(void);
 extern int jack_sysex_listen_event(uint8_t **data);
-extern void jack_sysex_send_event(uint32_t sysex_size, uint8_t *data);
-extern void jack_sysex_send_event_ack(uint32_t sysex_size, uint8_t *data);
+extern int jack_sysex_listen_event_time(uint8_t **data, uint64_t *time);
+extern void jack_flush_device_in_list(int device);
+extern int jack_sysex_listen_device(int device, uint8_t **data,
+		uint64_t *time);
+
+/* These return a ticket to pass to jack_sysex_wait_ticket. Unless LANE
+ * and LINK say otherwise, messages go on the realtime lane of link 0 */
+extern uint32_t jack_sysex_send_event(uint32_t sysex_size, uint8_t *data);
+extern uint32_t jack_sysex_send_event_at(uint32_t sysex_size, uint8_t *data,
+		uint64_t time, enum sysex_lane lane, int link);
+extern uint32_t jack_sysex_send_event_ack(uint32_t sysex_size,
+		uint8_t *data);
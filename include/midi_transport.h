@@ -0,0 +1,131 @@
+/* MIDI transports
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ * 
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ * 
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Whatever moves whole SysEx messages to and from the Juno. sysex.c goes
+ * through one of these and doesn't care which. Messages handed to
+ * listen_event start with 0xf0 and end with 0xf7.
+ * Times are microseconds on the transport's clock, as given by get_time.
+ * listen_event stores when the message arrived in *TIME if TIME isn't NULL,
+ * and send_event holds the message back until TIME, or sends it as soon as
+ * it can if TIME is 0. Messages go out on one of two lanes: anything due
+ * on the realtime lane goes ahead of the bulk lane, and within a lane
+ * messages go out in the order they're sent. set_bulk_budget limits how
+ * much bulk data may be sent ahead of a realtime message that turns up
+ * (bytes per process cycle for Jack, bytes buffered in the driver for
+ * ALSA), so edits cut in within about a message's time. 0 is no limit,
+ * and one bulk message always fits.
+ * send_event_ack always uses the realtime lane.
+ * set_pacing limits output to BYTES_PER_SECOND, and may be NULL where the
+ * device already does that.
+ * ms_to_timeout converts milliseconds to set_timeout's units, and only
+ * works after init.
+ * set_max_size sets the longest message that will be received, and must
+ * be called before init. dropped counts messages thrown away for being
+ * longer than that or cut short.
+ * A transport may reach the Juno over more than one link (USB and DIN,
+ * say), each with its own ports. set_links sets how many, before init, and
+ * is NULL where there's only ever one. Replies from every link arrive
+ * through listen_event. send_event's LINK picks the one a message goes out
+ * on; each link keeps its own lanes, pacing and bulk budget, and link 0
+ * is the only one used unless asked. set_link_pacing paces one link, where
+ * set_pacing does them all.
+ * A transport may also serve more than one Juno. add_device registers
+ * another, on a link of its own with ports named after NAME, and returns
+ * its number, storing the link in *LINK. Device 0 is the one init opens.
+ * Each device has its own input, so listen_event and flush_in_list take
+ * the device. add_device and remove_device are NULL where there's only
+ * ever one.
+ * The send calls return a ticket, and wait_ticket returns once that
+ * message has been written, without waiting for anything queued after
+ * it. Each lane of each link counts its own tickets up in steps of
+ * SYSEX_QUEUES, so the queue is the remainder, skipping 0, and wrapping.
+ * wait_write waits for everything queued so far, on every queue. */
+typedef uint32_t Sysex_ticket;
+
+enum sysex_lane {
+	SYSEX_LANE_REALTIME,
+	SYSEX_LANE_BULK,
+	SYSEX_LANES
+};
+
+#define DEFAULT_BULK_BUDGET	128
+#define MAX_SYSEX_LINKS		8
+#define MAX_SYSEX_DEVICES	4
+#define SYSEX_QUEUES		(SYSEX_LANES * MAX_SYSEX_LINKS)
+
+#define sysex_queue(lane, link) ((link) * SYSEX_LANES + (lane))
+#define ticket_queue(ticket) ((ticket) % SYSEX_QUEUES)
+#define ticket_lane(ticket) ((ticket) % SYSEX_LANES)
+#define ticket_link(ticket) (ticket_queue(ticket) / SYSEX_LANES)
+
+/* Whether TICKET has gone out, given the last one written on its lane */
+#define ticket_written(last_written, ticket) \
+	((int32_t) ((last_written) - (ticket)) >= 0)
+
+typedef struct s_midi_transport {
+	const char	*name;
+	int		(*init)(const char *client_name, int timeout_time,
+				enum init_flags flags);
+	int		(*close)(void);
+	void		(*set_timeout)(int timeout_time);
+	int		(*ms_to_timeout)(int ms);
+	void		(*set_pacing)(int bytes_per_second);
+	void		(*set_link_pacing)(int link, int bytes_per_second);
+	int		(*set_links)(int num);
+	int		(*add_device)(const char *name, int *link);
+	void		(*remove_device)(int device);
+	void		(*set_bulk_budget)(int bytes);
+	void		(*set_max_size)(int max_size);
+	unsigned int	(*dropped)(void);
+	uint64_t	(*get_time)(void);
+	void		(*wait_write)(void);
+	void		(*wait_ticket)(Sysex_ticket ticket);
+	void		(*flush_in_list)(int device);
+	int		(*listen_event)(int device, uint8_t **data,
+				uint64_t *time);
+	Sysex_ticket	(*send_event)(uint32_t sysex_size, uint8_t *data,
+				uint64_t time, enum sysex_lane lane, int link);
+	Sysex_ticket	(*send_event_ack)(uint32_t sysex_size, uint8_t *data);
+} Midi_transport;
+
+/* Timeouts are in process cycles */
+extern const Midi_transport midi_jack_transport;
+
+/* Through gieditord. Timeouts are in milliseconds */
+extern const Midi_transport midi_daemon_transport;
+
+/* Where to find gieditord, rather than daemon_socket_path. Call before
+ * init */
+extern void daemon_sysex_set_socket(const char *path);
+
+#ifdef HAVE_ALSA
+/* Timeouts are in milliseconds */
+extern const Midi_transport midi_alsa_transport;
+
+/* Rawmidi device to open, "hw:1,0,0" say. Call before init */
+extern void alsa_sysex_set_device(const char *device);
+#endif
+
+/* The transport SPEC names: "jack", "daemon" optionally followed by ":" and
+ * the socket's path, or "alsa" optionally followed by ":" and a rawmidi
+ * device name, which are passed on as they're found. NULL if it's none of
+ * those */
+extern const Midi_transport *midi_transport_find(const char *spec);
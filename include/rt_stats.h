@@ -0,0 +1,91 @@
+/* Process callback statistics
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Counters kept by a Jack process callback, in POSIX shared memory so
+ * gi_stat can watch them from outside. Only the callback writes them, with
+ * relaxed atomics, so it never blocks or takes a lock. Readers copy them
+ * out with rt_stats_read; each value is consistent on its own, though not
+ * necessarily with the others.
+ * Statistics are only kept if STATS_ENV is set in the environment, and
+ * rt_stats_open returns NULL otherwise. Everything else accepts NULL and
+ * does nothing, so callers don't need to check. */
+
+#define STATS_ENV		"GIEDITOR_STATS"
+#define RT_STATS_PREFIX		"gieditor-stats."
+#define RT_STATS_VERSION	1
+
+/* Cycle times go in power of two buckets: bucket 0 is under 2us, bucket
+ * N is 2^N to 2^(N+1) us, and the last takes everything longer */
+#define RT_STATS_BUCKETS	16
+#define RT_STATS_QUEUES		4
+#define RT_STATS_NAME_SIZE	32
+#define RT_STATS_QUEUE_NAME_SIZE 12
+
+typedef struct s_rt_stats {
+	uint32_t	version;
+	int32_t		pid;
+	char		name[RT_STATS_NAME_SIZE];
+	char		queue_names[RT_STATS_QUEUES][RT_STATS_QUEUE_NAME_SIZE];
+
+	uint64_t	cycles;
+	uint64_t	busy_us;	/* Total time spent in the callback */
+	uint32_t	last_us;
+	uint32_t	max_us;
+	uint32_t	period_us;	/* Length of the last period */
+	uint32_t	overruns;	/* Cycles longer than their period */
+	uint64_t	hist[RT_STATS_BUCKETS];
+
+	uint64_t	events_in;
+	uint64_t	events_out;
+	uint64_t	contended;	/* Lock wasn't free when we got there */
+	uint64_t	ack_deferred;	/* Cycles held up waiting for an ACK */
+	uint64_t	xruns;		/* As reported by Jack */
+
+	uint32_t	depth[RT_STATS_QUEUES];	/* At the end of the cycle */
+	uint32_t	max_depth[RT_STATS_QUEUES];
+} Rt_stats;
+
+/* Creates and maps the shared memory for client NAME. QUEUE_NAMES labels
+ * up to RT_STATS_QUEUES queues whose depth is recorded, and ends with NULL */
+extern Rt_stats *rt_stats_open(const char *name, const char **queue_names);
+extern void rt_stats_close(Rt_stats *stats);
+
+/* Called by the process callback */
+extern uint64_t rt_stats_cycle_begin(Rt_stats *stats);
+extern void rt_stats_cycle_end(Rt_stats *stats, uint64_t begin,
+		uint32_t period_us);
+extern void rt_stats_lock(Rt_stats *stats, pthread_mutex_t *lock);
+extern void rt_stats_depth(Rt_stats *stats, int queue, uint32_t depth);
+
+#define rt_stats_add(stats, field, n) do { \
+	if (stats) __atomic_fetch_add(&(stats)->field, (n), __ATOMIC_RELAXED); \
+} while (0)
+
+/* For readers. rt_stats_list calls FUNC with the shared memory name of
+ * each set of statistics whose process is still running, and returns how
+ * many there were. Any left behind by processes that have gone are
+ * removed. rt_stats_map maps one read only, returning NULL if it's gone or
+ * from an incompatible version */
+extern int rt_stats_list(void (*func)(const char *shm_name, void *arg),
+		void *arg);
+extern const Rt_stats *rt_stats_map(const char *shm_name);
+extern void rt_stats_unmap(const Rt_stats *stats);
+extern void rt_stats_read(const Rt_stats *stats, Rt_stats *copy);
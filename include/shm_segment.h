@@ -0,0 +1,37 @@
+/* Per-process shared memory segments
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Segments in POSIX shared memory named PREFIX, a client name and the
+ * process ID, one per process, such as rt_stats and the parameter mirror
+ * keep. Needs stdio.h */
+
+#define SHM_DIR			"/dev/shm"
+
+/* Fills BUF (SIZE bytes) with the name of NAME's segment for process PID,
+ * with the leading slash shm_open wants */
+extern void shm_segment_name(char *buf, size_t size, const char *prefix,
+		const char *name, int pid);
+/* Calls FUNC with the name (without the slash) of each segment starting
+ * with PREFIX whose process is still running, and returns how many there
+ * were, or -1 if they can't be listed. Any left behind by processes that
+ * have gone are removed */
+extern int shm_segment_list(const char *prefix,
+		void (*func)(const char *shm_name, void *arg), void *arg);
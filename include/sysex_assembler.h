@@ -0,0 +1,43 @@
+/* SysEx reassembly
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ * 
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ * 
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#define DEFAULT_MAX_SYSEX_SIZE	    512
+
+/* Collects one SysEx message from an input, however it's split up. Keep one
+ * per input, since bytes from different inputs can't be mixed. */
+typedef struct s_sysex_assembler {
+	uint8_t		*buf;
+	int		size;		/* -1 outside a message, -2 skipping one */
+	int		max_size;	/* Including 0xf0 and 0xf7 */
+	unsigned int	dropped;
+} Sysex_assembler;
+
+extern void sysex_assembler_init(Sysex_assembler *assembler, int max_size);
+extern void sysex_assembler_free(Sysex_assembler *assembler);
+
+/* Takes the next byte from the input. Returns the size of the message in
+ * ASSEMBLER->buf when C completes one, 0 otherwise. Messages cut short by
+ * another status byte, or longer than max_size, are dropped and counted.
+ * Realtime bytes are ignored. */
+extern int sysex_assembler_feed(Sysex_assembler *assembler, uint8_t c);
+
+/* True while in the middle of a message */
+#define sysex_assembler_busy(assembler) ((assembler)->size != -1)
@@ -0,0 +1,103 @@
+/* Arena allocator
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libgieditor.h"
+#include "arena.h"
+
+#define ARENA_ALIGN		    16
+#define ALIGN_UP(n)		    (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define BLOCK_HEADER_SIZE	    ALIGN_UP(sizeof(struct s_arena_block))
+#define BLOCK_DATA(block)	    ((uint8_t *) (block) + BLOCK_HEADER_SIZE)
+
+static Arena_block new_block(size_t size) {
+	Arena_block block = __common_allocate(BLOCK_HEADER_SIZE + size,
+			"libgieditor");
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+void arena_init(Arena *arena, size_t block_size) {
+	arena->blocks = NULL;
+	arena->block_size = block_size ? block_size : ARENA_BLOCK_SIZE;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+	Arena_block block = arena->blocks;
+	size_t block_size = arena->block_size ?
+			arena->block_size : ARENA_BLOCK_SIZE;
+	void *retval;
+
+	size = ALIGN_UP(size ? size : 1);
+
+	if (!block || block->size - block->used < size) {
+	    block = new_block(size > block_size ? size : block_size);
+	    block->next = arena->blocks;
+	    arena->blocks = block;
+	}
+
+	retval = BLOCK_DATA(block) + block->used;
+	block->used += size;
+	return retval;
+}
+
+Arena_mark arena_mark(Arena *arena) {
+	Arena_mark mark;
+	mark.block = arena->blocks;
+	mark.used = arena->blocks ? arena->blocks->used : 0;
+	return mark;
+}
+
+void arena_release(Arena *arena, Arena_mark mark) {
+	Arena_block block;
+
+	while (arena->blocks != mark.block) {
+	    block = arena->blocks;
+	    /* Hang on to the oldest block, it's going to be needed again */
+	    if (!block->next && !mark.block) {
+		block->used = 0;
+		return;
+	    }
+	    arena->blocks = block->next;
+	    free(block);
+	}
+
+	if (mark.block) mark.block->used = mark.used;
+}
+
+void arena_reset(Arena *arena) {
+	Arena_mark mark = { NULL, 0 };
+	arena_release(arena, mark);
+}
+
+void arena_free(Arena *arena) {
+	Arena_block block;
+	while (arena->blocks) {
+	    block = arena->blocks;
+	    arena->blocks = block->next;
+	    free(block);
+	}
+}
@@ -0,0 +1,50 @@
+/* Arena allocator
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#define ARENA_BLOCK_SIZE	    (64 * 1024)
+
+typedef struct s_arena_block *Arena_block;
+struct s_arena_block {
+	Arena_block	next;
+	size_t		size;
+	size_t		used;
+};
+
+typedef struct s_arena {
+	Arena_block	blocks;
+	size_t		block_size;
+} Arena;
+
+/* Remembers the allocation point of an arena, so everything allocated after
+ * it can be released in one step with arena_release() */
+typedef struct s_arena_mark {
+	Arena_block	block;
+	size_t		used;
+} Arena_mark;
+
+/* A zeroed (static) arena is ready to use with the default block size */
+extern void arena_init(Arena *arena, size_t block_size);
+extern void *arena_alloc(Arena *arena, size_t size);
+extern Arena_mark arena_mark(Arena *arena);
+extern void arena_release(Arena *arena, Arena_mark mark);
+/* Drops everything, but keeps the first block for reuse */
+extern void arena_reset(Arena *arena);
+extern void arena_free(Arena *arena);
@@ -0,0 +1,673 @@
+/* Whole device backup and restore
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#define LIBGIEDITOR_PRIVATE
+#include <libgieditor.h>
+#include "midi_addresses.h"
+#include "sysex.h"
+#include "arena.h"
+#include "copy_data.h"
+#include "patch_file.h"
+
+#define allocate(t, num) __common_allocate(sizeof(t) * num, "libgieditor")
+
+/* A backup is a header followed by one item per member of the top class, in
+ * the order they were read. Each item holds the member's base address, the
+ * layout hash and size of its class, a checksum, then one uint32_t value
+ * per leaf address in class layout order (as in a binary snapshot). Items
+ * are appended and synced one at a time, so an interrupted backup loses at
+ * most the item being written. Native byte order, swapped on load. */
+#define BACKUP_MAGIC		"GiBackup"
+#define BACKUP_VERSION		1
+#define BACKUP_BYTE_ORDER	0x01020304
+
+/* Addresses sent between waits for the output queue to drain */
+#define RESTORE_CHUNK		128
+
+/* A journal has the same header, then one record per DT1 message received:
+ * its address and data byte count, then the data bytes. It only needs to
+ * say which members have changed since the last backup, the values
+ * themselves are read again from the device. The writer holds an flock()
+ * while it adds each record, and a backup holds one while it replaces the
+ * file, after which the writer opens the new one. */
+#define JOURNAL_MAGIC		"GiJournl"
+#define JOURNAL_VERSION		1
+
+struct s_backup_header {
+	char		magic[8];
+	uint32_t	byte_order;
+	uint16_t	version;
+	uint16_t	header_size;
+};
+
+struct s_backup_item {
+	uint32_t	sysex_addr_base;
+	uint32_t	layout_hash;
+	uint32_t	size;
+	uint32_t	checksum;
+};
+
+struct s_journal_record {
+	uint32_t	sysex_addr;
+	uint32_t	size;
+};
+
+#define top_class libgieditor_top_midi_class
+
+/* FNV-1a over the item fields and values, taken a byte at a time from the
+ * least significant end so it doesn't depend on byte order */
+static void checksum_word(uint32_t *hash, uint32_t word) {
+	int i;
+
+	for (i = 0; i < 4; i++) {
+	    *hash ^= (word >> (i * 8)) & 0xff;
+	    *hash *= 16777619u;
+	}
+}
+
+static uint32_t item_checksum(const struct s_backup_item *item,
+		const uint32_t *values) {
+	uint32_t hash = 2166136261u;
+	int i;
+
+	checksum_word(&hash, item->sysex_addr_base);
+	checksum_word(&hash, item->layout_hash);
+	checksum_word(&hash, item->size);
+	for (i = 0; i < item->size; i++) checksum_word(&hash, values[i]);
+	return hash;
+}
+
+static int top_member_index(uint32_t sysex_addr_base) {
+	int i;
+
+	for (i = 0; i < top_class.size; i++) {
+	    if (top_class.members[i].class &&
+			top_class.members[i].sysex_addr_base == sysex_addr_base)
+		return i;
+	}
+	return -1;
+}
+
+/* The member whose area holds SYSEX_ADDR */
+static int top_member_at(uint32_t sysex_addr) {
+	int i, member = -1;
+
+	for (i = 0; i < top_class.size; i++) {
+	    if (!top_class.members[i].class) continue;
+	    if (top_class.members[i].sysex_addr_base > sysex_addr) break;
+	    member = i;
+	}
+	return member;
+}
+
+static int read_header(FILE *fp, const char *magic, int version,
+		int *swap) {
+	struct s_backup_header header;
+
+	if (fread(&header, sizeof(header), 1, fp) != 1) return -2;
+	if (memcmp(header.magic, magic, sizeof(header.magic)))
+	    return -2;
+
+	if (header.byte_order == BACKUP_BYTE_ORDER) *swap = 0;
+	else if (header.byte_order == __builtin_bswap32(BACKUP_BYTE_ORDER)) {
+	    *swap = 1;
+	    header.version = __builtin_bswap16(header.version);
+	    header.header_size = __builtin_bswap16(header.header_size);
+	} else return -2;
+
+	if (header.version != version ||
+			header.header_size < sizeof(header)) return -2;
+	if (fseek(fp, header.header_size, SEEK_SET)) return -2;
+	return 0;
+}
+
+static int write_header(FILE *fp, const char *magic, int version) {
+	struct s_backup_header header;
+
+	memcpy(header.magic, magic, sizeof(header.magic));
+	header.byte_order = BACKUP_BYTE_ORDER;
+	header.version = version;
+	header.header_size = sizeof(header);
+	if (fwrite(&header, sizeof(header), 1, fp) != 1) return -2;
+	return 0;
+}
+
+/* Returns 1 at the end of the file. *VALUES is newly allocated if an item
+ * was read, which is only if it is complete, matches the class layout of
+ * its member and passes its checksum. Returns -2 otherwise */
+static int read_item(FILE *fp, int swap, struct s_backup_item *item,
+		uint32_t **values) {
+	const midi_address *layout;
+	uint32_t hash;
+	size_t length;
+	int i, size;
+
+	*values = NULL;
+	length = fread(item, 1, sizeof(*item), fp);
+	if (length == 0 && feof(fp)) return 1;
+	if (length != sizeof(*item)) return -2;
+
+	if (swap) {
+	    item->sysex_addr_base = __builtin_bswap32(item->sysex_addr_base);
+	    item->layout_hash = __builtin_bswap32(item->layout_hash);
+	    item->size = __builtin_bswap32(item->size);
+	    item->checksum = __builtin_bswap32(item->checksum);
+	}
+
+	i = top_member_index(item->sysex_addr_base);
+	if (i < 0) return -2;
+	layout = class_layout(top_class.members[i].class,
+			item->sysex_addr_base, &size, &hash);
+	if (!layout || size != item->size || hash != item->layout_hash)
+	    return -2;
+
+	*values = allocate(uint32_t, size);
+	if (fread(*values, sizeof(uint32_t), size, fp) != size) goto failed;
+	if (swap) {
+	    for (i = 0; i < size; i++)
+		(*values)[i] = __builtin_bswap32((*values)[i]);
+	}
+	if (item_checksum(item, *values) != item->checksum) goto failed;
+	return 0;
+
+failed:
+	free(*values);
+	*values = NULL;
+	return -2;
+}
+
+/* The copy list may already hold the caller's entries, ours go on the end */
+static Class_data *newest_copy_data(void) {
+	Class_data *cur_class_data = peek_copy_data();
+
+	while (cur_class_data->next) cur_class_data = cur_class_data->next;
+	return cur_class_data;
+}
+
+/* Fills in the checksum */
+static int write_item(FILE *fp, struct s_backup_item *item,
+		const uint32_t *values) {
+	item->checksum = item_checksum(item, values);
+
+	if (fwrite(item, sizeof(*item), 1, fp) != 1 ||
+		    fwrite(values, sizeof(uint32_t), item->size, fp) !=
+		    item->size || fflush(fp))
+	    return -2;
+	return 0;
+}
+
+static int backup_member(FILE *fp, MidiClassMember *member) {
+	struct s_backup_item item;
+	Class_data *class_data;
+	uint32_t *values;
+	int i, size, depth = 0, retval;
+
+	if (!class_layout(member->class, member->sysex_addr_base,
+			&size, &item.layout_hash)) return -2;
+
+	if (libgieditor_copy_class(&top_class, member->sysex_addr_base,
+			    &depth) < 0) return -4;
+	class_data = newest_copy_data();
+	if (class_data->size != size) {
+	    remove_copy_data(class_data, &depth);
+	    return -2;
+	}
+
+	item.sysex_addr_base = member->sysex_addr_base;
+	item.size = size;
+	values = allocate(uint32_t, size);
+	for (i = 0; i < size; i++) values[i] = class_data->m_addresses[i].value;
+	remove_copy_data(class_data, &depth);
+
+	retval = write_item(fp, &item, values);
+	free(values);
+	return retval;
+}
+
+int libgieditor_backup(const char *filename, int resume,
+		BackupProgress progress, void *arg) {
+	struct s_backup_item item;
+	uint32_t *values;
+	char *done;
+	FILE *fp = NULL;
+	long end;
+	int i, swap, total = 0, num_done = 0, retval = 0;
+
+	done = allocate(char, top_class.size);
+	memset(done, 0, top_class.size);
+
+	if (resume) fp = fopen(filename, "r+");
+	if (fp) {
+	    /* Appending to a foreign byte order archive would garble it */
+	    if (read_header(fp, BACKUP_MAGIC, BACKUP_VERSION, &swap) < 0 ||
+			swap) {
+		retval = -2;
+		goto cleanup;
+	    }
+	    end = ftell(fp);
+	    while (read_item(fp, 0, &item, &values) == 0) {
+		done[top_member_index(item.sysex_addr_base)] = 1;
+		free(values);
+		end = ftell(fp);
+	    }
+	    /* Anything after the last good item was cut short */
+	    if (fflush(fp) || ftruncate(fileno(fp), end) ||
+			fseek(fp, end, SEEK_SET)) {
+		retval = -2;
+		goto cleanup;
+	    }
+	} else {
+	    fp = fopen(filename, "w");
+	    if (!fp) {
+		free(done);
+		return -1;
+	    }
+	    if (write_header(fp, BACKUP_MAGIC, BACKUP_VERSION) < 0) {
+		retval = -2;
+		goto cleanup;
+	    }
+	}
+
+	for (i = 0; i < top_class.size; i++) {
+	    if (!top_class.members[i].class) continue;
+	    total++;
+	    if (done[i]) num_done++;
+	}
+
+	for (i = 0; i < top_class.size; i++) {
+	    if (!top_class.members[i].class || done[i]) continue;
+	    retval = backup_member(fp, &top_class.members[i]);
+	    /* Each member is kept once it's on disk */
+	    if (retval == 0 && fdatasync(fileno(fp))) retval = -2;
+	    if (retval < 0) break;
+	    num_done++;
+	    if (progress) progress(num_done, total,
+			    libgieditor_member_name(&top_class.members[i]),
+			    arg);
+	}
+
+cleanup:
+	if (fclose(fp) && !retval) retval = -2;
+	free(done);
+	return retval;
+}
+
+/* Sends only the values that differ from what the device holds, a chunk at
+ * a time, then reads the member back to check. Returns -3 if it doesn't
+ * match, -4 if the device can't be read */
+static int restore_member(const struct s_backup_item *item,
+		const uint32_t *values) {
+	Class_data *class_data;
+	midi_address *changed;
+	int i, num_changed = 0, depth = 0, retval = 0;
+
+	if (libgieditor_copy_class(&top_class, item->sysex_addr_base,
+			    &depth) < 0) return -4;
+	class_data = newest_copy_data();
+
+	changed = allocate(midi_address, item->size);
+	for (i = 0; i < item->size; i++) {
+	    if (class_data->m_addresses[i].value == values[i]) continue;
+	    changed[num_changed] = class_data->m_addresses[i];
+	    changed[num_changed].sysex_addr += item->sysex_addr_base;
+	    changed[num_changed].value = values[i];
+	    num_changed++;
+	}
+	remove_copy_data(class_data, &depth);
+
+	for (i = 0; i < num_changed; i += RESTORE_CHUNK) {
+	    libgieditor_wait_ticket(libgieditor_send_bulk_sysex(&changed[i],
+			    num_changed - i < RESTORE_CHUNK ?
+			    num_changed - i : RESTORE_CHUNK));
+	}
+	free(changed);
+	if (!num_changed) return 0;
+
+	if (libgieditor_copy_class(&top_class, item->sysex_addr_base,
+			    &depth) < 0) return -4;
+	class_data = newest_copy_data();
+	for (i = 0; i < item->size; i++) {
+	    if (class_data->m_addresses[i].value != values[i]) {
+		retval = -3;
+		break;
+	    }
+	}
+	remove_copy_data(class_data, &depth);
+	return retval;
+}
+
+int libgieditor_restore(const char *filename, BackupProgress progress,
+		void *arg) {
+	struct s_backup_item item;
+	uint32_t *values;
+	FILE *fp;
+	long start;
+	int swap, total = 0, num_done = 0, failed = 0, retval;
+
+	fp = fopen(filename, "r");
+	if (!fp) return -1;
+
+	if (read_header(fp, BACKUP_MAGIC, BACKUP_VERSION, &swap) < 0) {
+	    fclose(fp);
+	    return -2;
+	}
+
+	/* Check the whole archive before anything is sent */
+	start = ftell(fp);
+	while ((retval = read_item(fp, swap, &item, &values)) == 0) {
+	    free(values);
+	    total++;
+	}
+	if (retval < 0 || fseek(fp, start, SEEK_SET)) {
+	    fclose(fp);
+	    return -2;
+	}
+
+	while (read_item(fp, swap, &item, &values) == 0) {
+	    retval = restore_member(&item, values);
+	    free(values);
+	    if (retval == -4) break;
+	    if (retval == -3) failed++;
+	    num_done++;
+	    if (progress) progress(num_done, total,
+			    libgieditor_member_name(&top_class.members[
+			    top_member_index(item.sysex_addr_base)]), arg);
+	}
+
+	fclose(fp);
+	if (retval == -4) return -4;
+	return failed;
+}
+
+/* Opened for appending, and started if it's new. Returns NULL with
+ * RETVAL set if not */
+static FILE *open_journal(const char *filename, int *retval) {
+	FILE *fp;
+	int fd, swap;
+
+	fd = open(filename, O_RDWR | O_APPEND | O_CREAT, 0666);
+	if (fd < 0) {
+	    *retval = -1;
+	    return NULL;
+	}
+	fp = fdopen(fd, "a+");
+	if (!fp) {
+	    close(fd);
+	    *retval = -1;
+	    return NULL;
+	}
+
+	*retval = -2;
+	flock(fd, LOCK_EX);
+	if (fseek(fp, 0, SEEK_END)) goto fail;
+	if (ftell(fp) == 0) {
+	    if (write_header(fp, JOURNAL_MAGIC, JOURNAL_VERSION) < 0 ||
+			    fflush(fp)) goto fail;
+	} else {
+	    rewind(fp);
+	    if (read_header(fp, JOURNAL_MAGIC, JOURNAL_VERSION, &swap) < 0 ||
+			    swap) goto fail;
+	}
+	flock(fd, LOCK_UN);
+	*retval = 0;
+	return fp;
+
+fail:
+	fclose(fp);
+	return NULL;
+}
+
+/* Whether a backup has put a new journal in place of FP's */
+static int journal_replaced(const char *filename, FILE *fp) {
+	struct stat path_st, fp_st;
+
+	if (stat(filename, &path_st) || fstat(fileno(fp), &fp_st)) return 1;
+	return path_st.st_ino != fp_st.st_ino || path_st.st_dev != fp_st.st_dev;
+}
+
+int libgieditor_journal(const char *filename) {
+	struct s_journal_record record;
+	uint8_t command_id;
+	uint8_t *data;
+	FILE *fp;
+	int bytes, sum, retval;
+
+	fp = open_journal(filename, &retval);
+	if (!fp) return retval;
+
+	while (1) {
+	    bytes = sysex_listen_event(&command_id, &record.sysex_addr,
+			    &data, &sum);
+	    /* Timed out */
+	    if (bytes < 0) continue;
+
+	    if (command_id == MIDI_CMD_DT1 && bytes > 0 && sum == 0) {
+		record.size = bytes;
+		flock(fileno(fp), LOCK_EX);
+		while (journal_replaced(filename, fp)) {
+		    fclose(fp);
+		    fp = open_journal(filename, &retval);
+		    if (!fp) {
+			free(data);
+			return retval;
+		    }
+		    flock(fileno(fp), LOCK_EX);
+		}
+		if (fwrite(&record, sizeof(record), 1, fp) != 1 ||
+			    fwrite(data, 1, bytes, fp) != bytes ||
+			    fflush(fp)) {
+		    free(data);
+		    fclose(fp);
+		    return -2;
+		}
+		flock(fileno(fp), LOCK_UN);
+	    }
+	    free(data);
+	}
+}
+
+/* TOUCHED has a flag per top class member. A journal cut short by a crash
+ * is fine, anything after the last whole record is ignored. LENGTH, if
+ * given, gets where the whole records end */
+static int read_journal(const char *filename, char *touched, long *length) {
+	struct s_journal_record record;
+	struct stat st;
+	FILE *fp;
+	long end;
+	int member, swap;
+
+	memset(touched, 0, top_class.size);
+
+	fp = fopen(filename, "r");
+	if (!fp) return -1;
+
+	/* Not while the writer is halfway through a record */
+	flock(fileno(fp), LOCK_SH);
+	if (fstat(fileno(fp), &st) ||
+		    read_header(fp, JOURNAL_MAGIC, JOURNAL_VERSION, &swap) < 0 ||
+		    swap) {
+	    fclose(fp);
+	    return -2;
+	}
+
+	end = ftell(fp);
+	while (fread(&record, sizeof(record), 1, fp) == 1) {
+	    if (ftell(fp) + (long) record.size > st.st_size) break;
+	    member = top_member_at(record.sysex_addr);
+	    if (member >= 0) touched[member] = 1;
+	    if (fseek(fp, record.size, SEEK_CUR)) break;
+	    end = ftell(fp);
+	}
+	if (length) *length = end;
+
+	fclose(fp);
+	return 0;
+}
+
+int libgieditor_journal_changes(const char *filename, const char ***names) {
+	char *touched;
+	int i, num = 0, retval;
+
+	*names = NULL;
+	touched = allocate(char, top_class.size);
+	retval = read_journal(filename, touched, NULL);
+	if (retval < 0) {
+	    free(touched);
+	    return retval;
+	}
+
+	*names = allocate(const char *, top_class.size);
+	for (i = 0; i < top_class.size; i++)
+	    if (touched[i])
+		(*names)[num++] =
+			libgieditor_member_name(&top_class.members[i]);
+	free(touched);
+	return num;
+}
+
+/* Replaces the journal with one holding only the records after the first
+ * KEEP_FROM bytes, or none if that's 0. The writer waits on the lock while
+ * they're copied, then finds the new file and carries on in that */
+static int restart_journal(const char *filename, long keep_from) {
+	char buf[4096], *temp_name;
+	FILE *old, *out;
+	size_t bytes;
+	int retval;
+
+	out = open_temp_file(filename, &temp_name);
+	if (!out) return -2;
+	retval = write_header(out, JOURNAL_MAGIC, JOURNAL_VERSION);
+
+	old = fopen(filename, "r");
+	if (old) {
+	    flock(fileno(old), LOCK_EX);
+	    if (keep_from > 0 && !fseek(old, keep_from, SEEK_SET)) {
+		while ((bytes = fread(buf, 1, sizeof(buf), old)) > 0)
+		    if (fwrite(buf, 1, bytes, out) != bytes) retval = -2;
+	    }
+	}
+	if (close_temp_file(out, filename, temp_name, retval < 0) < 0)
+	    retval = -2;
+	if (old) fclose(old);
+	return retval;
+}
+
+int libgieditor_backup_incremental(const char *filename, const char *journal,
+		BackupProgress progress, void *arg) {
+	struct s_backup_item item;
+	uint32_t *values;
+	uint32_t **base_values;
+	struct s_backup_item *base_items;
+	char *touched, *temp_name;
+	FILE *in, *out;
+	long journal_length;
+	int i, swap, total = 0, num_done = 0, retval;
+
+	/* The first time round everything is read. The journal is started
+	 * first, so if this is interrupted the next run only has to fetch
+	 * what's missing */
+	if (access(filename, F_OK)) {
+	    retval = restart_journal(journal, 0);
+	    if (retval < 0) return retval;
+	    return libgieditor_backup(filename, 0, progress, arg);
+	}
+
+	touched = allocate(char, top_class.size);
+	retval = read_journal(journal, touched, &journal_length);
+	if (retval < 0) {
+	    free(touched);
+	    return retval;
+	}
+
+	in = fopen(filename, "r");
+	if (!in) {
+	    free(touched);
+	    return -1;
+	}
+
+	/* The last full image, less whatever the journal says has changed */
+	base_items = allocate(struct s_backup_item, top_class.size);
+	base_values = allocate(uint32_t *, top_class.size);
+	memset(base_values, 0, sizeof(uint32_t *) * top_class.size);
+
+	/* A damaged tail is left behind and its members are read again */
+	if (read_header(in, BACKUP_MAGIC, BACKUP_VERSION, &swap) < 0) {
+	    fclose(in);
+	    retval = -2;
+	    goto cleanup;
+	}
+	while (read_item(in, swap, &item, &values) == 0) {
+	    i = top_member_index(item.sysex_addr_base);
+	    if (touched[i] || base_values[i]) {
+		free(values);
+		continue;
+	    }
+	    base_items[i] = item;
+	    base_values[i] = values;
+	}
+	fclose(in);
+
+	for (i = 0; i < top_class.size; i++)
+	    if (top_class.members[i].class && !base_values[i]) total++;
+
+	out = open_temp_file(filename, &temp_name);
+	if (!out) {
+	    retval = -2;
+	    goto cleanup;
+	}
+
+	retval = write_header(out, BACKUP_MAGIC, BACKUP_VERSION);
+	for (i = 0; i < top_class.size && !retval; i++) {
+	    if (!top_class.members[i].class) continue;
+	    if (base_values[i]) {
+		retval = write_item(out, &base_items[i], base_values[i]);
+		continue;
+	    }
+	    retval = backup_member(out, &top_class.members[i]);
+	    if (retval < 0) break;
+	    num_done++;
+	    if (progress) progress(num_done, total,
+			    libgieditor_member_name(&top_class.members[i]),
+			    arg);
+	}
+	if (close_temp_file(out, filename, temp_name, retval < 0) < 0 &&
+		    !retval) retval = -2;
+
+	/* Drop what the archive now covers, keeping whatever was logged while
+	 * it was being made */
+	if (!retval) retval = restart_journal(journal, journal_length);
+
+cleanup:
+	for (i = 0; i < top_class.size; i++) free(base_values[i]);
+	free(base_values);
+	free(base_items);
+	free(touched);
+	return retval;
+}
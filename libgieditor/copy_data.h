@@ -0,0 +1,35 @@
+/* Copy/paste list internals
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Shared between libgieditor.c and the patch file readers/writers.
+ * Needs libgieditor.h (LIBGIEDITOR_PRIVATE) and arena.h */
+
+extern Class_data *push_copy_data(int *depth);
+extern void drop_copy_data(Class_data *cur_class_data);
+extern Class_data *peek_copy_data(void);
+extern void pop_copy_data(int *depth);
+extern void remove_copy_data(Class_data *cur_class_data, int *depth);
+/* Where CUR_CLASS_DATA's addresses go, freed with it */
+extern Arena *copy_data_arena(Class_data *cur_class_data);
+extern int class_data_patch_name(Class_data *class_data, char *patch_name);
+
+extern const midi_address *class_layout(MidiClass *class, uint32_t sysex_addr,
+		int *size, uint32_t *hash);
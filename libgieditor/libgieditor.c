@@ -24,12 +24,18 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
-#include <glib.h>
+#include <pthread.h>
 
 #define LIBGIEDITOR_PRIVATE
 #include <libgieditor.h>
 #include "midi_addresses.h"
 #include "sysex.h"
+#include "arena.h"
+#include "copy_data.h"
+#include "undo.h"
+#include "profile.h"
+#include "mirror.h"
+#include "subscribe.h"
 
 #if LIBGIEDITOR_DEBUG
 #include "log.h"
@@ -40,13 +46,53 @@
 #define NUM_ADDRESSES libgieditor_num_addresses
 #define NUM_CLASSES libgieditor_num_classes
 
-static uint8_t device_id = DEFAULT_DEVICE_ID;
 static uint32_t model_id = DEFAULT_MODEL_ID;
-
-static GiPatch libgieditor_gi_patches[NUM_USER_PATCHES];
+static int read_window = 1;
+static int num_links = 1;
+/* Largest DT1 or RQ1 data. A device profile may change it */
+static int block_size = MAX_SYSEX_PACKET_SIZE;
+/* The same for each region, by the top byte of the address, where the
+ * profile has one. 0 means block_size applies */
+static int region_block_sizes[NUM_BLOCK_REGIONS];
+
+/* A Juno. The first is the one libgieditor_init opens, and uses the
+ * generated address table itself; others get their own copy, so values
+ * fetched from one don't show up in another */
+struct s_gi_device {
+	int			device;		/* As sysex.c numbers them */
+	uint8_t			device_id;
+	midi_address		*m_addresses;
+	GiPatch			gi_patches[NUM_USER_PATCHES];
+};
+
+static GiDevice first_device = {
+	.device		= 0,
+	.device_id	= DEFAULT_DEVICE_ID,
+	.m_addresses	= libgieditor_midi_addresses,
+};
+
+/* The device the calling thread talks to */
+static __thread GiDevice *cur_device = &first_device;
 
 static Class_data *copy_paste_data;
 
+/* Each entry's addresses live in its own arena, dropped in one go when the
+ * entry is pasted, written or flushed, whatever else is still on the list */
+typedef struct s_copy_entry {
+	Class_data	class_data;	/* First, to find the entry from it */
+	Arena		arena;
+} Copy_entry;
+
+/* Per-operation buffers for bulk transfers and pasting. Operations nest
+ * (paste -> copy -> bulk read), so each one marks the arena on entry and
+ * releases back to its mark when done. One per thread, so the translator's
+ * threads don't trample each other, freed by SCRATCH_KEY when the thread
+ * exits (libgieditor_close frees the calling thread's). */
+static __thread Arena scratch_arena;
+static __thread int scratch_registered;
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
 #ifdef BLACKLISTING
 static int match_member_entry(MidiClass *class, uint32_t address) {
 	int i;
@@ -78,10 +124,28 @@ static void blacklist_addresses(void) {
 }
 #endif
 
+int libgieditor_set_transport(const char *spec) {
+	return sysex_set_transport(spec);
+}
+
+void libgieditor_set_links(int num) {
+	num_links = num;
+}
+
 int libgieditor_init(const char *client_name, enum init_flags flags) {
 	int retval;
+	char *spec = getenv(TRANSPORT_ENV);
+	char *links = getenv(LINKS_ENV);
+
+	if (spec && sysex_set_transport(spec) < 0) return -1;
+	if (links) num_links = atoi(links);
+	if (sysex_set_links(num_links) < 0) return -1;
 
 	retval = sysex_init(client_name, TIMEOUT_TIME, flags);
+	if (retval == 0) {
+	    load_default_profile();
+	    mirror_open(client_name);
+	}
 
 #ifdef BLACKLISTING
 	blacklist_class_members();
@@ -91,14 +155,150 @@ int libgieditor_init(const char *client_name, enum init_flags flags) {
 	return retval;
 }
 
+GiDevice *libgieditor_open_device(const char *name, uint8_t id) {
+	GiDevice *device;
+	int i;
+
+	device = allocate(GiDevice, 1);
+	memset(device, 0, sizeof(GiDevice));
+	device->device = sysex_add_device(name);
+	if (device->device < 0) {
+	    free(device);
+	    return NULL;
+	}
+	device->device_id = id;
+
+	/* Keep what's blacklisted, but nothing has been fetched */
+	device->m_addresses = allocate(midi_address, NUM_ADDRESSES);
+	memcpy(device->m_addresses, libgieditor_midi_addresses,
+			sizeof(midi_address) * NUM_ADDRESSES);
+	for (i = 0; i < NUM_ADDRESSES; i++) {
+	    device->m_addresses[i].flags &= ~M_ADDRESS_FETCHED;
+	    device->m_addresses[i].value = 0;
+	}
+	return device;
+}
+
+void libgieditor_close_device(GiDevice *device) {
+	if (!device || device == &first_device) return;
+	if (cur_device == device) libgieditor_use_device(NULL);
+	sysex_remove_device(device->device);
+	free(device->m_addresses);
+	free(device);
+}
+
+void libgieditor_use_device(GiDevice *device) {
+	cur_device = device ? device : &first_device;
+	sysex_use_device(cur_device->device);
+}
+
+midi_address *libgieditor_address_table(void) {
+	return cur_device->m_addresses;
+}
+
+/* Only the first device's edits are kept for undo, or mirrored */
+static int recording_undo(void) {
+	return undo_enabled() && cur_device == &first_device;
+}
+
+static void mirror_data(uint32_t sysex_addr, const uint8_t *data,
+		uint32_t sysex_size) {
+	if (cur_device == &first_device)
+	    mirror_store(sysex_addr, data, sysex_size);
+}
+
 int libgieditor_close(void) {
-	int retval;
+	int retval, dummy;
 
 	retval = sysex_close();
+	mirror_close();
+
+	arena_free(&scratch_arena);
+	libgieditor_flush_copy_data(&dummy);
 
 	return retval;
 }
 
+static void free_scratch_arena(void *arena) {
+	arena_free(arena);
+}
+
+static void make_scratch_key(void) {
+	pthread_key_create(&scratch_key, free_scratch_arena);
+}
+
+static void *scratch_alloc(size_t size) {
+	if (!scratch_registered) {
+	    pthread_once(&scratch_once, make_scratch_key);
+	    pthread_setspecific(scratch_key, &scratch_arena);
+	    scratch_registered = 1;
+	}
+	return arena_alloc(&scratch_arena, size);
+}
+
+#define scratch_allocate(t, num) scratch_alloc(sizeof(t) * (num))
+#define copy_allocate(class_data, t, num) \
+	arena_alloc(copy_data_arena(class_data), sizeof(t) * (num))
+
+/* Append a new entry to the copy/paste list */
+Class_data *push_copy_data(int *depth) {
+	Copy_entry *entry = allocate(Copy_entry, 1);
+	Class_data *cur_class_data = &entry->class_data;
+
+	arena_init(&entry->arena, 0);
+        if (!copy_paste_data) {
+            copy_paste_data = cur_class_data;
+	    *depth = 1;
+        } else {
+            cur_class_data = copy_paste_data;
+            while (cur_class_data->next) cur_class_data = cur_class_data->next;
+            cur_class_data->next = &entry->class_data;
+            cur_class_data = cur_class_data->next;
+	    (*depth)++;
+        }
+        cur_class_data->next = NULL;
+	cur_class_data->m_addresses = NULL;
+
+	return cur_class_data;
+}
+
+/* Called once an entry has been unlinked from the copy/paste list */
+void drop_copy_data(Class_data *cur_class_data) {
+	Copy_entry *entry = (Copy_entry *) cur_class_data;
+
+	arena_free(&entry->arena);
+	free(entry);
+}
+
+Class_data *peek_copy_data(void) {
+	return copy_paste_data;
+}
+
+/* Unlink and drop the head of the copy/paste list */
+void pop_copy_data(int *depth) {
+	Class_data *cur_class_data = copy_paste_data;
+
+	if (!cur_class_data) return;
+	copy_paste_data = cur_class_data->next;
+	drop_copy_data(cur_class_data);
+	(*depth)--;
+}
+
+/* Unlink and drop any entry of the copy/paste list */
+void remove_copy_data(Class_data *cur_class_data, int *depth) {
+	Class_data **link = &copy_paste_data;
+
+	while (*link && *link != cur_class_data) link = &(*link)->next;
+	if (!*link) return;
+	*link = cur_class_data->next;
+	drop_copy_data(cur_class_data);
+	(*depth)--;
+}
+
+Arena *copy_data_arena(Class_data *cur_class_data) {
+	return &((Copy_entry *) cur_class_data)->arena;
+}
+
 uint32_t libgieditor_add_addresses(uint32_t address1, uint32_t address2) {
 	uint8_t a1, a2, a3, a4, b1, b2, b3, b4, c1, c2, c3, c4;
 	a1 = (address1 & 0xff000000) >> 24; b1 = (address2 & 0xff000000) >> 24;
@@ -119,14 +319,57 @@ uint32_t libgieditor_add_addresses(uint32_t address1, uint32_t address2) {
 	return ( c1<<24 | c2<<16 | c3<<8 | c4 );
 }
 
+uint32_t libgieditor_linear_addr(uint32_t sysex_addr) {
+	return (sysex_addr >> 24 & 0x7f) << 21 |
+		(sysex_addr >> 16 & 0x7f) << 14 |
+		(sysex_addr >> 8 & 0x7f) << 7 | (sysex_addr & 0x7f);
+}
+
+uint32_t libgieditor_roland_addr(uint32_t linear_addr) {
+	return (linear_addr >> 21 & 0x7f) << 24 |
+		(linear_addr >> 14 & 0x7f) << 16 |
+		(linear_addr >> 7 & 0x7f) << 8 | (linear_addr & 0x7f);
+}
+
+/* The first ID at or after LINEAR_ADDR, or NUM_ADDRESSES */
+static int lower_bound(uint32_t linear_addr) {
+	int lo = 0, hi = NUM_ADDRESSES, mid;
+
+	while (lo < hi) {
+	    mid = (lo + hi) / 2;
+	    if (libgieditor_midi_linear_addrs[mid] < linear_addr) lo = mid + 1;
+	    else hi = mid;
+	}
+	return lo;
+}
+
+int libgieditor_param_id(uint32_t sysex_addr) {
+	uint32_t linear_addr = libgieditor_linear_addr(sysex_addr);
+	int id = lower_bound(linear_addr);
+
+	if (id == NUM_ADDRESSES || libgieditor_midi_linear_addrs[id] !=
+		    linear_addr) return -1;
+	return id;
+}
+
+uint32_t libgieditor_param_addr(int id) {
+	if (id < 0 || id >= NUM_ADDRESSES) return -1;
+	return libgieditor_midi_addresses[id].sysex_addr;
+}
+
+int libgieditor_param_span(uint32_t sysex_addr, uint32_t sysex_size,
+		int *first, int *end) {
+	uint32_t linear_addr = libgieditor_linear_addr(sysex_addr);
+
+	*first = lower_bound(linear_addr);
+	*end = lower_bound(linear_addr + sysex_size);
+	return *end - *first;
+}
+
 midi_address *libgieditor_match_midi_address(uint32_t sysex_addr) {
-	int i;
-        for (i = 0; i < NUM_ADDRESSES; i++) {
-                if (libgieditor_midi_addresses[i].sysex_addr == sysex_addr) {
-                        return &libgieditor_midi_addresses[i];
-                }
-        }
-        return NULL;
+	int id = libgieditor_param_id(sysex_addr);
+
+	return id < 0 ? NULL : &cur_device->m_addresses[id];
 }
 
 MidiClass *libgieditor_match_class_name(char *class_name) {
@@ -197,7 +440,7 @@ const char *libgieditor_get_desc(uint32_t sysex_addr) {
 	if (!m_address) return NULL;
 	int i = match_class_member(sysex_addr, m_address->class, 0);
 	if (i < 0) return NULL;
-	return (m_address->class->members[i].name);
+	return libgieditor_member_name(&m_address->class->members[i]);
 }
 
 char **libgieditor_get_parents(uint32_t sysex_addr, int *num_parents) {
@@ -216,7 +459,8 @@ char **libgieditor_get_parents(uint32_t sysex_addr, int *num_parents) {
 	for (depth = *num_parents, j = 0; depth > 0; depth--, j++) {
 	    i = match_class_member(sysex_addr, m_address->class, depth);
 	    asprintf(&parents_array[j], "%s",
-		    m_address->class->parents[depth - 1]->members[i].name);
+		    libgieditor_member_name(&m_address->class->
+			    parents[depth - 1]->members[i]));
 	}
 
 	return parents_array;
@@ -251,13 +495,37 @@ static void libgieditor_write_sysex_value(uint32_t sysex_value,
 }
 
 void libgieditor_set_device_id(uint8_t id) {
-	device_id = id;
+	cur_device->device_id = id;
 }
 
 void libgieditor_set_model_id(uint32_t id) {
 	model_id = id;
 }
 
+void libgieditor_set_read_window(int window) {
+	read_window = window < 1 ? 1 : window;
+}
+
+void libgieditor_set_block_size(int size) {
+	if (size < 1) size = MAX_SYSEX_PACKET_SIZE;
+	block_size = size > MAX_BLOCK_SIZE ? MAX_BLOCK_SIZE : size;
+}
+
+int libgieditor_get_block_size(void) {
+	return block_size;
+}
+
+void libgieditor_set_region_block_size(uint32_t sysex_addr, int size) {
+	if (size < 1) size = 0;
+	else if (size > MAX_BLOCK_SIZE) size = MAX_BLOCK_SIZE;
+	region_block_sizes[sysex_addr >> BLOCK_REGION_SHIFT] = size;
+}
+
+int libgieditor_get_region_block_size(uint32_t sysex_addr) {
+	int size = region_block_sizes[sysex_addr >> BLOCK_REGION_SHIFT];
+	return size ? size : block_size;
+}
+
 static int address_sort(const void *va, const void *vb) {
 	const midi_address **a = (const midi_address **) va;
 	const midi_address **b = (const midi_address **) vb;
@@ -266,21 +534,28 @@ static int address_sort(const void *va, const void *vb) {
 	else return -1;
 }
 
+static int get_sysex_buf(uint32_t sysex_addr, uint32_t sysex_size,
+				uint8_t *buf);
+
+/* Reads use the region's block size, which gi_probe only measures for
+ * reads, so writes (with !BY_REGION) keep to the default */
 static int build_blocks(uint32_t block_addresses[], uint32_t block_sizes[],
 		int block_offsets[], int *total_size, const int num,
-		midi_address **s_addresses) {
-	int i, blocks;
+		midi_address **s_addresses, int by_region) {
+	int i, blocks, limit;
 	block_addresses[0] = s_addresses[0]->sysex_addr;
+	limit = by_region ? libgieditor_get_region_block_size(
+			block_addresses[0]) : block_size;
 	block_offsets[0] = 0;
 	for (i = 0; i < num; i++) block_sizes[i] = 0;
 	*total_size = 0;
 	for (i = 1, blocks = 1; i < num; i++) {
-	    if (s_addresses[i - 1]->sysex_addr + 
-		    s_addresses[i - 1]->sysex_size ==
+	    if (libgieditor_add_addresses(s_addresses[i - 1]->sysex_addr,
+			    s_addresses[i - 1]->sysex_size) ==
 			s_addresses[i]->sysex_addr) {
 		block_sizes[blocks - 1] += s_addresses[i - 1]->sysex_size;
 		*total_size += s_addresses[i - 1]->sysex_size;
-		if (block_sizes[blocks - 1] < MAX_SYSEX_PACKET_SIZE) {
+		if (block_sizes[blocks - 1] < limit) {
 		    continue;
 		} else {
 		    block_sizes[blocks - 1] -= s_addresses[i - 1]->sysex_size;
@@ -289,17 +564,19 @@ static int build_blocks(uint32_t block_addresses[], uint32_t block_sizes[],
 	    }
 	    block_sizes[blocks - 1] += s_addresses[i - 1]->sysex_size;
 	    *total_size += s_addresses[i - 1]->sysex_size;
-	    if (block_sizes[blocks - 1] > MAX_SYSEX_PACKET_SIZE) {
+	    if (block_sizes[blocks - 1] > limit) {
 		block_sizes[blocks - 1] -= s_addresses[i - 1]->sysex_size;
 		*total_size -= s_addresses[i - 1]->sysex_size;
 		i--;
 	    }
 	    block_offsets[blocks] = i;
 	    block_addresses[blocks++] = s_addresses[i]->sysex_addr;
+	    if (by_region) limit = libgieditor_get_region_block_size(
+			    s_addresses[i]->sysex_addr);
 	}
 	block_sizes[blocks - 1] += s_addresses[i - 1]->sysex_size;
 	*total_size += s_addresses[i - 1]->sysex_size;
-	if (block_sizes[blocks - 1] > MAX_SYSEX_PACKET_SIZE) {
+	if (block_sizes[blocks - 1] > limit) {
 	    block_sizes[blocks - 1] -= s_addresses[i - 1]->sysex_size;
 	    block_sizes[blocks] += s_addresses[i - 1]->sysex_size;
 	    block_offsets[blocks] = i - 1;
@@ -308,75 +585,172 @@ static int build_blocks(uint32_t block_addresses[], uint32_t block_sizes[],
 	return blocks;
 }
 
-int libgieditor_get_bulk_sysex(midi_address m_addresses[], const int num) {
-	int i, j, blocks;
-	int retval = 0;
-	int total_size;
-	uint32_t block_addresses[num];
-	uint32_t block_sizes[num];
-	int block_offsets[num];
-	uint8_t **data;
-	int data_offset;
-	midi_address *s_address;
+/* The reads for one run of addresses, split into blocks of at most the
+ * region's block size. The replies land back to back in DATA. */
+typedef struct s_bulk_plan {
+	midi_address	    **s_addresses;
+	uint32_t	    *block_addresses;
+	uint32_t	    *block_sizes;
+	int		    *block_offsets;
+	int		    blocks;
+	int		    total_size;
+	uint8_t		    *data;
+} Bulk_plan;
+
+/* Everything is allocated from the scratch arena */
+static void plan_bulk_sysex(Bulk_plan *plan, midi_address m_addresses[],
+		const int num) {
+	int i;
 
-	midi_address **s_addresses = allocate(midi_address *, num);
+	plan->s_addresses = scratch_allocate(midi_address *, num);
 	for (i = 0; i < num; i++) {
-		s_addresses[i] = &m_addresses[i];
+		plan->s_addresses[i] = &m_addresses[i];
 	}
-	qsort(s_addresses, num, sizeof(midi_address *), address_sort);
+	qsort(plan->s_addresses, num, sizeof(midi_address *), address_sort);
+
+	plan->block_addresses = scratch_allocate(uint32_t, num);
+	plan->block_sizes = scratch_allocate(uint32_t, num);
+	plan->block_offsets = scratch_allocate(int, num);
+	plan->blocks = build_blocks(plan->block_addresses, plan->block_sizes,
+			plan->block_offsets, &plan->total_size, num,
+			plan->s_addresses, 1);
+	plan->data = scratch_allocate(uint8_t, plan->total_size);
+}
 
-	blocks = build_blocks(block_addresses, block_sizes, block_offsets, 
-			&total_size, num, s_addresses);
+static void decode_bulk_sysex(Bulk_plan *plan) {
+	int i, j;
+	int data_offset, block_offset;
+	midi_address *s_address;
 
-	data = allocate(uint8_t *, blocks);
-	for (i = 0; i < blocks; i++) data[i] = NULL;
-	for (i = 0; i < blocks; i++) {
-	    retval = libgieditor_get_sysex(
-			    block_addresses[i], block_sizes[i], &data[i]);
-	    if (retval < 0) goto cleanup;
-	}
-	
-	for (i = 0; i < blocks; i++) {
+	for (i = 0, block_offset = 0; i < plan->blocks; i++) {
 	    data_offset = 0;
-	    for (j = 0; j < block_sizes[i]; j++) {
-		s_address = s_addresses[block_offsets[i] + j];
+	    for (j = 0; j < plan->block_sizes[i]; j++) {
+		s_address = plan->s_addresses[plan->block_offsets[i] + j];
 		s_address->value = libgieditor_get_sysex_value(
-			    &data[i][data_offset],
+			    &plan->data[block_offset + data_offset],
 			    s_address->sysex_size);
 		s_address->flags |= M_ADDRESS_FETCHED;
 		data_offset += s_address->sysex_size;
-		if (data_offset >= block_sizes[i]) break;
+		if (data_offset >= plan->block_sizes[i]) break;
 	    }
+	    block_offset += plan->block_sizes[i];
 	}
+}
 
-cleanup:
-	for (i = 0; i < blocks; i++) {
-	    if (data[i]) free(data[i]);
+/* Issues every block of every plan. With a window of one and one link,
+ * each request waits for its reply, otherwise up to READ_WINDOW are kept
+ * in flight on each link. The requests go on the bulk lane. */
+static int read_bulk_plans(Bulk_plan *plans, int num_plans) {
+	int i, j, num = 0, retval = 0, block_offset;
+	Sysex_request *requests;
+	Arena_mark mark;
+
+	if (read_window <= 1 && num_links == 1) {
+	    sysex_begin_bulk();
+	    for (i = 0; i < num_plans && retval >= 0; i++) {
+		for (j = 0, block_offset = 0; j < plans[i].blocks; j++) {
+		    retval = get_sysex_buf(plans[i].block_addresses[j],
+				    plans[i].block_sizes[j],
+				    plans[i].data + block_offset);
+		    if (retval < 0) break;
+		    block_offset += plans[i].block_sizes[j];
+		}
+	    }
+	    sysex_end_bulk();
+	    return retval < 0 ? retval : 0;
+	}
+
+	mark = arena_mark(&scratch_arena);
+	for (i = 0; i < num_plans; i++) num += plans[i].blocks;
+	requests = scratch_allocate(Sysex_request, num);
+	for (i = 0, num = 0; i < num_plans; i++) {
+	    for (j = 0, block_offset = 0; j < plans[i].blocks; j++, num++) {
+		requests[num].sysex_addr = plans[i].block_addresses[j];
+		requests[num].sysex_size = plans[i].block_sizes[j];
+		requests[num].buf = plans[i].data + block_offset;
+		block_offset += plans[i].block_sizes[j];
+	    }
 	}
-	free(data);
-	free(s_addresses);
+
+	sysex_begin_bulk();
+	retval = sysex_recv_pipelined(cur_device->device_id, model_id, requests, num,
+			read_window);
+	sysex_end_bulk();
+#if LIBGIEDITOR_DEBUG
+	if (retval < 0) common_log(1, "Timeout during a pipelined read");
+#endif
+	for (i = 0; retval == 0 && i < num; i++)
+	    mirror_data(requests[i].sysex_addr, requests[i].buf,
+			    requests[i].sysex_size);
+	arena_release(&scratch_arena, mark);
 	return retval;
 }
 
-void libgieditor_send_bulk_sysex(midi_address m_addresses[], const int num) {
+/* A region's block size from the profile may be more than this Juno
+ * answers. When a read fails, any region that had a block bigger than the
+ * default goes back to the default. Returns 1 if one did, and the read is
+ * worth trying again */
+static int forget_region_block_sizes(Bulk_plan *plans, int num_plans) {
+	int i, j, region, changed = 0;
+#if LIBGIEDITOR_DEBUG
+	char *msg;
+#endif
+
+	for (i = 0; i < num_plans; i++) {
+	    for (j = 0; j < plans[i].blocks; j++) {
+		region = plans[i].block_addresses[j] >> BLOCK_REGION_SHIFT;
+		if (!region_block_sizes[region] ||
+				plans[i].block_sizes[j] <= block_size) continue;
+		region_block_sizes[region] = 0;
+		changed = 1;
+#if LIBGIEDITOR_DEBUG
+		asprintf(&msg, "Block size for region 0x%02X reset", region);
+		common_log(1, msg);
+		free(msg);
+#endif
+	    }
+	}
+	return changed;
+}
+
+int libgieditor_get_bulk_sysex(midi_address m_addresses[], const int num) {
+	int retval;
+	Bulk_plan plan;
+	Arena_mark mark = arena_mark(&scratch_arena);
+
+	do {
+	    arena_release(&scratch_arena, mark);
+	    plan_bulk_sysex(&plan, m_addresses, num);
+	    retval = read_bulk_plans(&plan, 1);
+	} while (retval < 0 && forget_region_block_sizes(&plan, 1));
+	if (retval == 0) decode_bulk_sysex(&plan);
+
+	arena_release(&scratch_arena, mark);
+	return retval;
+}
+
+uint32_t libgieditor_send_bulk_sysex(midi_address m_addresses[],
+		const int num) {
 	int i, blocks;
+	uint32_t ticket = 0;
 	int total_size;
 	uint32_t block_addresses[num];
 	uint32_t block_sizes[num];
 	int block_offsets[num];
 	uint8_t *data;
 	int data_offset = 0;
+	Arena_mark mark = arena_mark(&scratch_arena);
 
-	midi_address **s_addresses = allocate(midi_address *, num);
+	midi_address **s_addresses = scratch_allocate(midi_address *, num);
 	for (i = 0; i < num; i++) {
 		s_addresses[i] = &m_addresses[i];
 	}
 	qsort(s_addresses, num, sizeof(midi_address *), address_sort);
 
 	blocks = build_blocks(block_addresses, block_sizes, block_offsets, 
-			&total_size, num, s_addresses);
+			&total_size, num, s_addresses, 0);
 
-	data = allocate(uint8_t *, total_size);
+	data = scratch_allocate(uint8_t, total_size);
 	for (i = 0; i < num; i++) {
 	    libgieditor_write_sysex_value(s_addresses[i]->value,
 			s_addresses[i]->sysex_size, &data[data_offset]);
@@ -384,33 +758,52 @@ void libgieditor_send_bulk_sysex(midi_address m_addresses[], const int num) {
 	}
 
 	data_offset = 0;
+	sysex_begin_bulk();
 	for (i = 0; i < blocks; i++) {
-	    libgieditor_send_sysex(block_addresses[i], block_sizes[i],
+	    ticket = libgieditor_send_sysex(block_addresses[i], block_sizes[i],
 			    data + data_offset);
 	    data_offset += block_sizes[i];
 	}
-	free(data);
-	free(s_addresses);
+	sysex_end_bulk();
+	arena_release(&scratch_arena, mark);
+	return ticket;
+}
+
+uint32_t libgieditor_send_sysex_at(uint32_t sysex_addr,
+			    uint32_t sysex_size, uint8_t *data, uint64_t time) {
+	if (recording_undo()) undo_record(sysex_addr, sysex_size, data);
+	mirror_data(sysex_addr, data, sysex_size);
+	return sysex_send_at(cur_device->device_id, model_id, sysex_addr, sysex_size,
+			data, time);
 }
 
-void libgieditor_send_sysex(uint32_t sysex_addr,
+uint32_t libgieditor_send_sysex(uint32_t sysex_addr,
 			    uint32_t sysex_size, uint8_t *data) {
-	sysex_send(device_id, model_id, sysex_addr, sysex_size, data);
+	return libgieditor_send_sysex_at(sysex_addr, sysex_size, data, 0);
 }
 
-void libgieditor_send_sysex_value(uint32_t sysex_addr,
+uint32_t libgieditor_send_sysex_value(uint32_t sysex_addr,
 			    uint32_t sysex_size, uint32_t sysex_value) {
 	uint8_t data[4];
 	libgieditor_write_sysex_value(sysex_value, sysex_size, data);
-	libgieditor_send_sysex(sysex_addr, sysex_size, data);
+	return libgieditor_send_sysex(sysex_addr, sysex_size, data);
 }
 
-int libgieditor_get_sysex(uint32_t sysex_addr,
-		                uint32_t sysex_size, uint8_t **data) {
+void libgieditor_wait_ticket(uint32_t ticket) {
+	sysex_wait_ticket(ticket);
+}
+
+void libgieditor_wait_sent(void) {
+	sysex_wait_sent();
+}
+
+/* Receives into BUF if given, otherwise into a newly allocated *DATA */
+static int get_sysex_priv(uint32_t sysex_addr, uint32_t sysex_size,
+				uint8_t **data, uint8_t *buf) {
 	int retval;
 	
 #ifdef BLACKLISTING
-	*data = NULL;
+	if (data) *data = NULL;
 	midi_address *m_address = libgieditor_match_midi_address(sysex_addr);
 	if (!m_address) return -2;
 	int i = match_class_member(sysex_addr, m_address->class, 0);
@@ -418,7 +811,14 @@ int libgieditor_get_sysex(uint32_t sysex_addr,
 	if (m_address->class->members[i].blacklisted) return -2;
 #endif
 
-	retval = sysex_recv(device_id, model_id, sysex_addr, sysex_size, data);
+	if (buf)
+	    retval = sysex_recv_buf(cur_device->device_id, model_id,
+			    sysex_addr, sysex_size, buf);
+	else
+	    retval = sysex_recv(cur_device->device_id, model_id,
+			    sysex_addr, sysex_size, data);
+
+	if (retval == 0) mirror_data(sysex_addr, buf ? buf : *data, sysex_size);
 
 	if (retval < 0) {
 #ifdef BLACKLISTING
@@ -437,41 +837,105 @@ int libgieditor_get_sysex(uint32_t sysex_addr,
 	return retval;
 }
 
+int libgieditor_get_sysex(uint32_t sysex_addr,
+		                uint32_t sysex_size, uint8_t **data) {
+	return get_sysex_priv(sysex_addr, sysex_size, data, NULL);
+}
+
+static int get_sysex_buf(uint32_t sysex_addr, uint32_t sysex_size,
+				uint8_t *buf) {
+	return get_sysex_priv(sysex_addr, sysex_size, NULL, buf);
+}
+
+int libgieditor_get_sysex_buf(uint32_t sysex_addr, uint32_t sysex_size,
+				uint8_t *buf) {
+	return get_sysex_buf(sysex_addr, sysex_size, buf);
+}
+
 void libgieditor_set_timeout(int timeout_time) {
 	sysex_set_timeout(timeout_time);
 }
 
+void libgieditor_set_timeout_ms(int ms) {
+	sysex_set_timeout_ms(ms);
+}
+
+void libgieditor_set_pacing(int bytes_per_second) {
+	sysex_set_pacing(bytes_per_second);
+}
+
+void libgieditor_set_link_pacing(int link, int bytes_per_second) {
+	sysex_set_link_pacing(link, bytes_per_second);
+}
+
+void libgieditor_set_bulk_budget(int bytes) {
+	sysex_set_bulk_budget(bytes);
+}
+
+void libgieditor_set_max_sysex_size(int max_size) {
+	sysex_set_max_size(max_size);
+}
+
+unsigned int libgieditor_sysex_dropped(void) {
+	return sysex_dropped();
+}
+
+uint64_t libgieditor_get_time(void) {
+	return sysex_get_time();
+}
+
 /* This function will block, returns the number of data bytes collected */
 int libgieditor_listen_sysex_event(uint8_t *command_id, 
 		uint32_t *address, uint8_t **data) {
-	int sum;
-	return sysex_listen_event(command_id, address, data, &sum);
+	return libgieditor_listen_sysex_event_time(command_id, address, data,
+			NULL);
+}
+
+int libgieditor_listen_sysex_event_time(uint8_t *command_id, 
+		uint32_t *address, uint8_t **data, uint64_t *time) {
+	int sum, retval;
+
+	retval = sysex_listen_event_time(command_id, address, data, &sum, time);
+	if (retval > 0 && *command_id == MIDI_CMD_DT1 && sum == 0) {
+	    mirror_data(*address, *data, retval);
+	    subscribe_dispatch(*address, *data, retval);
+	}
+	return retval;
 }
 
 char *libgieditor_get_patch_name(uint32_t sysex_addr) {
 	int i;
         for (i = 0; i < NUM_USER_PATCHES; i++) {
-                if (libgieditor_gi_patches[i].sysex_base_addr == sysex_addr) {
+                if (cur_device->gi_patches[i].sysex_base_addr == sysex_addr) {
 			break;
                 }
         }
-	if (libgieditor_gi_patches[i].flags & GI_PATCH_NAME_KNOWN)
-	    return libgieditor_gi_patches[i].name;
+	if (cur_device->gi_patches[i].flags & GI_PATCH_NAME_KNOWN)
+	    return cur_device->gi_patches[i].name;
         return NULL;
 }
 
-char *libgieditor_get_copy_patch_name(void) {
+/* PATCH_NAME needs room for MAX_SET_NAME_SIZE + 1 characters */
+int class_data_patch_name(Class_data *class_data, char *patch_name) {
 	int i;
-	char patch_name[MAX_SET_NAME_SIZE + 1];
 
-	if ((copy_paste_data->class != &libgieditor_studio_class) &&
-	    (copy_paste_data->class != &libgieditor_liveset_class))
-	    return NULL;
+	if ((class_data->class != &libgieditor_studio_class) &&
+	    (class_data->class != &libgieditor_liveset_class))
+	    return -1;
+	if (class_data->size < MAX_SET_NAME_SIZE) return -1;
 
 	for (i = 0; i < MAX_SET_NAME_SIZE; i++) {
-	    patch_name[i] = copy_paste_data->m_addresses[i].value;
+	    patch_name[i] = class_data->m_addresses[i].value;
 	}
 	patch_name[i] = '\0';
+	return 0;
+}
+
+char *libgieditor_get_copy_patch_name(void) {
+	char patch_name[MAX_SET_NAME_SIZE + 1];
+
+	if (class_data_patch_name(copy_paste_data, patch_name) < 0)
+	    return NULL;
 
 	return strdup(patch_name);
 }
@@ -482,47 +946,58 @@ int libgieditor_refresh_patch_names(void) {
 	uint32_t cur_sysex_base = FIRST_USER_PATCH_ADDR;
 
 	for (i = 0; i < NUM_USER_PATCHES; i++) {
-	    libgieditor_gi_patches[i].sysex_base_addr = cur_sysex_base;
+	    cur_device->gi_patches[i].sysex_base_addr = cur_sysex_base;
 	    if (libgieditor_get_sysex(cur_sysex_base, 
 			    MAX_SET_NAME_SIZE,
 			    (uint8_t **) &data) < 0) return -1;
-	    memcpy(libgieditor_gi_patches[i].name, data, MAX_SET_NAME_SIZE);
-	    libgieditor_gi_patches[i].name[MAX_SET_NAME_SIZE] = '\0';
+	    memcpy(cur_device->gi_patches[i].name, data, MAX_SET_NAME_SIZE);
+	    cur_device->gi_patches[i].name[MAX_SET_NAME_SIZE] = '\0';
 	    free(data);
-	    libgieditor_gi_patches[i].flags |= GI_PATCH_NAME_KNOWN;
+	    cur_device->gi_patches[i].flags |= GI_PATCH_NAME_KNOWN;
 	    cur_sysex_base = libgieditor_add_addresses(cur_sysex_base,
 			    USER_PATCH_DELTA);
 	}
 	return 0;
 }
 
-static int transfer_addresses_under_member(MidiClassMember *class_member,
-		uint32_t sysex_addr, int pasting) {
-	int i, retval;
+static int count_leaf_classes_under_member(MidiClassMember *class_member) {
+	int i, total = 0;
 	MidiClass *class = class_member->class;
 
 	if (!class) return 0;
+	if (!class->members[0].class) total++;
+
+	for (i = 0; i < class->size; i++)
+	    total += count_leaf_classes_under_member(&class->members[i]);
+	return total;
+}
+
+/* Pastes, or if PLANS is given, plans the reads for each leaf class so they
+ * can all be issued together */
+static void transfer_addresses_under_member(MidiClassMember *class_member,
+		uint32_t sysex_addr, Bulk_plan *plans, int *num_plans) {
+	int i;
+	MidiClass *class = class_member->class;
+
+	if (!class) return;
 
-	if (!class->members[0].class && pasting) {
+	if (!class->members[0].class && !plans) {
 	    libgieditor_send_bulk_sysex(
 		    libgieditor_match_midi_address(sysex_addr),
 		    class->size);
 	}
 
-	if (!class->members[0].class && !pasting) {
-	    retval = libgieditor_get_bulk_sysex(
+	if (!class->members[0].class && plans) {
+	    plan_bulk_sysex(&plans[(*num_plans)++],
 		    libgieditor_match_midi_address(sysex_addr),
 		    class->size);
-	    if (retval) return retval;
 	}
 
 	for (i = 0; i < class->size; i++) {
-	    retval = transfer_addresses_under_member(&class->members[i],
+	    transfer_addresses_under_member(&class->members[i],
 			    sysex_addr + class->members[i].sysex_addr_base,
-			    pasting);
-	    if (retval) return retval;
+			    plans, num_plans);
 	}
-	return retval;
 }
 
 static int count_addresses_under_member(MidiClassMember *class_member,
@@ -539,6 +1014,42 @@ static int count_addresses_under_member(MidiClassMember *class_member,
 	return total;
 }
 
+/* Widens FIRST to END (just past the last byte) to take in everything
+ * under CLASS_MEMBER */
+static void range_under_member(MidiClassMember *class_member,
+		uint32_t sysex_addr, uint32_t *first, uint32_t *end) {
+	int i;
+	uint32_t size, last;
+	MidiClass *class = class_member->class;
+
+	if (!class) {
+	    size = libgieditor_get_sysex_size(sysex_addr);
+	    if (size == (uint32_t) -1) return;
+	    last = libgieditor_add_addresses(sysex_addr, size);
+	    if (*first == *end || sysex_addr < *first) *first = sysex_addr;
+	    if (last > *end) *end = last;
+	    return;
+	}
+
+	for (i = 0; i < class->size; i++) {
+	    range_under_member(&class->members[i],
+			    sysex_addr + class->members[i].sysex_addr_base,
+			    first, end);
+	}
+}
+
+int libgieditor_class_range(MidiClass *class, uint32_t sysex_addr,
+		uint32_t *first, uint32_t *end) {
+	MidiClassMember *class_member;
+
+	if (!libgieditor_match_midi_address(sysex_addr)) return -1;
+	class_member = &class->members[match_class_member(sysex_addr,
+								class, 0)];
+	*first = *end = 0;
+	range_under_member(class_member, sysex_addr, first, end);
+	return *first == *end ? -1 : 0;
+}
+
 static void cp_addresses_under_member(MidiClassMember *class_member,
 		Class_data *cur_class_data,
 		int *index, uint32_t sysex_addr, int pasting) {
@@ -577,26 +1088,144 @@ static void cp_addresses_under_member(MidiClassMember *class_member,
 	return;
 }
 
+/* Leaf addresses of a class, in the same order cp_addresses_under_member
+ * visits them, with addresses relative to the class instance. Built once per
+ * class and shared; the patch file loaders use it as a template. */
+typedef struct s_class_layout {
+	midi_address	    *m_addresses;
+	int		    size;
+	uint32_t	    hash;
+} Class_layout;
+
+/* Indexed like libgieditor_midi_classes. Only access with layout_lock */
+static Class_layout *class_layouts;
+static pthread_mutex_t layout_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int layout_addresses_under_member(MidiClassMember *class_member,
+		midi_address *layout, int *index,
+		uint32_t sysex_addr, uint32_t sysex_addr_base) {
+	int i;
+	MidiClass *class = class_member->class;
+	midi_address *from;
+
+	if (!class) {
+	    from = libgieditor_match_midi_address(sysex_addr);
+	    if (!from) return -1;
+
+	    layout[*index] = *from;
+	    layout[*index].sysex_addr -= sysex_addr_base;
+	    layout[*index].flags = 0;
+	    layout[*index].value = 0;
+	    (*index)++;
+	    return 0;
+	}
+
+	for (i = 0; i < class->size; i++) {
+	    if (layout_addresses_under_member(&class->members[i],
+			    layout, index,
+			    sysex_addr + class->members[i].sysex_addr_base,
+			    sysex_addr_base) < 0) return -1;
+	}
+	return 0;
+}
+
+/* FNV-1a over the relative address and size of every leaf */
+static uint32_t layout_hash(midi_address *layout, int size) {
+	int i, j;
+	uint32_t hash = 2166136261u;
+	uint32_t words[2];
+
+	for (i = 0; i < size; i++) {
+	    words[0] = layout[i].sysex_addr;
+	    words[1] = layout[i].sysex_size;
+	    for (j = 0; j < 8; j++) {
+		hash ^= (words[j / 4] >> ((j % 4) * 8)) & 0xff;
+		hash *= 16777619u;
+	    }
+	}
+	return hash;
+}
+
+/* SYSEX_ADDR is the base of any instance of CLASS, it's only needed to look
+ * up the leaves the first time round. Returns NULL if the class doesn't
+ * map onto the address table there. */
+const midi_address *class_layout(MidiClass *class, uint32_t sysex_addr,
+		int *size, uint32_t *hash) {
+	int i, num_addresses = 0, index = 0;
+	midi_address *layout;
+	Class_layout *cur_layout;
+
+	for (i = 0; i < NUM_CLASSES; i++)
+	    if (libgieditor_midi_classes[i] == class) break;
+	if (i == NUM_CLASSES) return NULL;
+
+	pthread_mutex_lock(&layout_lock);
+	if (!class_layouts)
+	    class_layouts = calloc(NUM_CLASSES, sizeof(Class_layout));
+	cur_layout = &class_layouts[i];
+
+	if (!cur_layout->m_addresses) {
+	    for (i = 0; i < class->size; i++)
+		num_addresses += count_addresses_under_member(
+				&class->members[i], 0);
+
+	    layout = allocate(midi_address, num_addresses);
+	    for (i = 0; i < class->size; i++) {
+		if (layout_addresses_under_member(&class->members[i],
+			    layout, &index,
+			    sysex_addr + class->members[i].sysex_addr_base,
+			    sysex_addr) < 0) {
+		    free(layout);
+		    pthread_mutex_unlock(&layout_lock);
+		    return NULL;
+		}
+	    }
+	    cur_layout->size = num_addresses;
+	    cur_layout->hash = layout_hash(layout, num_addresses);
+	    cur_layout->m_addresses = layout;
+	}
+	pthread_mutex_unlock(&layout_lock);
+
+	*size = cur_layout->size;
+	if (hash) *hash = cur_layout->hash;
+	return cur_layout->m_addresses;
+}
+
+/* Reads every address under CLASS_MEMBER into the address table */
+static int fetch_addresses_under_member(MidiClassMember *class_member,
+		uint32_t sysex_addr) {
+	int i, num_plans = 0, retval;
+	Bulk_plan *plans;
+	Arena_mark mark = arena_mark(&scratch_arena);
+
+	do {
+	    arena_release(&scratch_arena, mark);
+	    num_plans = 0;
+	    plans = scratch_allocate(Bulk_plan,
+			    count_leaf_classes_under_member(class_member));
+	    transfer_addresses_under_member(class_member, sysex_addr,
+			    plans, &num_plans);
+	    retval = read_bulk_plans(plans, num_plans);
+	} while (retval < 0 && forget_region_block_sizes(plans, num_plans));
+	if (retval == 0) {
+	    for (i = 0; i < num_plans; i++) decode_bulk_sysex(&plans[i]);
+	}
+	arena_release(&scratch_arena, mark);
+	return retval;
+}
+
 int libgieditor_copy_class(MidiClass *class, uint32_t sysex_addr, int *depth) {
 	int num_addresses, retval;
 	int index = 0;
 	MidiClassMember *class_member;
         Class_data *cur_class_data, *last_class_data = NULL;
 
-        if (!copy_paste_data) {
-            copy_paste_data = allocate(struct s_class_data, 1);
-            cur_class_data = copy_paste_data;
-	    *depth = 1;
-        } else {
-            cur_class_data = copy_paste_data;
-            while (cur_class_data->next) cur_class_data = cur_class_data->next;
-            cur_class_data->next = allocate(struct s_class_data, 1);
-	    last_class_data = cur_class_data;
-            cur_class_data = cur_class_data->next;
-	    (*depth)++;
-        }
-        cur_class_data->next = NULL;
-	cur_class_data->m_addresses = NULL;
+	if (copy_paste_data) {
+	    last_class_data = copy_paste_data;
+	    while (last_class_data->next)
+		last_class_data = last_class_data->next;
+	}
+	cur_class_data = push_copy_data(depth);
 
 	if (!libgieditor_match_midi_address(sysex_addr)) {
 	    retval = -1;
@@ -606,11 +1235,13 @@ int libgieditor_copy_class(MidiClass *class, uint32_t sysex_addr, int *depth) {
 	class_member = &class->members[match_class_member(sysex_addr,
 								class, 0)];
 	num_addresses = count_addresses_under_member(class_member, sysex_addr);
-	retval = transfer_addresses_under_member(class_member, sysex_addr, 0);
+
+	retval = fetch_addresses_under_member(class_member, sysex_addr);
 	if (retval) goto failed;
 
 	cur_class_data->size = num_addresses;
-	cur_class_data->m_addresses = allocate(midi_address, num_addresses);
+	cur_class_data->m_addresses = copy_allocate(cur_class_data,
+			midi_address, num_addresses);
 	cur_class_data->class = class_member->class;
 	cur_class_data->sysex_addr_base = sysex_addr;
 
@@ -623,111 +1254,183 @@ failed:
 	    copy_paste_data = NULL;
 	else
 	    last_class_data->next = NULL;
-	if (cur_class_data->m_addresses)
-	    free(cur_class_data->m_addresses);
-	free(cur_class_data);
+	drop_copy_data(cur_class_data);
 	(*depth)--;
 	return retval;
 }
 
-int libgieditor_paste_class(MidiClass *class, uint32_t sysex_addr,
-		int *depth) {
-	int dummy, i, retval = 0;
-	Class_data *cur_class_data;
-	Class_data *verify_class_data;
-	Class_data *last_class_data;
-	MidiClassMember *class_member;
-	int index = 0;
-	int *broken_address_data;
-	int broken_addresses = 0, loops;
-	midi_address *cur_broken_addr;
-	uint8_t *data;
+/* Where the top of the copy list would go in CLASS at SYSEX_ADDR. Returns
+ * -1 if there's nothing to paste or nowhere to put it, -2 if it's a
+ * different class */
+static int paste_target(MidiClass *class, uint32_t sysex_addr,
+		MidiClassMember **class_member) {
+	Class_data *cur_class_data = copy_paste_data;
 
-	cur_class_data = copy_paste_data;
 	if (!cur_class_data) return -1;
 
 	if (!libgieditor_match_midi_address(sysex_addr)) return -1;
 
-	class_member = &class->members[match_class_member(sysex_addr,
+	*class_member = &class->members[match_class_member(sysex_addr,
 								class, 0)];
 	/* Sanity check */
 	/* Live set chorus and reverb are compatible with studio set, as long
 	 * as it's GM2 */
 	if ((cur_class_data->class == &libgieditor_liveset_chorus_class &&
-		class_member->class == &libgieditor_studio_chorus_class)    ||
+		(*class_member)->class == &libgieditor_studio_chorus_class) ||
 	    (cur_class_data->class == &libgieditor_liveset_reverb_class &&
-		class_member->class == &libgieditor_studio_reverb_class)    ||
+		(*class_member)->class == &libgieditor_studio_reverb_class) ||
 	    (cur_class_data->class == &libgieditor_studio_chorus_class  &&
-		class_member->class == &libgieditor_liveset_chorus_class)   ||
+		(*class_member)->class == &libgieditor_liveset_chorus_class) ||
 	    (cur_class_data->class == &libgieditor_studio_reverb_class  &&
-		class_member->class == &libgieditor_liveset_reverb_class)) {
+		(*class_member)->class == &libgieditor_liveset_reverb_class)) {
 	    /* We are ok */
-	} else if (class_member->class != cur_class_data->class)
+	} else if ((*class_member)->class != cur_class_data->class)
 	    return -2;
+	return 0;
+}
+
+/* Writes CUR_CLASS_DATA to CLASS_MEMBER at SYSEX_ADDR on the calling
+ * thread's device, reads it all back, and tries again one at a time for
+ * any address that didn't take. Only reads CUR_CLASS_DATA, so several
+ * devices can be pasted to at once. Returns -4 if it can't be read back,
+ * -3 if some addresses are still wrong */
+static int paste_member(MidiClassMember *class_member,
+		Class_data *cur_class_data, uint32_t sysex_addr) {
+	int i, index = 0, broken_addresses = 0;
+	midi_address *from, *to;
+	uint8_t *data;
 
-	cur_class_data->sysex_addr_base = sysex_addr;
 	cp_addresses_under_member(class_member,
 			                cur_class_data, &index, sysex_addr, 1);
-	transfer_addresses_under_member(class_member, sysex_addr, 1);
+	transfer_addresses_under_member(class_member, sysex_addr, NULL, NULL);
 
 	/* Verify that copy was perfect */
-	sysex_wait_write();
-	retval = libgieditor_copy_class(class,
-			cur_class_data->sysex_addr_base, &dummy);
+	libgieditor_wait_sent();
+	if (fetch_addresses_under_member(class_member, sysex_addr)) return -4;
+
+	/* Attempt one by one copy of any addresses that failed */
+	for (i = 0; i < cur_class_data->size; i++) {
+	    from = &cur_class_data->m_addresses[i];
+	    to = libgieditor_match_midi_address(from->sysex_addr + sysex_addr);
+	    if (to->value == from->value) continue;
+
+	    libgieditor_send_sysex_value(from->sysex_addr + sysex_addr,
+			    from->sysex_size, from->value);
+	    if (libgieditor_get_sysex(from->sysex_addr + sysex_addr,
+				    from->sysex_size, &data) < 0) {
+		broken_addresses++;
+		continue;
+	    }
+	    if (from->value != libgieditor_get_sysex_value(data,
+				    from->sysex_size))
+		broken_addresses++;
+	    free(data);
+	}
 
-	if (retval < 0) return -4;
+	return broken_addresses ? -3 : 0;
+}
 
-	broken_address_data = allocate(int, cur_class_data->size);
+/* The table is overwritten before anything is sent, so history is taken
+ * first, from what the destination holds now. Verifying and retrying don't
+ * add to it. */
+static int record_paste_undo(MidiClassMember *class_member,
+		Class_data *class_data, uint32_t sysex_addr) {
+	int i;
 
-	verify_class_data = copy_paste_data;
-	last_class_data = copy_paste_data;
-	while (last_class_data->next->next)
-		last_class_data = last_class_data->next;
-	while (verify_class_data->next)
-		verify_class_data = verify_class_data->next;
-	last_class_data->next = NULL;
+	if (fetch_addresses_under_member(class_member, sysex_addr)) return -4;
+	libgieditor_undo_begin_group();
+	for (i = 0; i < class_data->size; i++) {
+	    undo_record_value(libgieditor_match_midi_address(
+				class_data->m_addresses[i].sysex_addr +
+				sysex_addr),
+			class_data->m_addresses[i].value);
+	}
+	libgieditor_undo_end_group();
+	return 0;
+}
 
-	for (i = 0; i < cur_class_data->size; i++) {
-	    if (verify_class_data->m_addresses[i].value !=
-			cur_class_data->m_addresses[i].value) {
-		broken_address_data[broken_addresses] = i; 
-		broken_addresses ++;
-	    }
+int libgieditor_paste_class(MidiClass *class, uint32_t sysex_addr,
+		int *depth) {
+	int retval, recording;
+	Class_data *cur_class_data = copy_paste_data;
+	MidiClassMember *class_member;
+
+	retval = paste_target(class, sysex_addr, &class_member);
+	if (retval < 0) return retval;
+
+	recording = recording_undo();
+	if (recording) {
+	    if (record_paste_undo(class_member, cur_class_data, sysex_addr))
+		return -4;
+	    undo_suspend();
 	}
 
-	loops = broken_addresses;
-	/* Attempt one by one copy of any addresses that failed */
-	for (i = 0; i < loops; i++) {
-	    cur_broken_addr =
-		    &cur_class_data->m_addresses[broken_address_data[i]];
-	    libgieditor_send_sysex_value(
-				    cur_broken_addr->sysex_addr + 
-				    cur_class_data->sysex_addr_base,
-				    cur_broken_addr->sysex_size,
-				    cur_broken_addr->value);
-	    if (libgieditor_get_sysex(
-				    cur_broken_addr->sysex_addr +
-				    cur_class_data->sysex_addr_base,
-				    cur_broken_addr->sysex_size, &data) < 0) {
-		continue;
-	    }
-	    if (cur_broken_addr->value == libgieditor_get_sysex_value(data,
-						cur_broken_addr->sysex_size)) {
-		broken_addresses--;
-	    }
-	    free(data);
+	cur_class_data->sysex_addr_base = sysex_addr;
+	retval = paste_member(class_member, cur_class_data, sysex_addr);
+	if (recording) undo_resume();
+	if (retval == -4) return retval;
+
+	copy_paste_data = copy_paste_data->next;
+	drop_copy_data(cur_class_data);
+	(*depth) -= 1;
+	return retval;
+}
+
+typedef struct s_paste_job {
+	GiDevice	    *device;
+	MidiClassMember	    *class_member;
+	Class_data	    *class_data;
+	uint32_t	    sysex_addr;
+	pthread_t	    thread;
+	int		    started;
+	int		    retval;
+} Paste_job;
+
+static void *paste_job(void *arg) {
+	Paste_job *job = arg;
+
+	libgieditor_use_device(job->device);
+	/* History is only kept for the first device */
+	if (recording_undo() && record_paste_undo(job->class_member,
+			    job->class_data, job->sysex_addr)) {
+	    job->retval = -4;
+	} else {
+	    undo_suspend();
+	    job->retval = paste_member(job->class_member, job->class_data,
+			    job->sysex_addr);
+	    undo_resume();
 	}
-	
-	if (broken_addresses) retval = -3;
+	return NULL;
+}
+
+int libgieditor_paste_class_to_devices(GiDevice *devices[], int num,
+		MidiClass *class, uint32_t sysex_addr, int *depth) {
+	Paste_job jobs[num];
+	Class_data *cur_class_data = copy_paste_data;
+	MidiClassMember *class_member;
+	int i, retval;
+
+	retval = paste_target(class, sysex_addr, &class_member);
+	if (retval < 0) return retval;
+
+	cur_class_data->sysex_addr_base = sysex_addr;
+	for (i = 0; i < num; i++) {
+	    jobs[i].device = devices[i];
+	    jobs[i].class_member = class_member;
+	    jobs[i].class_data = cur_class_data;
+	    jobs[i].sysex_addr = sysex_addr;
+	    jobs[i].retval = -1;
+	    jobs[i].started = !pthread_create(&jobs[i].thread, NULL,
+			    paste_job, &jobs[i]);
+	}
+	for (i = 0; i < num; i++) {
+	    if (jobs[i].started) pthread_join(jobs[i].thread, NULL);
+	    if (retval == 0) retval = jobs[i].retval;
+	}
+	if (retval == -4) return retval;
 
 	copy_paste_data = copy_paste_data->next;
-	if (cur_class_data->m_addresses)
-		free(cur_class_data->m_addresses);
-	if (verify_class_data->m_addresses)
-		free(verify_class_data->m_addresses);
-	free(verify_class_data);
-	free(cur_class_data);
-	free(broken_address_data);
+	drop_copy_data(cur_class_data);
 	(*depth) -= 1;
 	return retval;
 }
@@ -820,19 +1523,19 @@ int libgieditor_paste_layer_to_part(MidiClass *class, uint32_t sysex_addr,
 
 	if (retval < 0) {
 	    retval = -4;
-	    goto copy_failed;
+	    goto failed;
 	}
 
 	studio_part_data = copy_paste_data;
 
-	sysex_wait_write();
+	libgieditor_wait_sent();
 	retval = libgieditor_copy_class(class_member->class,
 			sysex_addr + studio_offset_address_offset(part),
 			&dummy);
 
 	if (retval < 0) {
 	    retval = -4;
-	    goto copy_failed;
+	    goto failed;
 	}
 
 	studio_offset_data = copy_paste_data;
@@ -843,30 +1546,28 @@ int libgieditor_paste_layer_to_part(MidiClass *class, uint32_t sysex_addr,
 	libgieditor_copy_layer_data(studio_part_data, cur_class_data, layer);
 	libgieditor_copy_offset_data(studio_offset_data, cur_class_data, layer);
 
+	/* Both pastes are undone together */
+	libgieditor_undo_begin_group();
 	retval = libgieditor_paste_class(class_member->class,
 			sysex_addr + studio_part_address_offset(part),
 			&dummy);
 
-	if (retval < 0) goto paste_failed;
-
-	retval = libgieditor_paste_class(class_member->class,
+	if (retval >= 0) retval = libgieditor_paste_class(class_member->class,
 			sysex_addr + studio_offset_address_offset(part),
 			&dummy);
+	libgieditor_undo_end_group();
 
-	if (retval < 0) goto paste_failed;
+	if (retval < 0) goto failed;
 
-	copy_paste_data = first_class_data;
-	copy_paste_data = copy_paste_data->next;
-	if (cur_class_data->m_addresses)
-		free(cur_class_data->m_addresses);
-	free(cur_class_data);
+	/* The studio copies were only ever ours */
+	libgieditor_flush_copy_data(&dummy);
+	copy_paste_data = first_class_data->next;
+	drop_copy_data(first_class_data);
 	(*depth) -= 1;
 	return retval;
 
-paste_failed:
+failed:
 	libgieditor_flush_copy_data(&dummy);
-
-copy_failed:
 	copy_paste_data = first_class_data;
 	return retval;
 }
@@ -876,157 +1577,8 @@ void libgieditor_flush_copy_data(int *depth) {
         while (copy_paste_data) {
             cur_class_data = copy_paste_data;
             copy_paste_data = copy_paste_data->next;
-	    if (cur_class_data->m_addresses) free(cur_class_data->m_addresses);
-            free(cur_class_data);
+	    drop_copy_data(cur_class_data);
         }
 	*depth = 0;
 }
 
-#define CHECK_ERROR(val) \
-	if (!val) goto parse_error;					    \
-	p_error = 0;							    \
-	retval = g_error_matches(error, G_KEY_FILE_ERROR,		    \
-				G_KEY_FILE_ERROR_KEY_NOT_FOUND);	    \
-	if (retval) p_error = 1;					    \
-	retval = g_error_matches(error, G_KEY_FILE_ERROR,		    \
-				G_KEY_FILE_ERROR_INVALID_VALUE);	    \
-	if (retval) p_error = 1;					    \
-	g_clear_error(&error);						    \
-	if (p_error) goto parse_error
-
-int libgieditor_read_copy_data_from_file(char *filename, int *depth) {
-	int retval, p_error, i;
-	GKeyFile *key_file;
-	GError *error;
-	gsize length;
-	gchar *class_name;
-	gchar **address_keys;
-	gchar *cur_key;
-        Class_data *cur_class_data;
-	int num_addresses;
-	uint32_t addr_base, sysex_addr;
-	MidiClass *class;
-	midi_address *cur_address;
-	midi_address *lib_address;
-
-	key_file = g_key_file_new();
-	if (g_key_file_load_from_file(key_file, filename, 
-				G_KEY_FILE_NONE, NULL) == FALSE) return -1;
-	error = NULL;
-
-	num_addresses = g_key_file_get_uint64(key_file, GENERAL_GROUP,
-			SIZE_KEY, &error);
-	CHECK_ERROR(num_addresses);
-
-	addr_base = g_key_file_get_uint64(key_file, GENERAL_GROUP,
-			ADDRESS_BASE_KEY, &error);
-	CHECK_ERROR(addr_base);
-
-	class_name = g_key_file_get_string(key_file, GENERAL_GROUP,
-			CLASS_KEY, &error);
-	CHECK_ERROR(class_name);
-
-	class = libgieditor_match_class_name(class_name);
-	free(class_name);
-	if (!class) goto parse_error;
-
-	address_keys = g_key_file_get_keys(key_file, ADDRESS_GROUP,
-			&length, &error);
-        if (g_error_matches(error, G_KEY_FILE_ERROR,
-			        G_KEY_FILE_ERROR_GROUP_NOT_FOUND)) {
-	    g_clear_error(&error);
-	    goto parse_error;
-	}
-
-	if (length != num_addresses) {
-	    g_strfreev(address_keys);
-	    goto parse_error;
-	}
-
-        if (!copy_paste_data) {
-            copy_paste_data = allocate(struct s_class_data, 1);
-            cur_class_data = copy_paste_data;
-	    *depth = 1;
-        } else {
-            cur_class_data = copy_paste_data;
-            while (cur_class_data->next) cur_class_data = cur_class_data->next;
-            cur_class_data->next = allocate(struct s_class_data, 1);
-            cur_class_data = cur_class_data->next;
-	    (*depth)++;
-        }
-        cur_class_data->next = NULL;
-	cur_class_data->m_addresses = NULL;
-
-	cur_class_data->size = num_addresses;
-	cur_class_data->m_addresses = allocate(midi_address, num_addresses);
-	cur_class_data->class = class;
-	cur_class_data->sysex_addr_base = addr_base;
-
-	for (i = 0; i < num_addresses; i++) {
-	    cur_key = address_keys[i];
-	    if (sscanf(cur_key, "0x%08X", &sysex_addr) != 1) continue;
-	    lib_address = libgieditor_match_midi_address(
-					    sysex_addr + addr_base);
-	    cur_address = &cur_class_data->m_addresses[i];
-
-	    cur_address->sysex_addr = sysex_addr;
-	    cur_address->value = g_key_file_get_uint64(key_file,
-			    ADDRESS_GROUP, cur_key, NULL);
-	    cur_address->class = lib_address->class;
-	    cur_address->sysex_size = lib_address->sysex_size;
-	    cur_address->flags = 0;
-	}
-
-	g_strfreev(address_keys);
-	g_key_file_free(key_file);
-	return 0;
-
-parse_error:
-	return -2;
-}
-
-int libgieditor_write_copy_data_to_file(char *filename, int *depth) {
-	int i;
-	FILE *fp;
-	GKeyFile *key_file;
-	gsize length;
-	gchar key_name[11];
-	gchar *data;
-        Class_data *cur_class_data;
-	midi_address *m_address;
-
-	cur_class_data = copy_paste_data;
-	if (!cur_class_data) return -1;
-	
-	fp = fopen(filename, "w");
-	if (!fp) return -2;
-
-	key_file = g_key_file_new();
-	
-	g_key_file_set_string(key_file, GENERAL_GROUP,
-			    CLASS_KEY, cur_class_data->class->name);
-	g_key_file_set_uint64(key_file, GENERAL_GROUP,
-			    ADDRESS_BASE_KEY, cur_class_data->sysex_addr_base);
-	g_key_file_set_uint64(key_file, GENERAL_GROUP,
-			    SIZE_KEY, cur_class_data->size);
-
-	for (i = 0; i < cur_class_data->size; i++) {
-	    m_address = &cur_class_data->m_addresses[i];
-	    sprintf(key_name, "0x%08X", m_address->sysex_addr);
-	    g_key_file_set_uint64(key_file, ADDRESS_GROUP,
-					key_name, m_address->value);
-	}
-
-	data = g_key_file_to_data(key_file, &length, NULL);
-	size_t s = fwrite(data, sizeof(gchar), length, fp);
-
-	fclose(fp);
-	free(data);
-	g_key_file_free(key_file);
-	copy_paste_data = copy_paste_data->next;
-	if (cur_class_data->m_addresses)
-		free(cur_class_data->m_addresses);
-	free(cur_class_data);
-	(*depth)--;
-	return 0;
-}
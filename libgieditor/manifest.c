@@ -0,0 +1,452 @@
+/* Patch directory manifests
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#define LIBGIEDITOR_PRIVATE
+#include <libgieditor.h>
+#include "arena.h"
+#include "patch_file.h"
+
+#define allocate(t, num) __common_allocate(sizeof(t) * num, "libgieditor")
+
+/* DIR/.manifest holds one line per file:
+ *	filename <tab> size <tab> mtime <tab> class <tab> set name
+ * The class is empty for files that couldn't be parsed. Tabs, newlines and
+ * backslashes in the filename and set name are escaped. */
+#define MANIFEST_FILE		".manifest"
+#define MANIFEST_HEADER		"# libgieditor manifest 1\n"
+
+struct s_patch_manifest {
+	char		*dir;
+	GHashTable	*entries;	/* filename -> ManifestEntry */
+	int		dirty;
+};
+
+/* Scans hand out jobs by index and queue results for the caller's thread,
+ * which is the only one that touches the manifest itself */
+struct s_scan_job {
+	char		*filename;
+	uint64_t	size;		/* As the manifest had it */
+	int64_t		mtime;
+};
+
+typedef struct s_scan_result *Scan_result;
+struct s_scan_result {
+	int		job;
+	uint64_t	size;
+	int64_t		mtime;
+	MidiClass	*class;
+	char		name[MAX_SET_NAME_SIZE + 1];
+	Scan_result	next;
+};
+
+struct s_patch_scan {
+	PatchManifest	    *manifest;
+	struct s_scan_job   *jobs;
+	int		    num_jobs;
+	int		    next_job;		/* Atomic */
+	int		    cancelled;		/* Atomic */
+	pthread_t	    *workers;
+	int		    num_workers;
+	pthread_mutex_t	    result_lock;
+	/* Only access with result_lock */
+	Scan_result	    results, last_result;
+	int		    workers_running;
+};
+
+static int64_t stat_mtime(struct stat *st) {
+	return (int64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static char *full_filename(PatchManifest *manifest, const char *filename) {
+	char *file_path = allocate(char,
+			strlen(manifest->dir) + strlen(filename) + 2);
+	sprintf(file_path, "%s/%s", manifest->dir, filename);
+	return file_path;
+}
+
+static void free_entry(gpointer data) {
+	ManifestEntry *entry = data;
+	free(entry->filename);
+	free(entry);
+}
+
+void write_index_field(FILE *fp, const char *string) {
+	for (; *string; string++) {
+	    switch (*string) {
+		case '\t': fputs("\\t", fp); break;
+		case '\n': fputs("\\n", fp); break;
+		case '\\': fputs("\\\\", fp); break;
+		default: fputc(*string, fp); break;
+	    }
+	}
+}
+
+char *split_index_field(char *field) {
+	char *in = field, *out = field;
+
+	for (; *in && *in != '\t' && *in != '\n'; in++) {
+	    if (*in == '\\' && in[1]) {
+		in++;
+		if (*in == 't') *out++ = '\t';
+		else if (*in == 'n') *out++ = '\n';
+		else *out++ = *in;
+	    } else *out++ = *in;
+	}
+
+	if (*in == '\t') {
+	    *out = '\0';
+	    return in + 1;
+	}
+	*out = '\0';
+	return NULL;
+}
+
+int split_index_line(char *line, char **fields, int num) {
+	int i;
+
+	fields[0] = line;
+	for (i = 1; i < num; i++) {
+	    fields[i] = split_index_field(fields[i - 1]);
+	    if (!fields[i]) return -1;
+	}
+	split_index_field(fields[num - 1]);
+	return 0;
+}
+
+static void load_manifest(PatchManifest *manifest) {
+	FILE *fp;
+	char *file_path, *line = NULL;
+	char *fields[5];
+	size_t line_size = 0;
+	ManifestEntry *entry;
+
+	file_path = full_filename(manifest, MANIFEST_FILE);
+	fp = fopen(file_path, "r");
+	free(file_path);
+	if (!fp) return;
+
+	if (getline(&line, &line_size, fp) < 0 ||
+			strcmp(line, MANIFEST_HEADER)) goto out;
+
+	while (getline(&line, &line_size, fp) >= 0) {
+	    if (split_index_line(line, fields, 5) < 0) continue;
+
+	    entry = allocate(ManifestEntry, 1);
+	    entry->filename = strdup(fields[0]);
+	    entry->size = strtoull(fields[1], NULL, 10);
+	    entry->mtime = strtoll(fields[2], NULL, 10);
+	    entry->class = fields[3][0] ?
+		    libgieditor_match_class_name(fields[3]) : NULL;
+	    strncpy(entry->name, fields[4], MAX_SET_NAME_SIZE);
+	    entry->name[MAX_SET_NAME_SIZE] = '\0';
+
+	    /* A class this build doesn't know about, have another look */
+	    if (fields[3][0] && !entry->class) entry->mtime = -1;
+
+	    g_hash_table_replace(manifest->entries, entry->filename, entry);
+	}
+
+out:
+	free(line);
+	fclose(fp);
+}
+
+PatchManifest *libgieditor_manifest_open(const char *dir) {
+	PatchManifest *manifest = allocate(PatchManifest, 1);
+
+	manifest->dir = strdup(dir);
+	manifest->entries = g_hash_table_new_full(g_str_hash, g_str_equal,
+			NULL, free_entry);
+	manifest->dirty = 0;
+
+	load_manifest(manifest);
+	return manifest;
+}
+
+static ManifestEntry *update_entry(PatchManifest *manifest,
+		const char *filename, uint64_t size, int64_t mtime,
+		MidiClass *class, const char *name) {
+	ManifestEntry *entry = g_hash_table_lookup(manifest->entries, filename);
+
+	if (!entry) {
+	    entry = allocate(ManifestEntry, 1);
+	    entry->filename = strdup(filename);
+	    g_hash_table_replace(manifest->entries, entry->filename, entry);
+	}
+
+	entry->size = size;
+	entry->mtime = mtime;
+	entry->class = class;
+	strcpy(entry->name, name);
+	manifest->dirty = 1;
+	return entry;
+}
+
+const ManifestEntry *libgieditor_manifest_lookup(PatchManifest *manifest,
+		const char *filename, int parse) {
+	ManifestEntry *entry;
+	MidiClass *class;
+	struct stat st;
+	char *file_path;
+	char name[MAX_SET_NAME_SIZE + 1];
+
+	file_path = full_filename(manifest, filename);
+	if (stat(file_path, &st) < 0 || !S_ISREG(st.st_mode)) {
+	    free(file_path);
+	    return NULL;
+	}
+
+	entry = g_hash_table_lookup(manifest->entries, filename);
+	if (entry && entry->size == st.st_size &&
+			entry->mtime == stat_mtime(&st)) {
+	    free(file_path);
+	    return entry;
+	}
+
+	if (!parse) {
+	    free(file_path);
+	    return NULL;
+	}
+
+	name[0] = '\0';
+	if (patch_file_summary(file_path, &class, name)) class = NULL;
+	free(file_path);
+
+	return update_entry(manifest, filename, st.st_size, stat_mtime(&st),
+			class, name);
+}
+
+/* Entries for files that have gone away aren't worth keeping */
+static gboolean prune_entry(gpointer key, gpointer value, gpointer data) {
+	PatchManifest *manifest = data;
+	struct stat st;
+	char *file_path;
+	int missing;
+
+	file_path = full_filename(manifest, key);
+	missing = stat(file_path, &st) < 0;
+	free(file_path);
+
+	if (missing) manifest->dirty = 1;
+	return missing;
+}
+
+static void write_entry(gpointer key, gpointer value, gpointer data) {
+	ManifestEntry *entry = value;
+	FILE *fp = data;
+
+	write_index_field(fp, entry->filename);
+	fprintf(fp, "\t%llu\t%lld\t%s\t",
+			(unsigned long long) entry->size,
+			(long long) entry->mtime,
+			entry->class ? entry->class->name : "");
+	write_index_field(fp, entry->name);
+	fputc('\n', fp);
+}
+
+/* Returns 0 if there was nothing to do, -2 if the manifest couldn't be
+ * written (a read only directory, for instance) */
+int libgieditor_manifest_save(PatchManifest *manifest) {
+	FILE *fp;
+	char *file_path, *temp_name;
+	int retval;
+
+	g_hash_table_foreach_remove(manifest->entries, prune_entry, manifest);
+	if (!manifest->dirty) return 0;
+
+	file_path = full_filename(manifest, MANIFEST_FILE);
+	fp = open_temp_file(file_path, &temp_name);
+	if (!fp) {
+	    free(file_path);
+	    return -2;
+	}
+
+	fputs(MANIFEST_HEADER, fp);
+	g_hash_table_foreach(manifest->entries, write_entry, fp);
+
+	retval = close_temp_file(fp, file_path, temp_name, 0);
+	free(file_path);
+	if (!retval) manifest->dirty = 0;
+	return retval;
+}
+
+void libgieditor_manifest_close(PatchManifest *manifest) {
+	g_hash_table_destroy(manifest->entries);
+	free(manifest->dir);
+	free(manifest);
+}
+
+/* Returns NULL if the file is missing or the manifest is up to date */
+static Scan_result scan_file(PatchScan *scan, int job) {
+	struct s_scan_job *cur_job = &scan->jobs[job];
+	Scan_result result;
+	struct stat st;
+	char *file_path;
+
+	file_path = full_filename(scan->manifest, cur_job->filename);
+	if (stat(file_path, &st) < 0 || !S_ISREG(st.st_mode) ||
+		(cur_job->size == st.st_size &&
+		 cur_job->mtime == stat_mtime(&st))) {
+	    free(file_path);
+	    return NULL;
+	}
+
+	result = allocate(struct s_scan_result, 1);
+	result->job = job;
+	result->size = st.st_size;
+	result->mtime = stat_mtime(&st);
+	result->name[0] = '\0';
+	result->next = NULL;
+	if (patch_file_summary(file_path, &result->class, result->name))
+	    result->class = NULL;
+
+	free(file_path);
+	return result;
+}
+
+static void *scan_worker(void *arg) {
+	PatchScan *scan = arg;
+	Scan_result result;
+	int job;
+
+	while (!__atomic_load_n(&scan->cancelled, __ATOMIC_RELAXED)) {
+	    job = __atomic_fetch_add(&scan->next_job, 1, __ATOMIC_RELAXED);
+	    if (job >= scan->num_jobs) break;
+
+	    result = scan_file(scan, job);
+	    if (!result) continue;
+
+	    pthread_mutex_lock(&scan->result_lock);
+	    if (scan->last_result) scan->last_result->next = result;
+	    else scan->results = result;
+	    scan->last_result = result;
+	    pthread_mutex_unlock(&scan->result_lock);
+	}
+
+	pthread_mutex_lock(&scan->result_lock);
+	scan->workers_running--;
+	pthread_mutex_unlock(&scan->result_lock);
+	return NULL;
+}
+
+PatchScan *libgieditor_scan_start(PatchManifest *manifest,
+		char **filenames, int num) {
+	PatchScan *scan = allocate(PatchScan, 1);
+	ManifestEntry *entry;
+	long num_cpus;
+	int i;
+
+	scan->manifest = manifest;
+	scan->jobs = allocate(struct s_scan_job, num);
+	scan->num_jobs = num;
+	scan->next_job = 0;
+	scan->cancelled = 0;
+	scan->results = scan->last_result = NULL;
+	pthread_mutex_init(&scan->result_lock, NULL);
+
+	for (i = 0; i < num; i++) {
+	    scan->jobs[i].filename = strdup(filenames[i]);
+	    entry = g_hash_table_lookup(manifest->entries, filenames[i]);
+	    scan->jobs[i].size = entry ? entry->size : UINT64_MAX;
+	    scan->jobs[i].mtime = entry ? entry->mtime : -1;
+	}
+
+	num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	scan->num_workers = num_cpus > 0 ? num_cpus : 1;
+	if (scan->num_workers > num) scan->num_workers = num;
+	scan->workers = allocate(pthread_t, scan->num_workers);
+
+	scan->workers_running = scan->num_workers;
+	for (i = 0; i < scan->num_workers; i++) {
+	    if (pthread_create(&scan->workers[i], NULL, scan_worker, scan)) {
+		/* Those started may already have finished */
+		pthread_mutex_lock(&scan->result_lock);
+		scan->workers_running -= scan->num_workers - i;
+		pthread_mutex_unlock(&scan->result_lock);
+		scan->num_workers = i;
+		break;
+	    }
+	}
+
+	/* No threads to be had, do it the slow way */
+	if (!scan->num_workers) {
+	    scan->workers_running = 1;
+	    scan_worker(scan);
+	}
+	return scan;
+}
+
+const ManifestEntry *libgieditor_scan_poll(PatchScan *scan) {
+	Scan_result result;
+	ManifestEntry *entry;
+
+	pthread_mutex_lock(&scan->result_lock);
+	result = scan->results;
+	if (result) {
+	    scan->results = result->next;
+	    if (!scan->results) scan->last_result = NULL;
+	}
+	pthread_mutex_unlock(&scan->result_lock);
+
+	if (!result) return NULL;
+
+	entry = update_entry(scan->manifest, scan->jobs[result->job].filename,
+			result->size, result->mtime,
+			result->class, result->name);
+	free(result);
+	return entry;
+}
+
+int libgieditor_scan_done(PatchScan *scan) {
+	int done;
+
+	pthread_mutex_lock(&scan->result_lock);
+	done = !scan->workers_running && !scan->results;
+	pthread_mutex_unlock(&scan->result_lock);
+	return done;
+}
+
+void libgieditor_scan_stop(PatchScan *scan) {
+	int i;
+
+	__atomic_store_n(&scan->cancelled, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < scan->num_workers; i++)
+	    pthread_join(scan->workers[i], NULL);
+
+	/* Whatever was finished is still worth keeping */
+	while (libgieditor_scan_poll(scan));
+
+	for (i = 0; i < scan->num_jobs; i++)
+	    free(scan->jobs[i].filename);
+	free(scan->jobs);
+	free(scan->workers);
+	pthread_mutex_destroy(&scan->result_lock);
+	free(scan);
+}
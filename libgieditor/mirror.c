@@ -0,0 +1,263 @@
+/* Parameter mirror
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Every value the library reads from or writes to the first Juno, in POSIX
+ * shared memory, one per entry of libgieditor_midi_addresses, so other
+ * processes can read them without asking the Juno. Values are updated
+ * under a sequence count per block of MIRROR_BLOCK entries: odd while one
+ * is being written, so readers copy a block, and copy it again if the
+ * count was odd or moved meanwhile. Writers in this process take a lock
+ * between themselves; readers never take a lock. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LIBGIEDITOR_PRIVATE
+#include <libgieditor.h>
+#include "midi_addresses.h"
+#include "mirror.h"
+#include "shm_segment.h"
+
+#define allocate(t, num) __common_allocate(sizeof(t) * num, "libgieditor")
+#define NUM_ADDRESSES libgieditor_num_addresses
+
+#define MIRROR_PREFIX		"gieditor-mirror."
+#define MIRROR_VERSION		2
+#define MIRROR_NAME_SIZE	32
+#define SHM_NAME_SIZE		(MIRROR_NAME_SIZE + 32)
+
+#define num_blocks(num) (((num) + MIRROR_BLOCK - 1) / MIRROR_BLOCK)
+
+/* Followed by a sequence count per block, then the values, then a byte per
+ * value that is nonzero once it's known */
+struct s_param_mirror {
+	uint32_t	version;
+	int32_t		pid;
+	char		name[MIRROR_NAME_SIZE];
+	uint32_t	num_addresses;
+	uint32_t	table_hash;	/* Of the address table it indexes */
+	uint32_t	generation;	/* Counts updates */
+	uint32_t	seq[];
+};
+
+#define mirror_values(mirror) \
+	((mirror)->seq + num_blocks((mirror)->num_addresses))
+#define mirror_known(mirror) \
+	((uint8_t *) (mirror_values(mirror) + (mirror)->num_addresses))
+#define mirror_size(num) (sizeof(Param_mirror) + \
+		(num_blocks(num) + (num)) * sizeof(uint32_t) + (num))
+
+static Param_mirror *mirror;
+static pthread_mutex_t mirror_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* FNV-1a over the address and size of every entry, so a reader built with
+ * the table in another order doesn't take one parameter for another */
+static uint32_t table_hash(void) {
+	static uint32_t table;
+	uint32_t hash = __atomic_load_n(&table, __ATOMIC_RELAXED), words[2];
+	int i, j;
+
+	if (hash) return hash;
+	hash = 2166136261u;
+	for (i = 0; i < NUM_ADDRESSES; i++) {
+	    words[0] = libgieditor_midi_addresses[i].sysex_addr;
+	    words[1] = libgieditor_midi_addresses[i].sysex_size;
+	    for (j = 0; j < 8; j++) {
+		hash ^= (words[j / 4] >> ((j % 4) * 8)) & 0xff;
+		hash *= 16777619u;
+	    }
+	}
+	__atomic_store_n(&table, hash, __ATOMIC_RELAXED);
+	return hash;
+}
+
+void mirror_open(const char *client_name) {
+	char path[SHM_NAME_SIZE];
+	Param_mirror *shared;
+	size_t size = mirror_size(NUM_ADDRESSES);
+	int fd;
+
+	if (mirror || !getenv(MIRROR_ENV)) return;
+
+	shm_segment_name(path, sizeof(path), MIRROR_PREFIX, client_name,
+			getpid());
+	fd = shm_open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return;
+	if (ftruncate(fd, size) < 0) {
+	    close(fd);
+	    shm_unlink(path);
+	    return;
+	}
+	shared = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shared == MAP_FAILED) {
+	    shm_unlink(path);
+	    return;
+	}
+
+	/* ftruncate has zeroed it */
+	strncpy(shared->name, client_name, MIRROR_NAME_SIZE - 1);
+	shared->pid = getpid();
+	shared->num_addresses = NUM_ADDRESSES;
+	shared->table_hash = table_hash();
+	__atomic_store_n(&shared->version, MIRROR_VERSION, __ATOMIC_RELEASE);
+	mirror = shared;
+}
+
+void mirror_close(void) {
+	char path[SHM_NAME_SIZE];
+
+	if (!mirror) return;
+	shm_segment_name(path, sizeof(path), MIRROR_PREFIX, mirror->name,
+			mirror->pid);
+	shm_unlink(path);
+	munmap(mirror, mirror_size(mirror->num_addresses));
+	mirror = NULL;
+}
+
+/* Called with mirror_lock held. Readers retry a block while its count is
+ * odd, so everything written between these is seen together */
+static void begin_block(int block) {
+	uint32_t *seq = &mirror->seq[block];
+
+	__atomic_store_n(seq, __atomic_load_n(seq, __ATOMIC_RELAXED) + 1,
+			__ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void end_block(int block) {
+	uint32_t *seq = &mirror->seq[block];
+
+	__atomic_store_n(seq, __atomic_load_n(seq, __ATOMIC_RELAXED) + 1,
+			__ATOMIC_RELEASE);
+}
+
+/* Each parameter starting in the data, in turn, with each block changed
+ * all at once. A value that doesn't all fit isn't known */
+void mirror_store(uint32_t sysex_addr, const uint8_t *data,
+		uint32_t sysex_size) {
+	uint32_t from = libgieditor_linear_addr(sysex_addr), offset;
+	int id, first, end, size, block = -1;
+
+	if (!mirror) return;
+	if (libgieditor_param_span(sysex_addr, sysex_size, &first, &end) <= 0)
+	    return;
+
+	pthread_mutex_lock(&mirror_lock);
+	for (id = first; id < end; id++) {
+	    offset = libgieditor_midi_linear_addrs[id] - from;
+	    size = libgieditor_midi_addresses[id].sysex_size;
+	    if (offset + size > sysex_size) break;
+
+	    if (id / MIRROR_BLOCK != block) {
+		if (block >= 0) end_block(block);
+		block = id / MIRROR_BLOCK;
+		begin_block(block);
+	    }
+	    __atomic_store_n(&mirror_values(mirror)[id],
+			    libgieditor_get_sysex_value((uint8_t *)
+				    data + offset, size), __ATOMIC_RELAXED);
+	    __atomic_store_n(&mirror_known(mirror)[id], 1,
+			    __ATOMIC_RELAXED);
+	}
+	if (block >= 0) end_block(block);
+	__atomic_add_fetch(&mirror->generation, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&mirror_lock);
+}
+
+int libgieditor_mirror_list(void (*func)(const char *shm_name, void *arg),
+		void *arg) {
+	return shm_segment_list(MIRROR_PREFIX, func, arg);
+}
+
+const Param_mirror *libgieditor_mirror_map(const char *shm_name) {
+	char path[SHM_NAME_SIZE];
+	const Param_mirror *shared;
+	struct stat st;
+	int fd;
+
+	snprintf(path, sizeof(path), "/%s", shm_name);
+	fd = shm_open(path, O_RDONLY, 0);
+	if (fd < 0) return NULL;
+	if (fstat(fd, &st) < 0 || st.st_size != mirror_size(NUM_ADDRESSES)) {
+	    close(fd);
+	    return NULL;
+	}
+	shared = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shared == MAP_FAILED) return NULL;
+
+	/* From another build of the address table, the indices won't match */
+	if (__atomic_load_n(&shared->version, __ATOMIC_ACQUIRE) !=
+			MIRROR_VERSION ||
+			shared->num_addresses != NUM_ADDRESSES ||
+			shared->table_hash != table_hash()) {
+	    libgieditor_mirror_unmap(shared);
+	    return NULL;
+	}
+	return shared;
+}
+
+void libgieditor_mirror_unmap(const Param_mirror *shared) {
+	munmap((void *) shared, mirror_size(shared->num_addresses));
+}
+
+uint32_t libgieditor_mirror_generation(const Param_mirror *shared) {
+	return __atomic_load_n(&shared->generation, __ATOMIC_ACQUIRE);
+}
+
+int libgieditor_mirror_read(const Param_mirror *shared, int first, int num,
+		uint32_t *values, uint8_t *known) {
+	const uint32_t *seq;
+	uint32_t before, after;
+	int i, j, block, end, last = first + num;
+
+	if (first < 0 || num < 0 || last > shared->num_addresses) return -1;
+
+	for (i = first; i < last; i = end) {
+	    block = i / MIRROR_BLOCK;
+	    end = (block + 1) * MIRROR_BLOCK;
+	    if (end > last) end = last;
+	    seq = &shared->seq[block];
+
+	    do {
+		while ((before = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1);
+		for (j = i; j < end; j++) {
+		    values[j - first] = __atomic_load_n(
+				    &mirror_values(shared)[j],
+				    __ATOMIC_RELAXED);
+		    if (known) known[j - first] = __atomic_load_n(
+				    &mirror_known(shared)[j],
+				    __ATOMIC_RELAXED);
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(seq, __ATOMIC_RELAXED);
+	    } while (before != after);
+	}
+	return 0;
+}
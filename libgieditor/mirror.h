@@ -0,0 +1,30 @@
+/* Parameter mirror hooks
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Called by libgieditor_init and libgieditor_close. Nothing is published
+ * unless MIRROR_ENV is set */
+extern void mirror_open(const char *client_name);
+extern void mirror_close(void);
+
+/* SIZE bytes of DATA were read from or written to SYSEX_ADDR. Does nothing
+ * if the mirror isn't open */
+extern void mirror_store(uint32_t sysex_addr, const uint8_t *data,
+		uint32_t sysex_size);
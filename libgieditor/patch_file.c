@@ -0,0 +1,635 @@
+/* Patch file readers and writers
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LIBGIEDITOR_PRIVATE
+#include <libgieditor.h>
+#include "arena.h"
+#include "copy_data.h"
+#include "patch_file.h"
+
+#define allocate(t, num) __common_allocate(sizeof(t) * num, "libgieditor")
+#define MAX_CLASS_NAME 256
+
+/* Binary snapshots: a header, the class name (NUL terminated, padded to 4
+ * bytes), then one uint32_t value per leaf address in class layout order.
+ * Addresses and sizes aren't stored; LAYOUT_HASH ties the values to the
+ * layout of the class they were written from. Files are written in native
+ * byte order and swapped on load if need be. */
+#define SNAPSHOT_MAGIC		"GiPatch"
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_BYTE_ORDER	0x01020304
+
+struct s_snapshot_header {
+	char		magic[8];
+	uint32_t	byte_order;
+	uint16_t	version;
+	uint16_t	header_size;	/* Up to the class name */
+	uint32_t	name_size;	/* Padded */
+	uint32_t	sysex_addr_base;
+	uint32_t	layout_hash;
+	uint32_t	size;
+};
+
+/* The keyfile format is what GKeyFile reads and writes, but handled here in a
+ * single pass over the mapped file: the General group gives the class and
+ * size up front, so the Addresses group goes straight into its final array.
+ * The writer produces the same bytes g_key_file_to_data() did. */
+enum keyfile_group {
+	GROUP_NONE,
+	GROUP_GENERAL,
+	GROUP_ADDRESSES,
+	GROUP_OTHER,
+};
+
+#define IS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || \
+		(c) == '\n' || (c) == '\f' || (c) == '\v')
+
+/* Returns the line at *POS with surrounding whitespace stripped and moves
+ * *POS past it. Returns NULL at the end of the data. */
+static const char *next_line(const char *data, size_t length, size_t *pos,
+		size_t *line_length) {
+	const char *line, *end;
+
+	if (*pos >= length) return NULL;
+
+	line = data + *pos;
+	end = memchr(line, '\n', length - *pos);
+	if (!end) end = data + length;
+	*pos = end - data + 1;
+
+	while (line < end && IS_SPACE(*line)) line++;
+	while (end > line && IS_SPACE(end[-1])) end--;
+	*line_length = end - line;
+	return line;
+}
+
+static enum keyfile_group match_group(const char *line, size_t line_length) {
+	if (line_length < 2 || line[line_length - 1] != ']')
+	    return GROUP_OTHER;
+	line++;
+	line_length -= 2;
+
+	if (line_length == strlen(GENERAL_GROUP) &&
+		    !memcmp(line, GENERAL_GROUP, line_length))
+	    return GROUP_GENERAL;
+	if (line_length == strlen(ADDRESS_GROUP) &&
+		    !memcmp(line, ADDRESS_GROUP, line_length))
+	    return GROUP_ADDRESSES;
+	return GROUP_OTHER;
+}
+
+/* Splits "key = value". Returns -1 if there's no '=' */
+static int split_key(const char *line, size_t line_length,
+		size_t *key_length, const char **value, size_t *value_length) {
+	const char *equals = memchr(line, '=', line_length);
+	const char *end = line + line_length;
+
+	if (!equals) return -1;
+
+	*key_length = equals - line;
+	while (*key_length && IS_SPACE(line[*key_length - 1])) (*key_length)--;
+
+	*value = equals + 1;
+	while (*value < end && IS_SPACE(**value)) (*value)++;
+	*value_length = end - *value;
+	return 0;
+}
+
+static int key_matches(const char *key, size_t key_length, const char *name) {
+	return key_length == strlen(name) && !memcmp(key, name, key_length);
+}
+
+static int parse_number(const char *string, size_t length, int base,
+		uint32_t *number) {
+	uint64_t value = 0;
+	int digit;
+
+	if (!length) return -1;
+
+	for (; length; string++, length--) {
+	    if (*string >= '0' && *string <= '9') digit = *string - '0';
+	    else if (*string >= 'a' && *string <= 'f') digit = *string - 'a' + 10;
+	    else if (*string >= 'A' && *string <= 'F') digit = *string - 'A' + 10;
+	    else return -1;
+
+	    if (digit >= base) return -1;
+	    value = value * base + digit;
+	    if (value > UINT32_MAX) return -1;
+	}
+	*number = value;
+	return 0;
+}
+
+/* Undoes the escaping done by write_escaped() */
+static int parse_string(const char *string, size_t length,
+		char *buf, size_t buf_size) {
+	size_t i, out = 0;
+	char c;
+
+	for (i = 0; i < length; i++) {
+	    c = string[i];
+	    if (c == '\\' && ++i < length) {
+		switch (string[i]) {
+		    case 's': c = ' '; break;
+		    case 'n': c = '\n'; break;
+		    case 't': c = '\t'; break;
+		    case 'r': c = '\r'; break;
+		    case '\\': c = '\\'; break;
+		    default: return -1;
+		}
+	    }
+	    if (out + 1 >= buf_size) return -1;
+	    buf[out++] = c;
+	}
+	buf[out] = '\0';
+	return 0;
+}
+
+/* One "0x00001234=56" line. The layout saves looking the address up in the
+ * library table when the file is in the usual order. */
+static int parse_address(const char *key, size_t key_length,
+		const char *value, size_t value_length,
+		Class_data *class_data, const midi_address *layout,
+		int layout_size, int index) {
+	midi_address *cur_address = &class_data->m_addresses[index];
+	const midi_address *lib_address;
+	uint32_t sysex_addr, sysex_value;
+
+	if (key_length < 3 || key[0] != '0' || (key[1] != 'x' && key[1] != 'X'))
+	    return -1;
+	if (parse_number(key + 2, key_length - 2, 16, &sysex_addr) < 0)
+	    return -1;
+	if (parse_number(value, value_length, 10, &sysex_value) < 0)
+	    return -1;
+
+	if (layout && index < layout_size &&
+			layout[index].sysex_addr == sysex_addr) {
+	    lib_address = &layout[index];
+	} else {
+	    lib_address = libgieditor_match_midi_address(
+			    sysex_addr + class_data->sysex_addr_base);
+	    if (!lib_address) return -1;
+	}
+
+	cur_address->sysex_addr = sysex_addr;
+	cur_address->value = sysex_value;
+	cur_address->class = lib_address->class;
+	cur_address->sysex_size = lib_address->sysex_size;
+	cur_address->flags = 0;
+	return 0;
+}
+
+/* Addresses can only be stored once General has been seen. If a file has
+ * them the other way round, a second pass picks them up.
+ * If MAX_ADDRESSES is set, parsing stops after that many addresses. */
+static int parse_keyfile(const char *data, size_t length,
+		Class_data *class_data, Arena *arena,
+		unsigned int max_addresses) {
+	enum keyfile_group group;
+	const char *line, *key, *value;
+	size_t pos, line_length, key_length, value_length;
+	char class_name[MAX_CLASS_NAME];
+	const midi_address *layout = NULL;
+	MidiClass *class = NULL;
+	uint32_t num_addresses = 0, addr_base = 0, wanted = 0;
+	int pass, index = 0, deferred, layout_size = 0;
+
+	class_data->m_addresses = NULL;
+
+	for (pass = 0; pass < 2; pass++) {
+	    group = GROUP_NONE;
+	    deferred = 0;
+	    pos = 0;
+
+	    while ((line = next_line(data, length, &pos, &line_length))) {
+		if (!line_length || *line == '#') continue;
+
+		if (*line == '[') {
+		    group = match_group(line, line_length);
+		    if (group != GROUP_ADDRESSES || class_data->m_addresses)
+			continue;
+
+		    if (!num_addresses || !addr_base || !class) {
+			deferred = 1;
+			continue;
+		    }
+
+		    wanted = num_addresses;
+		    if (max_addresses && max_addresses < wanted)
+			wanted = max_addresses;
+
+		    class_data->size = wanted;
+		    class_data->m_addresses = arena_alloc(arena,
+				    sizeof(midi_address) * wanted);
+		    class_data->class = class;
+		    class_data->sysex_addr_base = addr_base;
+		    class_data->next = NULL;
+		    layout = class_layout(class, addr_base, &layout_size, NULL);
+		    continue;
+		}
+
+		key = line;
+		if (split_key(line, line_length, &key_length,
+				    &value, &value_length) < 0) return -2;
+
+		switch (group) {
+		    case GROUP_GENERAL:
+			if (pass) break;
+			if (key_matches(key, key_length, SIZE_KEY)) {
+			    if (parse_number(value, value_length, 10,
+						    &num_addresses) < 0)
+				return -2;
+			} else if (key_matches(key, key_length,
+						    ADDRESS_BASE_KEY)) {
+			    if (parse_number(value, value_length, 10,
+						    &addr_base) < 0)
+				return -2;
+			} else if (key_matches(key, key_length, CLASS_KEY)) {
+			    if (parse_string(value, value_length, class_name,
+						    sizeof(class_name)) < 0)
+				return -2;
+			    class = libgieditor_match_class_name(class_name);
+			    if (!class) return -2;
+			}
+			break;
+		    case GROUP_ADDRESSES:
+			if (!class_data->m_addresses) break;
+			if (index == wanted) return -2;
+			if (parse_address(key, key_length, value, value_length,
+					class_data, layout, layout_size,
+					index) < 0) return -2;
+			if (++index == wanted && wanted < num_addresses)
+			    return 0;
+			break;
+		    default:
+			break;
+		}
+	    }
+
+	    if (!deferred || class_data->m_addresses) break;
+	    if (!num_addresses || !addr_base || !class) return -2;
+	}
+
+	if (!class_data->m_addresses || index != wanted) return -2;
+	return 0;
+}
+
+/* Writers go through a temporary file in the same directory that is renamed
+ * over FILENAME once complete, so a failed save leaves the old file alone */
+FILE *open_temp_file(const char *filename, char **temp_name) {
+	int fd;
+	mode_t mask;
+	FILE *fp;
+
+	*temp_name = allocate(char, strlen(filename) + 8);
+	sprintf(*temp_name, "%s.XXXXXX", filename);
+
+	fd = mkstemp(*temp_name);
+	if (fd < 0) {
+	    free(*temp_name);
+	    return NULL;
+	}
+
+	/* mkstemp() creates files 0600, match what fopen() would have done */
+	mask = umask(0);
+	umask(mask);
+	fchmod(fd, 0666 & ~mask);
+
+	fp = fdopen(fd, "w");
+	if (!fp) {
+	    close(fd);
+	    unlink(*temp_name);
+	    free(*temp_name);
+	}
+	return fp;
+}
+
+int close_temp_file(FILE *fp, const char *filename, char *temp_name,
+		int failed) {
+	if (ferror(fp) || fflush(fp) || fsync(fileno(fp))) failed = 1;
+	if (fclose(fp)) failed = 1;
+	if (!failed && rename(temp_name, filename)) failed = 1;
+
+	if (failed) unlink(temp_name);
+	free(temp_name);
+	return failed ? -2 : 0;
+}
+
+/* Same escaping as g_key_file_set_string() */
+static void write_escaped(FILE *fp, const char *string) {
+	const char *p;
+
+	for (p = string; *p; p++) {
+	    switch (*p) {
+		case ' ':
+		    if (p == string) fputs("\\s", fp);
+		    else fputc(' ', fp);
+		    break;
+		case '\n': fputs("\\n", fp); break;
+		case '\t': fputs("\\t", fp); break;
+		case '\r': fputs("\\r", fp); break;
+		case '\\': fputs("\\\\", fp); break;
+		default: fputc(*p, fp); break;
+	    }
+	}
+}
+
+static int write_keyfile(const char *filename, Class_data *class_data) {
+	int i;
+	FILE *fp;
+	char *temp_name;
+	midi_address *m_address;
+
+	fp = open_temp_file(filename, &temp_name);
+	if (!fp) return -2;
+
+	fprintf(fp, "[%s]\n%s=", GENERAL_GROUP, CLASS_KEY);
+	write_escaped(fp, class_data->class->name);
+	fprintf(fp, "\n%s=%u\n%s=%u\n\n[%s]\n",
+			ADDRESS_BASE_KEY, class_data->sysex_addr_base,
+			SIZE_KEY, class_data->size, ADDRESS_GROUP);
+
+	for (i = 0; i < class_data->size; i++) {
+	    m_address = &class_data->m_addresses[i];
+	    fprintf(fp, "0x%08X=%u\n", m_address->sysex_addr,
+			    m_address->value);
+	}
+
+	return close_temp_file(fp, filename, temp_name, 0);
+}
+
+static int is_snapshot(const uint8_t *data, size_t length) {
+	return length >= sizeof(struct s_snapshot_header) &&
+		!memcmp(data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+}
+
+/* DATA is the whole mapped file. Only the first MAX_ADDRESSES values are
+ * loaded, if it's set */
+static int parse_snapshot(const uint8_t *data, size_t length,
+		Class_data *class_data, Arena *arena,
+		unsigned int max_addresses) {
+	struct s_snapshot_header header;
+	const uint32_t *values;
+	const midi_address *layout;
+	const char *class_name;
+	MidiClass *class;
+	uint32_t hash;
+	int i, num_addresses, swap;
+
+	memcpy(&header, data, sizeof(header));
+
+	if (header.byte_order == SNAPSHOT_BYTE_ORDER) swap = 0;
+	else if (header.byte_order == __builtin_bswap32(SNAPSHOT_BYTE_ORDER))
+	    swap = 1;
+	else return -2;
+
+	if (swap) {
+	    header.version = __builtin_bswap16(header.version);
+	    header.header_size = __builtin_bswap16(header.header_size);
+	    header.name_size = __builtin_bswap32(header.name_size);
+	    header.sysex_addr_base = __builtin_bswap32(header.sysex_addr_base);
+	    header.layout_hash = __builtin_bswap32(header.layout_hash);
+	    header.size = __builtin_bswap32(header.size);
+	}
+
+	if (header.version != SNAPSHOT_VERSION) return -2;
+	if (header.header_size < sizeof(header) || header.header_size % 4 ||
+			header.name_size == 0 || header.name_size % 4 ||
+			header.name_size > MAX_CLASS_NAME) return -2;
+	if (length != header.header_size + header.name_size +
+			(size_t) header.size * sizeof(uint32_t)) return -2;
+
+	class_name = (const char *) data + header.header_size;
+	if (!memchr(class_name, '\0', header.name_size)) return -2;
+
+	class = libgieditor_match_class_name((char *) class_name);
+	if (!class) return -2;
+
+	layout = class_layout(class, header.sysex_addr_base,
+			&num_addresses, &hash);
+	if (!layout) return -2;
+	if (num_addresses != header.size || hash != header.layout_hash)
+	    return -2;
+	if (max_addresses && max_addresses < num_addresses)
+	    num_addresses = max_addresses;
+
+	class_data->size = num_addresses;
+	class_data->m_addresses = arena_alloc(arena,
+			sizeof(midi_address) * num_addresses);
+	class_data->class = class;
+	class_data->sysex_addr_base = header.sysex_addr_base;
+	class_data->next = NULL;
+
+	memcpy(class_data->m_addresses, layout,
+			sizeof(midi_address) * num_addresses);
+
+	values = (const uint32_t *) (data + header.header_size +
+			header.name_size);
+	for (i = 0; i < num_addresses; i++) {
+	    class_data->m_addresses[i].value = swap ?
+		    __builtin_bswap32(values[i]) : values[i];
+	}
+	return 0;
+}
+
+static int write_snapshot(const char *filename, Class_data *class_data) {
+	struct s_snapshot_header header;
+	char name[MAX_CLASS_NAME];
+	const midi_address *layout;
+	uint32_t *values;
+	FILE *fp;
+	char *temp_name;
+	size_t name_length;
+	int i, num_addresses, failed = 0;
+
+	layout = class_layout(class_data->class, class_data->sysex_addr_base,
+			&num_addresses, &header.layout_hash);
+	if (!layout || num_addresses != class_data->size) return -3;
+	for (i = 0; i < num_addresses; i++)
+	    if (class_data->m_addresses[i].sysex_addr != layout[i].sysex_addr)
+		return -3;
+
+	name_length = strlen(class_data->class->name) + 1;
+	if (name_length > MAX_CLASS_NAME) return -3;
+
+	memset(&header.magic, 0, sizeof(header.magic));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	header.byte_order = SNAPSHOT_BYTE_ORDER;
+	header.version = SNAPSHOT_VERSION;
+	header.header_size = sizeof(header);
+	header.name_size = (name_length + 3) & ~3;
+	header.sysex_addr_base = class_data->sysex_addr_base;
+	header.size = num_addresses;
+
+	memset(name, 0, header.name_size);
+	memcpy(name, class_data->class->name, name_length);
+
+	values = allocate(uint32_t, num_addresses);
+	for (i = 0; i < num_addresses; i++)
+	    values[i] = class_data->m_addresses[i].value;
+
+	fp = open_temp_file(filename, &temp_name);
+	if (!fp) {
+	    free(values);
+	    return -2;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+		fwrite(name, header.name_size, 1, fp) != 1 ||
+		fwrite(values, sizeof(uint32_t), num_addresses, fp) !=
+		    num_addresses) failed = 1;
+
+	free(values);
+	return close_temp_file(fp, filename, temp_name, failed);
+}
+
+/* Either format, decided by the magic at the start of the file */
+int read_patch_file(const char *filename, Class_data *class_data,
+		Arena *arena, unsigned int max_addresses) {
+	int fd, retval;
+	struct stat st;
+	uint8_t *data;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) return -1;
+
+	if (fstat(fd, &st) < 0) {
+	    close(fd);
+	    return -1;
+	}
+
+	if (st.st_size == 0) {
+	    close(fd);
+	    return -2;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return -1;
+
+	if (!max_addresses) madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+	if (is_snapshot(data, st.st_size))
+	    retval = parse_snapshot(data, st.st_size, class_data, arena,
+			    max_addresses);
+	else retval = parse_keyfile((const char *) data, st.st_size,
+			class_data, arena, max_addresses);
+
+	munmap(data, st.st_size);
+	return retval;
+}
+
+int write_patch_file(const char *filename, Class_data *class_data,
+		enum patch_format format) {
+	switch (format) {
+	    case PATCH_FORMAT_KEYFILE:
+		return write_keyfile(filename, class_data);
+	    case PATCH_FORMAT_BINARY:
+		return write_snapshot(filename, class_data);
+	}
+	return -1;
+}
+
+/* Class and set name of a saved patch, without going near the copy list.
+ * PATCH_NAME is left empty if the patch isn't a studio or live set.
+ * Only the name addresses are read, the rest of the file is skipped. */
+int patch_file_summary(const char *filename, MidiClass **class,
+		char *patch_name) {
+	int retval;
+	Class_data class_data;
+	Arena arena;
+
+	arena_init(&arena, sizeof(midi_address) * MAX_SET_NAME_SIZE);
+	retval = read_patch_file(filename, &class_data, &arena,
+			MAX_SET_NAME_SIZE);
+	if (!retval) {
+	    *class = class_data.class;
+	    if (class_data_patch_name(&class_data, patch_name) < 0)
+		patch_name[0] = '\0';
+	}
+
+	arena_free(&arena);
+	return retval;
+}
+
+int libgieditor_read_copy_data_from_file(char *filename, int *depth) {
+	int retval;
+	Class_data loaded, *cur_class_data = push_copy_data(depth);
+
+	retval = read_patch_file(filename, &loaded,
+			copy_data_arena(cur_class_data), 0);
+	if (retval) {
+	    remove_copy_data(cur_class_data, depth);
+	    return retval;
+	}
+
+	cur_class_data->m_addresses = loaded.m_addresses;
+	cur_class_data->sysex_addr_base = loaded.sysex_addr_base;
+	cur_class_data->class = loaded.class;
+	cur_class_data->size = loaded.size;
+	return 0;
+}
+
+static int write_copy_data(char *filename, int *depth,
+		enum patch_format format) {
+	int retval;
+	Class_data *cur_class_data = peek_copy_data();
+
+	if (!cur_class_data) return -1;
+
+	retval = write_patch_file(filename, cur_class_data, format);
+	if (retval) return retval;
+
+	pop_copy_data(depth);
+	return 0;
+}
+
+int libgieditor_write_copy_data_to_file(char *filename, int *depth) {
+	return write_copy_data(filename, depth, PATCH_FORMAT_KEYFILE);
+}
+
+int libgieditor_write_copy_data_to_binary_file(char *filename, int *depth) {
+	return write_copy_data(filename, depth, PATCH_FORMAT_BINARY);
+}
+
+int libgieditor_convert_patch_file(char *in_filename, char *out_filename,
+		enum patch_format format) {
+	int retval;
+	Class_data class_data;
+	Arena arena;
+
+	arena_init(&arena, 0);
+	retval = read_patch_file(in_filename, &class_data, &arena, 0);
+	if (!retval)
+	    retval = write_patch_file(out_filename, &class_data, format);
+
+	arena_free(&arena);
+	return retval;
+}
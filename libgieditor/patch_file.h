@@ -0,0 +1,52 @@
+/* Patch file readers and writers
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Needs libgieditor.h (LIBGIEDITOR_PRIVATE) and arena.h */
+
+/* Write to a temporary file next to FILENAME, then rename it into place.
+ * close_temp_file() returns -2 (and removes the temporary file) if FAILED
+ * is set or anything went wrong writing it */
+extern FILE *open_temp_file(const char *filename, char **temp_name);
+extern int close_temp_file(FILE *fp, const char *filename, char *temp_name,
+		int failed);
+
+/* Reads either format into CLASS_DATA, allocating from ARENA. Only the first
+ * MAX_ADDRESSES addresses are read if it's non zero */
+extern int read_patch_file(const char *filename, Class_data *class_data,
+		Arena *arena, unsigned int max_addresses);
+extern int write_patch_file(const char *filename, Class_data *class_data,
+		enum patch_format format);
+
+extern int patch_file_summary(const char *filename, MidiClass **class,
+		char *patch_name);
+
+/* Reads a stored object, for things that need the values themselves */
+extern int store_read_entry(PatchStore *store, const StoreEntry *entry,
+		Class_data *class_data, Arena *arena);
+
+/* Tab separated index files (the manifest and the patch store). Fields have
+ * tabs, newlines and backslashes escaped. split_index_field() unescapes
+ * FIELD in place up to the next tab or end of line and returns the start of
+ * the following field, or NULL if this was the last one */
+extern void write_index_field(FILE *fp, const char *string);
+extern char *split_index_field(char *field);
+/* Splits LINE into its first NUM fields. Returns -1 if it has fewer */
+extern int split_index_line(char *line, char **fields, int num);
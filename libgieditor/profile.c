@@ -0,0 +1,180 @@
+/* Device profiles
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <glib.h>
+
+#include <libgieditor.h>
+#include "profile.h"
+
+/* A GLib keyfile. Keys that are missing are left as they were.
+ *	[Device]
+ *	BlockSize=120		largest DT1/RQ1 data, bytes
+ *	Timeout=250		milliseconds to wait for a reply
+ *	Pacing=3125		bytes per second, 0 for unpaced
+ *	BulkBudget=134		bytes of bulk output ahead of an edit
+ *	[BlockSizes]
+ *	10000000=256		block size for the region at an address, hex */
+#define PROFILE_GROUP		"Device"
+#define BLOCK_SIZE_KEY		"BlockSize"
+#define TIMEOUT_KEY		"Timeout"
+#define PACING_KEY		"Pacing"
+#define BULK_BUDGET_KEY		"BulkBudget"
+#define REGIONS_GROUP		"BlockSizes"
+#define PROFILE_DIR		"gieditor"
+#define PROFILE_FILE		"device.profile"
+
+static void get_key(GKeyFile *key_file, const char *group, const char *key,
+		int *value) {
+	GError *error = NULL;
+	int i = g_key_file_get_integer(key_file, group, key, &error);
+
+	if (error) {
+	    g_error_free(error);
+	    *value = -1;
+	} else *value = i;
+}
+
+static void get_regions(GKeyFile *key_file, DeviceProfile *profile) {
+	RegionBlockSize *region;
+	char **keys;
+	int i;
+
+	profile->num_regions = 0;
+	keys = g_key_file_get_keys(key_file, REGIONS_GROUP, NULL, NULL);
+	if (!keys) return;
+	for (i = 0; keys[i] && profile->num_regions < MAX_PROFILE_REGIONS;
+			i++) {
+	    region = &profile->regions[profile->num_regions];
+	    region->sysex_addr = strtoul(keys[i], NULL, 16);
+	    get_key(key_file, REGIONS_GROUP, keys[i], &region->block_size);
+	    if (region->block_size > 0) profile->num_regions++;
+	}
+	g_strfreev(keys);
+}
+
+int libgieditor_read_profile(const char *filename, DeviceProfile *profile) {
+	GKeyFile *key_file = g_key_file_new();
+
+	if (!g_key_file_load_from_file(key_file, filename, G_KEY_FILE_NONE,
+				NULL)) {
+	    g_key_file_free(key_file);
+	    return -1;
+	}
+	if (!g_key_file_has_group(key_file, PROFILE_GROUP)) {
+	    g_key_file_free(key_file);
+	    return -2;
+	}
+
+	get_key(key_file, PROFILE_GROUP, BLOCK_SIZE_KEY, &profile->block_size);
+	get_key(key_file, PROFILE_GROUP, TIMEOUT_KEY, &profile->timeout_ms);
+	get_key(key_file, PROFILE_GROUP, PACING_KEY, &profile->pacing);
+	get_key(key_file, PROFILE_GROUP, BULK_BUDGET_KEY,
+			&profile->bulk_budget);
+	get_regions(key_file, profile);
+	g_key_file_free(key_file);
+	return 0;
+}
+
+void libgieditor_apply_profile(const DeviceProfile *profile) {
+	int i;
+
+	if (profile->block_size > 0)
+	    libgieditor_set_block_size(profile->block_size);
+	if (profile->timeout_ms > 0)
+	    libgieditor_set_timeout_ms(profile->timeout_ms);
+	if (profile->pacing >= 0) libgieditor_set_pacing(profile->pacing);
+	if (profile->bulk_budget >= 0)
+	    libgieditor_set_bulk_budget(profile->bulk_budget);
+	for (i = 0; i < profile->num_regions; i++)
+	    libgieditor_set_region_block_size(profile->regions[i].sysex_addr,
+			    profile->regions[i].block_size);
+}
+
+int libgieditor_load_profile(const char *filename) {
+	DeviceProfile profile;
+	int retval;
+
+	retval = libgieditor_read_profile(filename, &profile);
+	if (retval < 0) return retval;
+	libgieditor_apply_profile(&profile);
+	return 0;
+}
+
+static void write_key(FILE *fp, const char *key, int value) {
+	if (value >= 0) fprintf(fp, "%s=%d\n", key, value);
+}
+
+/* NOTES go in comments above the group, one line each */
+int libgieditor_save_profile(const char *filename,
+		const DeviceProfile *profile, const char *notes) {
+	const char *line, *end;
+	FILE *fp;
+	int i;
+
+	fp = fopen(filename, "w");
+	if (!fp) return -1;
+
+	for (line = notes; line && *line; line = end ? end + 1 : NULL) {
+	    end = strchr(line, '\n');
+	    fprintf(fp, "# %.*s\n", end ? (int) (end - line) :
+			    (int) strlen(line), line);
+	}
+	fprintf(fp, "[%s]\n", PROFILE_GROUP);
+	write_key(fp, BLOCK_SIZE_KEY, profile->block_size);
+	write_key(fp, TIMEOUT_KEY, profile->timeout_ms);
+	write_key(fp, PACING_KEY, profile->pacing);
+	write_key(fp, BULK_BUDGET_KEY, profile->bulk_budget);
+	if (profile->num_regions) fprintf(fp, "[%s]\n", REGIONS_GROUP);
+	for (i = 0; i < profile->num_regions; i++)
+	    fprintf(fp, "%08X=%d\n", profile->regions[i].sysex_addr,
+			    profile->regions[i].block_size);
+
+	if (fclose(fp)) return -2;
+	return 0;
+}
+
+char *libgieditor_default_profile(void) {
+	char *path, *retval;
+
+	path = g_build_filename(g_get_user_config_dir(), PROFILE_DIR,
+			PROFILE_FILE, NULL);
+	retval = strdup(path);
+	g_free(path);
+	return retval;
+}
+
+/* $GIEDITOR_PROFILE if set, and empty to load nothing. Otherwise the
+ * default, if gi_probe has written one */
+void load_default_profile(void) {
+	char *filename = getenv(PROFILE_ENV);
+
+	if (filename) {
+	    if (*filename) libgieditor_load_profile(filename);
+	    return;
+	}
+	filename = libgieditor_default_profile();
+	libgieditor_load_profile(filename);
+	free(filename);
+}
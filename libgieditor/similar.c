@@ -0,0 +1,351 @@
+/* Patch similarity search
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <float.h>
+
+#define LIBGIEDITOR_PRIVATE
+#include <libgieditor.h>
+#include "arena.h"
+#include "copy_data.h"
+#include "patch_file.h"
+#include "midi_addresses.h"
+#include "log.h"
+
+#define allocate(t, num) __common_allocate(sizeof(t) * num, "libgieditor")
+
+/* Patches are compared as vectors of values scaled to 0..1, one element per
+ * leaf address in class layout order, padded out to a whole number of
+ * vec_t. The distance is the weighted sum of squared differences. */
+typedef float vec_t __attribute__ ((vector_size (16)));
+#define VEC_WIDTH	(sizeof(vec_t) / sizeof(float))
+
+/* Libraries smaller than this are always searched exhaustively */
+#define COARSE_MIN_ENTRIES	1024
+#define KMEANS_ITERATIONS	8
+
+struct s_similarity_index {
+	MidiClass		*class;
+	const midi_address	*layout;
+	int			size;		/* Leaves */
+	int			width;		/* In vec_t */
+	vec_t			*weights;
+	vec_t			*vectors;	/* num_entries * width */
+	const StoreEntry	**entries;
+	int			num_entries;
+	/* Coarse index: entries grouped by nearest centroid */
+	vec_t			*centroids;	/* num_lists * width */
+	int			num_lists;
+	int			*list_start;	/* num_lists + 1 */
+	int			*list_members;
+};
+
+static vec_t *allocate_vectors(int num) {
+	void *vectors;
+
+	if (posix_memalign(&vectors, sizeof(vec_t), sizeof(vec_t) * num)) {
+	    common_log(2, "libgieditor", ": Out of memory");
+	    exit(1);
+	}
+	memset(vectors, 0, sizeof(vec_t) * num);
+	return vectors;
+}
+
+static float max_value(uint32_t sysex_size) {
+	/* One byte holds seven bits, anything bigger is split into nibbles */
+	if (sysex_size <= 1) return 127;
+	return (float) ((1ULL << (4 * sysex_size)) - 1);
+}
+
+static void make_vector(SimilarityIndex *index, Class_data *class_data,
+		vec_t *vector) {
+	float *elements = (float *) vector;
+	int i;
+
+	for (i = 0; i < index->size; i++) {
+	    elements[i] = class_data->m_addresses[i].value /
+		    max_value(index->layout[i].sysex_size);
+	}
+}
+
+static float distance(const vec_t *a, const vec_t *b, const vec_t *weights,
+		int width) {
+	vec_t sum0 = { 0, 0, 0, 0 }, sum1 = { 0, 0, 0, 0 }, d;
+	int i;
+
+	for (i = 0; i + 1 < width; i += 2) {
+	    d = a[i] - b[i];
+	    sum0 += weights[i] * d * d;
+	    d = a[i + 1] - b[i + 1];
+	    sum1 += weights[i + 1] * d * d;
+	}
+	if (i < width) {
+	    d = a[i] - b[i];
+	    sum0 += weights[i] * d * d;
+	}
+
+	sum0 += sum1;
+	return sum0[0] + sum0[1] + sum0[2] + sum0[3];
+}
+
+static int nearest_centroid(SimilarityIndex *index, const vec_t *vector) {
+	int i, best = 0;
+	float d, best_distance = FLT_MAX;
+
+	for (i = 0; i < index->num_lists; i++) {
+	    d = distance(vector, &index->centroids[i * index->width],
+			    index->weights, index->width);
+	    if (d < best_distance) {
+		best_distance = d;
+		best = i;
+	    }
+	}
+	return best;
+}
+
+/* A few rounds of k-means, seeded with evenly spaced entries */
+static void build_coarse(SimilarityIndex *index) {
+	int i, j, list, iteration, width = index->width;
+	int *assignment, *counts;
+	vec_t *centroid;
+
+	index->num_lists = 1;
+	while ((index->num_lists + 1) * (index->num_lists + 1) <=
+			index->num_entries) index->num_lists++;
+	index->centroids = allocate_vectors(index->num_lists * width);
+	assignment = allocate(int, index->num_entries);
+	counts = allocate(int, index->num_lists);
+
+	for (i = 0; i < index->num_lists; i++) {
+	    j = (long) i * index->num_entries / index->num_lists;
+	    memcpy(&index->centroids[i * width], &index->vectors[j * width],
+			    sizeof(vec_t) * width);
+	}
+
+	for (iteration = 0; iteration < KMEANS_ITERATIONS; iteration++) {
+	    for (i = 0; i < index->num_entries; i++)
+		assignment[i] = nearest_centroid(index,
+				&index->vectors[i * width]);
+
+	    memset(counts, 0, sizeof(int) * index->num_lists);
+	    for (i = 0; i < index->num_entries; i++) counts[assignment[i]]++;
+
+	    for (list = 0; list < index->num_lists; list++) {
+		/* An empty list keeps its old centroid */
+		if (!counts[list]) continue;
+		centroid = &index->centroids[list * width];
+		memset(centroid, 0, sizeof(vec_t) * width);
+	    }
+	    for (i = 0; i < index->num_entries; i++) {
+		if (!counts[assignment[i]]) continue;
+		centroid = &index->centroids[assignment[i] * width];
+		for (j = 0; j < width; j++)
+		    centroid[j] += index->vectors[i * width + j];
+	    }
+	    for (list = 0; list < index->num_lists; list++) {
+		if (!counts[list]) continue;
+		centroid = &index->centroids[list * width];
+		for (j = 0; j < width; j++)
+		    centroid[j] /= (float) counts[list];
+	    }
+	}
+
+	/* Final assignment, laid out list by list */
+	index->list_start = allocate(int, index->num_lists + 1);
+	index->list_members = allocate(int, index->num_entries);
+	memset(counts, 0, sizeof(int) * index->num_lists);
+	for (i = 0; i < index->num_entries; i++) {
+	    assignment[i] = nearest_centroid(index, &index->vectors[i * width]);
+	    counts[assignment[i]]++;
+	}
+	index->list_start[0] = 0;
+	for (list = 0; list < index->num_lists; list++)
+	    index->list_start[list + 1] = index->list_start[list] + counts[list];
+	memset(counts, 0, sizeof(int) * index->num_lists);
+	for (i = 0; i < index->num_entries; i++) {
+	    list = assignment[i];
+	    index->list_members[index->list_start[list] + counts[list]++] = i;
+	}
+
+	free(assignment);
+	free(counts);
+}
+
+SimilarityIndex *libgieditor_similar_build(PatchStore *store,
+		MidiClass *class, int coarse) {
+	SimilarityIndex *index;
+	StoreQuery query = { class, NULL, NULL, -1, 0, 0 };
+	const StoreEntry **entries;
+	Class_data class_data;
+	Arena arena;
+	float *weights;
+	int i, num;
+
+	num = libgieditor_store_query(store, &query, &entries);
+	if (!num) {
+	    free(entries);
+	    return NULL;
+	}
+
+	index = allocate(SimilarityIndex, 1);
+	memset(index, 0, sizeof(SimilarityIndex));
+	index->class = class;
+	index->layout = class_layout(class, entries[0]->sysex_addr_base,
+			&index->size, NULL);
+	if (!index->layout) {
+	    free(entries);
+	    free(index);
+	    return NULL;
+	}
+	index->width = (index->size + VEC_WIDTH - 1) / VEC_WIDTH;
+
+	/* Set names don't make a sound, leave them out */
+	index->weights = allocate_vectors(index->width);
+	weights = (float *) index->weights;
+	for (i = 0; i < index->size; i++) weights[i] = 1;
+	if ((class == &libgieditor_studio_class ||
+		    class == &libgieditor_liveset_class) &&
+		    index->size >= MAX_SET_NAME_SIZE) {
+	    for (i = 0; i < MAX_SET_NAME_SIZE; i++) weights[i] = 0;
+	}
+
+	index->vectors = allocate_vectors(num * index->width);
+	index->entries = allocate(const StoreEntry *, num);
+
+	arena_init(&arena, 0);
+	for (i = 0; i < num; i++) {
+	    arena_reset(&arena);
+	    if (store_read_entry(store, entries[i], &class_data, &arena) ||
+			    class_data.size != index->size) continue;
+	    make_vector(index, &class_data,
+			    &index->vectors[index->num_entries * index->width]);
+	    index->entries[index->num_entries++] = entries[i];
+	}
+	arena_free(&arena);
+	free(entries);
+
+	if (coarse && index->num_entries >= COARSE_MIN_ENTRIES)
+	    build_coarse(index);
+	return index;
+}
+
+/* SYSEX_ADDR is relative to the class */
+int libgieditor_similar_set_weight(SimilarityIndex *index,
+		uint32_t sysex_addr, float weight) {
+	int i;
+
+	for (i = 0; i < index->size; i++) {
+	    if (index->layout[i].sysex_addr == sysex_addr) {
+		((float *) index->weights)[i] = weight;
+		return 0;
+	    }
+	}
+	return -1;
+}
+
+/* MATCHES is kept sorted, nearest first */
+static void consider(SimilarityIndex *index, int entry, float d,
+		SimilarMatch *matches, int k, int *found) {
+	int i;
+
+	if (*found == k && d >= matches[k - 1].distance) return;
+
+	i = *found < k ? (*found)++ : k - 1;
+	for (; i > 0 && matches[i - 1].distance > d; i--)
+	    matches[i] = matches[i - 1];
+	matches[i].entry = index->entries[entry];
+	matches[i].distance = d;
+}
+
+int libgieditor_similar_query(SimilarityIndex *index, int k,
+		SimilarMatch *matches) {
+	Class_data *query_data = peek_copy_data();
+	vec_t *query;
+	float *list_distance;
+	int *lists;
+	int i, j, list, probes, found = 0, width = index->width;
+
+	if (!query_data) return -1;
+	if (query_data->class != index->class ||
+		    query_data->size != index->size) return -2;
+	if (k <= 0) return 0;
+
+	query = allocate_vectors(width);
+	make_vector(index, query_data, query);
+
+	if (!index->num_lists) {
+	    for (i = 0; i < index->num_entries; i++)
+		consider(index, i, distance(query, &index->vectors[i * width],
+				    index->weights, width),
+			    matches, k, &found);
+	    free(query);
+	    return found;
+	}
+
+	/* Probe the nearest eighth of the lists */
+	probes = index->num_lists / 8 + 1;
+	list_distance = allocate(float, index->num_lists);
+	lists = allocate(int, index->num_lists);
+	for (i = 0; i < index->num_lists; i++) {
+	    list_distance[i] = distance(query, &index->centroids[i * width],
+			    index->weights, width);
+	    lists[i] = i;
+	}
+	for (i = 0; i < probes; i++) {
+	    for (j = i + 1; j < index->num_lists; j++) {
+		if (list_distance[lists[j]] < list_distance[lists[i]]) {
+		    list = lists[i];
+		    lists[i] = lists[j];
+		    lists[j] = list;
+		}
+	    }
+	}
+
+	for (i = 0; i < probes; i++) {
+	    list = lists[i];
+	    for (j = index->list_start[list];
+			    j < index->list_start[list + 1]; j++) {
+		consider(index, index->list_members[j],
+			    distance(query,
+				&index->vectors[index->list_members[j] * width],
+				index->weights, width),
+			    matches, k, &found);
+	    }
+	}
+
+	free(lists);
+	free(list_distance);
+	free(query);
+	return found;
+}
+
+void libgieditor_similar_free(SimilarityIndex *index) {
+	free(index->weights);
+	free(index->vectors);
+	free(index->entries);
+	free(index->centroids);
+	free(index->list_start);
+	free(index->list_members);
+	free(index);
+}
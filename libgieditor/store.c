@@ -0,0 +1,540 @@
+/* Content addressed patch store
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#define LIBGIEDITOR_PRIVATE
+#include <libgieditor.h>
+#include "arena.h"
+#include "copy_data.h"
+#include "patch_file.h"
+
+#define allocate(t, num) __common_allocate(sizeof(t) * num, "libgieditor")
+
+/* DIR/objects/xx/<hash> are binary snapshots, xx being the first two
+ * characters of the hash. DIR/index has a line listing the indexed
+ * parameter addresses, then one line per object:
+ *	hash <tab> class <tab> base address <tab> name <tab> tags <tab> params
+ * Tags are comma separated, as are the parameter values ("-" where the
+ * class has no such parameter). */
+#define STORE_OBJECTS		"objects"
+#define STORE_INDEX		"index"
+#define STORE_HEADER		"# libgieditor store 1\n"
+#define STORE_PARAMS		"params"
+
+struct s_patch_store {
+	char		*dir;
+	uint32_t	*params;	/* Relative addresses */
+	int		num_params;
+	GHashTable	*entries;	/* hash -> StoreEntry */
+	GHashTable	*by_class;	/* MidiClass -> GPtrArray of entries */
+	GHashTable	*by_tag;	/* tag -> GPtrArray of entries */
+	GPtrArray	*all;
+	int		dirty;
+};
+
+static char *store_path(PatchStore *store, const char *hash) {
+	char *file_path = allocate(char, strlen(store->dir) +
+			strlen(STORE_OBJECTS) + STORE_HASH_SIZE + 8);
+
+	if (hash) sprintf(file_path, "%s/%s/%.2s/%s", store->dir,
+			STORE_OBJECTS, hash, hash);
+	else sprintf(file_path, "%s/%s", store->dir, STORE_INDEX);
+	return file_path;
+}
+
+/* FNV-1a over the class name and the values. The base address doesn't
+ * count, the same set copied from two slots is the same set. */
+static void content_hash(Class_data *class_data, char *hash) {
+	uint64_t h = 14695981039346656037ULL;
+	const char *p = class_data->class->name;
+	uint32_t value;
+	int i, j;
+
+	do {
+	    h ^= (uint8_t) *p;
+	    h *= 1099511628211ULL;
+	} while (*p++);
+
+	for (i = 0; i < class_data->size; i++) {
+	    value = class_data->m_addresses[i].value;
+	    for (j = 0; j < 4; j++) {
+		h ^= (value >> (j * 8)) & 0xff;
+		h *= 1099511628211ULL;
+	    }
+	}
+	sprintf(hash, "%016llx", (unsigned long long) h);
+}
+
+static void free_ptr_array(gpointer data) {
+	g_ptr_array_free(data, TRUE);
+}
+
+static void free_entry(gpointer data) {
+	StoreEntry *entry = data;
+	free(entry->tags);
+	free(entry->params);
+	free(entry);
+}
+
+static void index_add(GHashTable *table, gpointer key, gpointer key_copy,
+		StoreEntry *entry) {
+	GPtrArray *array = g_hash_table_lookup(table, key);
+
+	if (!array) {
+	    array = g_ptr_array_new();
+	    g_hash_table_insert(table, key_copy, array);
+	} else if (key_copy != key) free(key_copy);
+
+	g_ptr_array_add(array, entry);
+}
+
+static int has_tag(const char *tags, const char *tag) {
+	size_t length = strlen(tag);
+	const char *p = tags;
+
+	while (p && *p) {
+	    if (!strncmp(p, tag, length) && (p[length] == ',' || !p[length]))
+		return 1;
+	    p = strchr(p, ',');
+	    if (p) p++;
+	}
+	return 0;
+}
+
+static void add_tag(PatchStore *store, StoreEntry *entry, const char *tag) {
+	size_t old_length = entry->tags ? strlen(entry->tags) : 0;
+	char *tags;
+
+	if (!*tag || (entry->tags && has_tag(entry->tags, tag))) return;
+
+	tags = allocate(char, old_length + strlen(tag) + 2);
+	if (old_length) sprintf(tags, "%s,%s", entry->tags, tag);
+	else strcpy(tags, tag);
+	free(entry->tags);
+	entry->tags = tags;
+
+	index_add(store->by_tag, (gpointer) tag, strdup(tag), entry);
+	store->dirty = 1;
+}
+
+/* TAGS is comma separated */
+static void add_tags(PatchStore *store, StoreEntry *entry, const char *tags) {
+	char *copy, *tag, *save;
+
+	if (!tags) return;
+
+	copy = strdup(tags);
+	for (tag = strtok_r(copy, ",", &save); tag;
+			tag = strtok_r(NULL, ",", &save))
+	    add_tag(store, entry, tag);
+	free(copy);
+}
+
+static void extract_params(PatchStore *store, StoreEntry *entry,
+		Class_data *class_data) {
+	int i, j;
+
+	for (i = 0; i < store->num_params; i++) {
+	    entry->params[i] = STORE_NO_PARAM;
+	    for (j = 0; j < class_data->size; j++) {
+		if (class_data->m_addresses[j].sysex_addr == store->params[i]) {
+		    entry->params[i] = class_data->m_addresses[j].value;
+		    break;
+		}
+	    }
+	}
+}
+
+static StoreEntry *new_entry(PatchStore *store, const char *hash,
+		MidiClass *class, uint32_t sysex_addr_base, const char *name) {
+	StoreEntry *entry = allocate(StoreEntry, 1);
+	int i;
+
+	strcpy(entry->hash, hash);
+	entry->class = class;
+	entry->sysex_addr_base = sysex_addr_base;
+	strncpy(entry->name, name, MAX_SET_NAME_SIZE);
+	entry->name[MAX_SET_NAME_SIZE] = '\0';
+	entry->tags = NULL;
+	entry->params = allocate(uint32_t, store->num_params);
+	for (i = 0; i < store->num_params; i++)
+	    entry->params[i] = STORE_NO_PARAM;
+
+	g_hash_table_insert(store->entries, entry->hash, entry);
+	index_add(store->by_class, (gpointer) class, (gpointer) class, entry);
+	g_ptr_array_add(store->all, entry);
+	return entry;
+}
+
+static void parse_params(PatchStore *store, StoreEntry *entry, char *field) {
+	char *value, *save;
+	int i = 0;
+
+	for (value = strtok_r(field, ",", &save); value && i < store->num_params;
+			value = strtok_r(NULL, ",", &save), i++) {
+	    if (*value != '-') entry->params[i] = strtoul(value, NULL, 10);
+	}
+}
+
+static int params_changed(PatchStore *store, char *line) {
+	char *field;
+	int i = 0;
+
+	field = split_index_field(line);
+	while (field) {
+	    if (i == store->num_params ||
+			    strtoul(field, NULL, 16) != store->params[i])
+		return 1;
+	    field = split_index_field(field);
+	    i++;
+	}
+	return i != store->num_params;
+}
+
+static void read_params(PatchStore *store, char *line) {
+	char *field;
+
+	field = split_index_field(line);
+	while (field) {
+	    store->params = realloc(store->params,
+			    sizeof(uint32_t) * (store->num_params + 1));
+	    store->params[store->num_params++] = strtoul(field, NULL, 16);
+	    field = split_index_field(field);
+	}
+}
+
+/* Returns 1 if the parameter columns need to be rebuilt */
+static int load_index(PatchStore *store) {
+	FILE *fp;
+	char *file_path, *line = NULL;
+	char *fields[6];
+	size_t line_size = 0;
+	int rebuild = 0;
+	MidiClass *class;
+	StoreEntry *entry;
+
+	file_path = store_path(store, NULL);
+	fp = fopen(file_path, "r");
+	free(file_path);
+	if (!fp) return 0;
+
+	if (getline(&line, &line_size, fp) < 0 ||
+			strcmp(line, STORE_HEADER)) goto out;
+
+	if (getline(&line, &line_size, fp) < 0 ||
+			strncmp(line, STORE_PARAMS, strlen(STORE_PARAMS)))
+	    goto out;
+
+	if (!store->num_params) read_params(store, line);
+	else rebuild = params_changed(store, line);
+
+	while (getline(&line, &line_size, fp) >= 0) {
+	    if (split_index_line(line, fields, 6) < 0) continue;
+
+	    if (strlen(fields[0]) != STORE_HASH_SIZE) continue;
+	    if (g_hash_table_lookup(store->entries, fields[0])) continue;
+	    class = libgieditor_match_class_name(fields[1]);
+	    if (!class) continue;
+
+	    entry = new_entry(store, fields[0], class,
+			    strtoul(fields[2], NULL, 10), fields[3]);
+	    add_tags(store, entry, fields[4]);
+	    if (!rebuild) parse_params(store, entry, fields[5]);
+	}
+	store->dirty = rebuild;
+
+out:
+	free(line);
+	fclose(fp);
+	return rebuild;
+}
+
+/* The only time the objects themselves get read back in bulk */
+static void rebuild_params(PatchStore *store) {
+	int i;
+	char *file_path;
+	StoreEntry *entry;
+	Class_data class_data;
+	Arena arena;
+
+	arena_init(&arena, 0);
+	for (i = 0; i < store->all->len; i++) {
+	    entry = g_ptr_array_index(store->all, i);
+	    file_path = store_path(store, entry->hash);
+	    if (!read_patch_file(file_path, &class_data, &arena, 0))
+		extract_params(store, entry, &class_data);
+	    free(file_path);
+	    arena_reset(&arena);
+	}
+	arena_free(&arena);
+}
+
+PatchStore *libgieditor_store_open(const char *dir,
+		const uint32_t *params, int num_params) {
+	PatchStore *store;
+	char *objects_dir;
+
+	if (mkdir(dir, 0777) < 0 && errno != EEXIST) return NULL;
+
+	objects_dir = allocate(char, strlen(dir) + strlen(STORE_OBJECTS) + 2);
+	sprintf(objects_dir, "%s/%s", dir, STORE_OBJECTS);
+	if (mkdir(objects_dir, 0777) < 0 && errno != EEXIST) {
+	    free(objects_dir);
+	    return NULL;
+	}
+	free(objects_dir);
+
+	store = allocate(PatchStore, 1);
+	store->dir = strdup(dir);
+	store->num_params = num_params;
+	store->params = NULL;
+	if (num_params) {
+	    store->params = allocate(uint32_t, num_params);
+	    memcpy(store->params, params, sizeof(uint32_t) * num_params);
+	}
+	store->entries = g_hash_table_new_full(g_str_hash, g_str_equal,
+			NULL, free_entry);
+	store->by_class = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+			NULL, free_ptr_array);
+	store->by_tag = g_hash_table_new_full(g_str_hash, g_str_equal,
+			free, free_ptr_array);
+	store->all = g_ptr_array_new();
+	store->dirty = 0;
+
+	if (load_index(store)) rebuild_params(store);
+	return store;
+}
+
+static void write_entry(FILE *fp, PatchStore *store, StoreEntry *entry) {
+	int i;
+
+	fprintf(fp, "%s\t", entry->hash);
+	write_index_field(fp, entry->class->name);
+	fprintf(fp, "\t%u\t", entry->sysex_addr_base);
+	write_index_field(fp, entry->name);
+	fputc('\t', fp);
+	if (entry->tags) write_index_field(fp, entry->tags);
+	fputc('\t', fp);
+	for (i = 0; i < store->num_params; i++) {
+	    if (i) fputc(',', fp);
+	    if (entry->params[i] == STORE_NO_PARAM) fputc('-', fp);
+	    else fprintf(fp, "%u", entry->params[i]);
+	}
+	fputc('\n', fp);
+}
+
+int libgieditor_store_save(PatchStore *store) {
+	FILE *fp;
+	char *file_path, *temp_name;
+	int i, retval;
+
+	if (!store->dirty) return 0;
+
+	file_path = store_path(store, NULL);
+	fp = open_temp_file(file_path, &temp_name);
+	if (!fp) {
+	    free(file_path);
+	    return -2;
+	}
+
+	fputs(STORE_HEADER, fp);
+	fputs(STORE_PARAMS, fp);
+	for (i = 0; i < store->num_params; i++)
+	    fprintf(fp, "\t0x%08X", store->params[i]);
+	fputc('\n', fp);
+
+	for (i = 0; i < store->all->len; i++)
+	    write_entry(fp, store, g_ptr_array_index(store->all, i));
+
+	retval = close_temp_file(fp, file_path, temp_name, 0);
+	free(file_path);
+	if (!retval) store->dirty = 0;
+	return retval;
+}
+
+void libgieditor_store_close(PatchStore *store) {
+	g_hash_table_destroy(store->by_class);
+	g_hash_table_destroy(store->by_tag);
+	g_ptr_array_free(store->all, TRUE);
+	g_hash_table_destroy(store->entries);
+	free(store->params);
+	free(store->dir);
+	free(store);
+}
+
+static StoreEntry *store_class_data(PatchStore *store,
+		Class_data *class_data, const char *tags) {
+	char hash[STORE_HASH_SIZE + 1];
+	char name[MAX_SET_NAME_SIZE + 1];
+	char *file_path, *slash;
+	StoreEntry *entry;
+
+	content_hash(class_data, hash);
+	entry = g_hash_table_lookup(store->entries, hash);
+	if (entry) {
+	    add_tags(store, entry, tags);
+	    return entry;
+	}
+
+	file_path = store_path(store, hash);
+	slash = strrchr(file_path, '/');
+	*slash = '\0';
+	if (mkdir(file_path, 0777) < 0 && errno != EEXIST) {
+	    free(file_path);
+	    return NULL;
+	}
+	*slash = '/';
+
+	if (write_patch_file(file_path, class_data, PATCH_FORMAT_BINARY)) {
+	    free(file_path);
+	    return NULL;
+	}
+	free(file_path);
+
+	if (class_data_patch_name(class_data, name) < 0) name[0] = '\0';
+	entry = new_entry(store, hash, class_data->class,
+			class_data->sysex_addr_base, name);
+	extract_params(store, entry, class_data);
+	add_tags(store, entry, tags);
+	store->dirty = 1;
+	return entry;
+}
+
+const StoreEntry *libgieditor_store_add_copy_data(PatchStore *store,
+		int *depth, const char *tags) {
+	StoreEntry *entry;
+	Class_data *cur_class_data = peek_copy_data();
+
+	if (!cur_class_data) return NULL;
+
+	entry = store_class_data(store, cur_class_data, tags);
+	if (entry) pop_copy_data(depth);
+	return entry;
+}
+
+const StoreEntry *libgieditor_store_import_file(PatchStore *store,
+		const char *filename, const char *tags) {
+	StoreEntry *entry = NULL;
+	Class_data class_data;
+	Arena arena;
+
+	arena_init(&arena, 0);
+	if (!read_patch_file(filename, &class_data, &arena, 0))
+	    entry = store_class_data(store, &class_data, tags);
+	arena_free(&arena);
+	return entry;
+}
+
+int libgieditor_store_add_tag(PatchStore *store, const char *hash,
+		const char *tag) {
+	StoreEntry *entry = g_hash_table_lookup(store->entries, hash);
+
+	if (!entry) return -1;
+	add_tag(store, entry, tag);
+	return 0;
+}
+
+int store_read_entry(PatchStore *store, const StoreEntry *entry,
+		Class_data *class_data, Arena *arena) {
+	char *file_path;
+	int retval;
+
+	file_path = store_path(store, entry->hash);
+	retval = read_patch_file(file_path, class_data, arena, 0);
+	free(file_path);
+	return retval;
+}
+
+int libgieditor_store_load(PatchStore *store, const char *hash, int *depth) {
+	char *file_path;
+	int retval;
+
+	if (!g_hash_table_lookup(store->entries, hash)) return -1;
+
+	file_path = store_path(store, hash);
+	retval = libgieditor_read_copy_data_from_file(file_path, depth);
+	free(file_path);
+	return retval;
+}
+
+static int name_matches(const char *name, const char *pattern) {
+	size_t i, length = strlen(pattern);
+
+	for (; *name; name++) {
+	    for (i = 0; i < length && name[i] &&
+		    tolower(name[i]) == tolower(pattern[i]); i++);
+	    if (i == length) return 1;
+	}
+	return !length;
+}
+
+static int entry_matches(PatchStore *store, StoreEntry *entry,
+		const StoreQuery *query) {
+	uint32_t value;
+
+	if (query->class && entry->class != query->class) return 0;
+	if (query->tag && (!entry->tags || !has_tag(entry->tags, query->tag)))
+	    return 0;
+	if (query->name && !name_matches(entry->name, query->name)) return 0;
+	if (query->param >= 0) {
+	    if (query->param >= store->num_params) return 0;
+	    value = entry->params[query->param];
+	    if (value == STORE_NO_PARAM || value < query->param_min ||
+			    value > query->param_max) return 0;
+	}
+	return 1;
+}
+
+/* Starts from the smallest of the class and tag lists, then filters */
+int libgieditor_store_query(PatchStore *store, const StoreQuery *query,
+		const StoreEntry ***results) {
+	GPtrArray *candidates = store->all, *tagged;
+	StoreEntry *entry;
+	int i, num = 0;
+
+	*results = NULL;
+
+	if (query->class) {
+	    candidates = g_hash_table_lookup(store->by_class, query->class);
+	    if (!candidates) return 0;
+	}
+	if (query->tag) {
+	    tagged = g_hash_table_lookup(store->by_tag, query->tag);
+	    if (!tagged) return 0;
+	    if (tagged->len < candidates->len) candidates = tagged;
+	}
+	if (!candidates->len) return 0;
+
+	*results = allocate(const StoreEntry *, candidates->len);
+	for (i = 0; i < candidates->len; i++) {
+	    entry = g_ptr_array_index(candidates, i);
+	    if (entry_matches(store, entry, query)) (*results)[num++] = entry;
+	}
+	return num;
+}
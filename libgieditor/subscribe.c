@@ -0,0 +1,198 @@
+/* Subscriptions
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Subscriptions are kept as ranges of linear addresses, sorted by where
+ * they start. The array doubles as a balanced tree: the middle entry of
+ * any span is the root of that span, and max_end holds the furthest any
+ * range under it reaches. A DT1 then finds the ranges it overlaps in
+ * O(log n + k) however many there are, and the tree is rebuilt, O(n), when
+ * one is added or removed, which is rare by comparison. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define LIBGIEDITOR_PRIVATE
+#include <libgieditor.h>
+#include "subscribe.h"
+
+typedef struct s_subscription {
+	uint32_t	from;
+	uint32_t	to;
+	ParamCallback	callback;
+	void		*arg;
+	int		id;
+} Subscription;
+
+static Subscription *subs;
+static uint32_t *max_end;
+static int num_subs, max_subs, next_id = 1;
+static pthread_mutex_t subscribe_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int subscription_sort(const void *va, const void *vb) {
+	const Subscription *a = va, *b = vb;
+
+	if (a->from != b->from) return a->from > b->from ? 1 : -1;
+	return a->id > b->id ? 1 : -1;
+}
+
+static uint32_t build_tree(int lo, int hi) {
+	uint32_t end, left_end, right_end;
+	int mid;
+
+	if (lo >= hi) return 0;
+	mid = (lo + hi) / 2;
+	end = subs[mid].to;
+	left_end = build_tree(lo, mid);
+	right_end = build_tree(mid + 1, hi);
+	if (left_end > end) end = left_end;
+	if (right_end > end) end = right_end;
+	max_end[mid] = end;
+	return end;
+}
+
+/* Called with subscribe_lock held */
+static void rebuild(void) {
+	qsort(subs, num_subs, sizeof(Subscription), subscription_sort);
+	build_tree(0, num_subs);
+}
+
+/* Adds each subscription in LO to HI overlapping FROM to TO to FOUND */
+static void find_overlaps(int lo, int hi, uint32_t from, uint32_t to,
+		Subscription *found, int *num_found) {
+	int mid;
+
+	if (lo >= hi) return;
+	mid = (lo + hi) / 2;
+	if (max_end[mid] <= from) return;
+	find_overlaps(lo, mid, from, to, found, num_found);
+	if (subs[mid].from >= to) return;
+	if (subs[mid].to > from) found[(*num_found)++] = subs[mid];
+	find_overlaps(mid + 1, hi, from, to, found, num_found);
+}
+
+static int add_subscription(uint32_t from, uint32_t to,
+		ParamCallback callback, void *arg) {
+	Subscription *new_subs;
+	uint32_t *new_max_end;
+	int id;
+
+	if (!callback || to <= from) return -1;
+
+	pthread_mutex_lock(&subscribe_lock);
+	if (num_subs == max_subs) {
+	    max_subs = max_subs ? max_subs * 2 : 16;
+	    new_subs = realloc(subs, max_subs * sizeof(Subscription));
+	    new_max_end = realloc(max_end, max_subs * sizeof(uint32_t));
+	    if (new_subs) subs = new_subs;
+	    if (new_max_end) max_end = new_max_end;
+	    if (!new_subs || !new_max_end) {
+		max_subs = num_subs;
+		pthread_mutex_unlock(&subscribe_lock);
+		return -1;
+	    }
+	}
+	id = next_id++;
+	subs[num_subs].from = from;
+	subs[num_subs].to = to;
+	subs[num_subs].callback = callback;
+	subs[num_subs].arg = arg;
+	subs[num_subs++].id = id;
+	rebuild();
+	pthread_mutex_unlock(&subscribe_lock);
+	return id;
+}
+
+int libgieditor_subscribe(uint32_t sysex_addr, uint32_t sysex_size,
+		ParamCallback callback, void *arg) {
+	uint32_t from = libgieditor_linear_addr(sysex_addr);
+
+	return add_subscription(from, from + sysex_size, callback, arg);
+}
+
+int libgieditor_subscribe_class(MidiClass *class, uint32_t sysex_addr,
+		ParamCallback callback, void *arg) {
+	uint32_t first, end;
+
+	if (libgieditor_class_range(class, sysex_addr, &first, &end) < 0)
+	    return -1;
+	return add_subscription(libgieditor_linear_addr(first),
+			libgieditor_linear_addr(end), callback, arg);
+}
+
+void libgieditor_unsubscribe(int id) {
+	int i;
+
+	pthread_mutex_lock(&subscribe_lock);
+	for (i = 0; i < num_subs; i++) {
+	    if (subs[i].id != id) continue;
+	    memmove(&subs[i], &subs[i + 1],
+			    (num_subs - i - 1) * sizeof(Subscription));
+	    num_subs--;
+	    rebuild();
+	    break;
+	}
+	pthread_mutex_unlock(&subscribe_lock);
+}
+
+/* The subscriptions over the whole DT1 are picked out under the lock, then
+ * called without it, so a callback can subscribe or unsubscribe */
+void subscribe_dispatch(uint32_t sysex_addr, const uint8_t *data,
+		uint32_t sysex_size) {
+	midi_address *m_addresses = libgieditor_address_table(), *m_address;
+	Subscription *found = NULL;
+	uint32_t from = libgieditor_linear_addr(sysex_addr), offset, old_value;
+	int i, id, first, end, old_known, num_found = 0;
+
+	if (libgieditor_param_span(sysex_addr, sysex_size, &first, &end) <= 0)
+	    return;
+
+	pthread_mutex_lock(&subscribe_lock);
+	if (num_subs && max_end[num_subs / 2] > from) {
+	    found = malloc(num_subs * sizeof(Subscription));
+	    if (found) find_overlaps(0, num_subs, from, from + sysex_size,
+			    found, &num_found);
+	}
+	pthread_mutex_unlock(&subscribe_lock);
+
+	for (id = first; id < end; id++) {
+	    m_address = &m_addresses[id];
+	    offset = libgieditor_linear_addr(m_address->sysex_addr) - from;
+	    if (offset + m_address->sysex_size > sysex_size) break;
+
+	    old_value = m_address->value;
+	    old_known = m_address->flags & M_ADDRESS_FETCHED ? 1 : 0;
+	    m_address->value = libgieditor_get_sysex_value((uint8_t *)
+			    data + offset, m_address->sysex_size);
+	    m_address->flags |= M_ADDRESS_FETCHED;
+
+	    if (old_known && old_value == m_address->value) continue;
+	    for (i = 0; i < num_found; i++) {
+		if (found[i].from >= from + offset + m_address->sysex_size ||
+				found[i].to <= from + offset) continue;
+		found[i].callback(m_address, old_value, old_known,
+				found[i].arg);
+	    }
+	}
+	free(found);
+}
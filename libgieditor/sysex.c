@@ -24,19 +24,16 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
-
-#include <jack/jack.h>
-#include <jack/midiport.h>
+#include <stdlib.h>
 
 #include "libgieditor.h"
-#include "midi_jack.h"
+#include "midi_transport.h"
+#include "sysex.h"
 
 #define allocate(t, num) __common_allocate(sizeof(t) * num, "libgieditor")
 
 #define MIDI_CMD_COMMON_SYSEX	    0xf0
 #define MIDI_CMD_COMMON_SYSEX_END   0xf7
-#define MIDI_CMD_RQ1		    0x11
-#define MIDI_CMD_DT1		    0x12
 #define MIDI_ROLAND_ID		    0x41
 #define MAX_SYSEX_SIZE		    512
 #define SYSEX_DATA_OFFSET	    11
@@ -44,24 +41,137 @@
 #define SYSEX_ADDRESS_OFFSET	    7
 #define SYSEX_NOT_DATA_BYTES	    13
 
+static const Midi_transport *transport = &midi_jack_transport;
+
+/* While set, this thread's messages go on the bulk lane */
+static __thread int bulk_depth;
+/* The last ticket this thread was given on each queue, 0 for none */
+static __thread uint32_t last_sent[SYSEX_QUEUES];
+/* The device this thread talks to */
+static __thread int cur_device;
+
+/* Each device's links, as the transport numbers them */
+static struct {
+	int	first;
+	int	num;
+} device_links[MAX_SYSEX_DEVICES] = { { 0, 1 } };
+
+/* LINK counts from the current device's first */
+static uint32_t send_event(uint32_t size, uint8_t *buf, uint64_t time,
+		int link) {
+	enum sysex_lane lane = bulk_depth ?
+		SYSEX_LANE_BULK : SYSEX_LANE_REALTIME;
+	uint32_t ticket = transport->send_event(size, buf, time, lane,
+			device_links[cur_device].first + link);
+
+	return last_sent[ticket_queue(ticket)] = ticket;
+}
+
+int sysex_set_transport(const char *spec) {
+	const Midi_transport *found = midi_transport_find(spec);
+
+	if (!found) return -1;
+	transport = found;
+	return 0;
+}
+
 int sysex_init(const char *client_name, int timeout_time,
                 enum init_flags flags) {
-	return jack_sysex_init(client_name, timeout_time, flags);
+	return transport->init(client_name, timeout_time, flags);
 }
 
 int sysex_close(void) {
-	return jack_sysex_close();
+	return transport->close();
 }
 
 void sysex_set_timeout(int timeout_time) {
-	jack_sysex_set_timeout(timeout_time);
+	transport->set_timeout(timeout_time);
+}
+
+void sysex_set_timeout_ms(int ms) {
+	transport->set_timeout(ms < 0 ? ms : transport->ms_to_timeout(ms));
+}
+
+void sysex_set_pacing(int bytes_per_second) {
+	if (transport->set_pacing) transport->set_pacing(bytes_per_second);
+}
+
+/* Call before init */
+int sysex_set_links(int num) {
+	if (!transport->set_links) return num == 1 ? 0 : -1;
+	if (transport->set_links(num) < 0) return -1;
+	device_links[0].num = num;
+	return 0;
+}
+
+/* LINK counts from the current device's first */
+void sysex_set_link_pacing(int link, int bytes_per_second) {
+	if (transport->set_link_pacing)
+	    transport->set_link_pacing(device_links[cur_device].first + link,
+			    bytes_per_second);
+	else if (link == 0) sysex_set_pacing(bytes_per_second);
+}
+
+int sysex_add_device(const char *name) {
+	int device, link;
+
+	if (!transport->add_device) return -1;
+	device = transport->add_device(name, &link);
+	if (device < 0) return -1;
+	device_links[device].first = link;
+	device_links[device].num = 1;
+	return device;
+}
+
+void sysex_remove_device(int device) {
+	if (device > 0 && transport->remove_device)
+	    transport->remove_device(device);
+}
+
+void sysex_use_device(int device) {
+	cur_device = device;
+}
+
+void sysex_set_bulk_budget(int bytes) {
+	transport->set_bulk_budget(bytes);
+}
+
+void sysex_begin_bulk(void) {
+	bulk_depth++;
+}
+
+void sysex_end_bulk(void) {
+	bulk_depth--;
+}
+
+void sysex_set_max_size(int max_size) {
+	transport->set_max_size(max_size);
+}
+
+unsigned int sysex_dropped(void) {
+	return transport->dropped();
+}
+
+uint64_t sysex_get_time(void) {
+	return transport->get_time();
 }
 
 void sysex_wait_write(void) {
-	jack_sysex_wait_write();
+	transport->wait_write();
+}
+
+void sysex_wait_ticket(uint32_t ticket) {
+	if (ticket) transport->wait_ticket(ticket);
+}
+
+void sysex_wait_sent(void) {
+	int queue;
+
+	for (queue = 0; queue < SYSEX_QUEUES; queue++)
+	    sysex_wait_ticket(last_sent[queue]);
 }
 
-static int checksum(int len, uint8_t *data) {
+int libgieditor_checksum(int len, const uint8_t *data) {
 	int i, sum;
 	
 	for (sum = i = 0; i < len; i++) {
@@ -72,26 +182,35 @@ static int checksum(int len, uint8_t *data) {
 	return 0x80 - sum;
 }
 
-int sysex_listen_event(uint8_t *command_id, 
+static int parse_event(uint8_t *priv_data, int data_bytes,
+		uint8_t *command_id, uint32_t *sysex_addr, int *sum) {
+	*command_id = priv_data[SYSEX_COMMAND_OFFSET];
+	*sysex_addr = priv_data[SYSEX_ADDRESS_OFFSET]	<< 24 |
+		    priv_data[SYSEX_ADDRESS_OFFSET+1]	<< 16 |
+		    priv_data[SYSEX_ADDRESS_OFFSET+2]	<< 8 |
+		    priv_data[SYSEX_ADDRESS_OFFSET+3];
+	data_bytes = data_bytes - SYSEX_NOT_DATA_BYTES;
+	
+	*sum = libgieditor_checksum(data_bytes + 5,
+			priv_data + SYSEX_ADDRESS_OFFSET);
+
+	return data_bytes;
+}
+
+int sysex_listen_event_time(uint8_t *command_id, 
 		                uint32_t *sysex_addr, uint8_t **data,
-				int *sum) {
+				int *sum, uint64_t *time) {
 	int data_bytes;
 	uint8_t *priv_data;
 
 	*data = NULL;
 
-	data_bytes = jack_sysex_listen_event(&priv_data);
+	data_bytes = transport->listen_event(cur_device, &priv_data, time);
 
 	if (data_bytes < 0) return -1;
 
-	*command_id = priv_data[SYSEX_COMMAND_OFFSET];
-	*sysex_addr = priv_data[SYSEX_ADDRESS_OFFSET]	<< 24 |
-		    priv_data[SYSEX_ADDRESS_OFFSET+1]	<< 16 |
-		    priv_data[SYSEX_ADDRESS_OFFSET+2]	<< 8 |
-		    priv_data[SYSEX_ADDRESS_OFFSET+3];
-	data_bytes = data_bytes - SYSEX_NOT_DATA_BYTES;
-	
-	*sum = checksum(data_bytes + 5, priv_data + SYSEX_ADDRESS_OFFSET);
+	data_bytes = parse_event(priv_data, data_bytes,
+			command_id, sysex_addr, sum);
 
 	if (data_bytes > 0) {
 	    *data = allocate(uint8_t, data_bytes);
@@ -103,13 +222,44 @@ int sysex_listen_event(uint8_t *command_id,
 	return data_bytes;
 }
 
-extern int sysex_send(uint8_t dev_id, uint32_t model_id, uint32_t sysex_addr,
-		                uint32_t sysex_size, uint8_t *data) {
-	static uint8_t buf[MAX_SYSEX_SIZE + 50];
+/* As above, but the data bytes are copied into BUF, which holds BUF_SIZE
+ * bytes. Anything beyond BUF_SIZE is discarded. */
+static int sysex_listen_event_buf(uint8_t *command_id,
+				uint32_t *sysex_addr, uint8_t *buf,
+				uint32_t buf_size, int *sum) {
+	int data_bytes;
+	uint8_t *priv_data;
+
+	data_bytes = transport->listen_event(cur_device, &priv_data, NULL);
+
+	if (data_bytes < 0) return -1;
+
+	data_bytes = parse_event(priv_data, data_bytes,
+			command_id, sysex_addr, sum);
+
+	if (data_bytes > 0) {
+	    memcpy(buf, priv_data + SYSEX_DATA_OFFSET,
+			    data_bytes < buf_size ? data_bytes : buf_size);
+	} else data_bytes = 0;
+
+	free(priv_data);
+
+	return data_bytes;
+}
+
+int sysex_listen_event(uint8_t *command_id, uint32_t *sysex_addr,
+		uint8_t **data, int *sum) {
+	return sysex_listen_event_time(command_id, sysex_addr, data, sum, NULL);
+}
+
+uint32_t sysex_send_at(uint8_t dev_id, uint32_t model_id, uint32_t sysex_addr,
+		uint32_t sysex_size, uint8_t *data, uint64_t time) {
+	/* Not static, senders on other threads mustn't share it */
+	uint8_t buf[MAX_SYSEX_SIZE + 50];
 	int sum, start;
 	int i;
 
-	if (sysex_size > MAX_SYSEX_SIZE) return -1;
+	if (sysex_size > MAX_SYSEX_SIZE) return 0;
 
 	i = 0;
 	buf[i++] = MIDI_CMD_COMMON_SYSEX;
@@ -132,24 +282,24 @@ extern int sysex_send(uint8_t dev_id, uint32_t model_id, uint32_t sysex_addr,
 	memcpy(buf + i, data, sysex_size);
 	i += sysex_size;
 
-	sum = checksum(sysex_size + 4, buf + start);
+	sum = libgieditor_checksum(sysex_size + 4, buf + start);
 
 	buf[i++] = sum;
 	buf[i++] = MIDI_CMD_COMMON_SYSEX_END;
 
-	jack_sysex_send_event(i, buf);
-	return 0;
+	return send_event(i, buf, time, 0);
 }
 
-int sysex_recv(uint8_t dev_id, uint32_t model_id,
-		uint32_t sysex_addr, uint32_t sysex_size, uint8_t **data) {
-	static uint8_t buf[MAX_SYSEX_SIZE + 50];
-	uint8_t cmd_id;
-	int sum, start, bytes_received;
-	int i;
+uint32_t sysex_send(uint8_t dev_id, uint32_t model_id, uint32_t sysex_addr,
+		uint32_t sysex_size, uint8_t *data) {
+	return sysex_send_at(dev_id, model_id, sysex_addr, sysex_size, data, 0);
+}
 
-	*data = NULL;
-	if (sysex_size > MAX_SYSEX_SIZE) return -1;
+static void send_rq1(uint8_t dev_id, uint32_t model_id,
+		uint32_t sysex_addr, uint32_t sysex_size, int link) {
+	uint8_t buf[MAX_SYSEX_SIZE + 50];
+	int sum, start;
+	int i;
 
 	i = 0;
 	buf[i++] = MIDI_CMD_COMMON_SYSEX;
@@ -169,18 +319,32 @@ int sysex_recv(uint8_t dev_id, uint32_t model_id,
 	buf[i++] = (sysex_addr & 0x0000ff00) >> 8;
 	buf[i++] = (sysex_addr & 0x000000ff);
 	
-	buf[i++] = (sysex_size & 0xff000000) >> 24;
-	buf[i++] = (sysex_size & 0x00ff0000) >> 16;
-	buf[i++] = (sysex_size & 0x0000ff00) >> 8;
-	buf[i++] = (sysex_size & 0x000000ff);
+	/* Seven bits a byte, like the address */
+	buf[i++] = (sysex_size >> 21) & 0x7f;
+	buf[i++] = (sysex_size >> 14) & 0x7f;
+	buf[i++] = (sysex_size >> 7) & 0x7f;
+	buf[i++] = sysex_size & 0x7f;
 	
-	sum = checksum(i - start, buf + start);
+	sum = libgieditor_checksum(i - start, buf + start);
 
 	buf[i++] = sum;
 	buf[i++] = MIDI_CMD_COMMON_SYSEX_END;
 
-	jack_sysex_send_event(i, buf);
-	jack_flush_sysex_in_list();
+	send_event(i, buf, 0, link);
+}
+
+int sysex_recv(uint8_t dev_id, uint32_t model_id,
+		uint32_t sysex_addr, uint32_t sysex_size, uint8_t **data) {
+	uint8_t cmd_id;
+	int sum, bytes_received;
+
+	*data = NULL;
+	if (sysex_size > MAX_SYSEX_SIZE) return -1;
+
+	/* Before sending, a transport that writes at once could have the
+	 * reply in already */
+	transport->flush_in_list(cur_device);
+	send_rq1(dev_id, model_id, sysex_addr, sysex_size, 0);
 
 	bytes_received = sysex_listen_event(&cmd_id, &sysex_addr, data, &sum);
 
@@ -192,3 +356,101 @@ int sysex_recv(uint8_t dev_id, uint32_t model_id,
 
 	return 0;
 }
+
+/* Requests SYSEX_SIZE bytes, and receives them straight into the caller's
+ * buffer, saving an allocation per reply */
+int sysex_recv_buf(uint8_t dev_id, uint32_t model_id,
+		uint32_t sysex_addr, uint32_t sysex_size, uint8_t *buf) {
+	uint8_t cmd_id;
+	int sum, bytes_received;
+
+	if (sysex_size > MAX_SYSEX_SIZE) return -1;
+
+	transport->flush_in_list(cur_device);
+	send_rq1(dev_id, model_id, sysex_addr, sysex_size, 0);
+
+	bytes_received = sysex_listen_event_buf(&cmd_id, &sysex_addr,
+			buf, sysex_size, &sum);
+
+	if (bytes_received < sysex_size)
+		return -1;
+
+	if (sum != 0x00)
+		return -1;
+
+	return 0;
+}
+
+/* The link with the fewest requests outstanding, if it has room for
+ * another, otherwise -1 */
+static int free_link(int outstanding[], int window) {
+	int link, best = 0;
+
+	for (link = 1; link < device_links[cur_device].num; link++)
+	    if (outstanding[link] < outstanding[best]) best = link;
+	return outstanding[best] < window ? best : -1;
+}
+
+/* Keeps up to WINDOW requests outstanding on each link, sending each one
+ * on whichever has fewest, so a faster link ends up taking more of them.
+ * Each reply is matched to its request by address, whichever link it
+ * comes back on, so the device may answer in any order, and anything that
+ * matches nothing is dropped. Fails if a reply times out, is short or has
+ * a bad checksum. */
+int sysex_recv_pipelined(uint8_t dev_id, uint32_t model_id,
+		Sysex_request *requests, int num, int window) {
+	uint8_t cmd_id;
+	uint32_t sysex_addr;
+	uint8_t *priv_data;
+	int i, sum, data_bytes, link;
+	int sent = 0, received = 0, oldest = 0;
+	int outstanding[MAX_SYSEX_LINKS] = { 0 };
+
+	if (window < 1) window = 1;
+	for (i = 0; i < num; i++) {
+	    if (requests[i].sysex_size > MAX_SYSEX_SIZE) return -1;
+	    requests[i].received = 0;
+	}
+
+	transport->flush_in_list(cur_device);
+
+	while (received < num) {
+	    while (sent < num && (link = free_link(outstanding, window)) >= 0) {
+		send_rq1(dev_id, model_id, requests[sent].sysex_addr,
+				requests[sent].sysex_size, link);
+		requests[sent++].link = link;
+		outstanding[link]++;
+	    }
+
+	    data_bytes = transport->listen_event(cur_device, &priv_data, NULL);
+	    if (data_bytes < 0) return -1;
+
+	    data_bytes = parse_event(priv_data, data_bytes,
+			    &cmd_id, &sysex_addr, &sum);
+
+	    for (i = oldest; i < sent; i++) {
+		if (!requests[i].received &&
+			    requests[i].sysex_addr == sysex_addr) break;
+	    }
+	    if (i == sent || cmd_id != MIDI_CMD_DT1) {
+		free(priv_data);
+		continue;
+	    }
+
+	    if (data_bytes < (int) requests[i].sysex_size || sum != 0x00) {
+		free(priv_data);
+		return -1;
+	    }
+
+	    memcpy(requests[i].buf, priv_data + SYSEX_DATA_OFFSET,
+			    requests[i].sysex_size);
+	    requests[i].received = 1;
+	    outstanding[requests[i].link]--;
+	    received++;
+	    free(priv_data);
+
+	    while (oldest < sent && requests[oldest].received) oldest++;
+	}
+
+	return 0;
+}
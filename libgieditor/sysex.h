@@ -20,19 +20,78 @@
  * $Id: sysex.h,v 1.7 2012/06/28 05:11:32 kmtaylor Exp $
  */
 
+#define MIDI_CMD_RQ1		    0x11
+#define MIDI_CMD_DT1		    0x12
+
+extern int sysex_set_transport(const char *spec);
+
 extern int sysex_init(const char *client_name, int timeout_time,
 		enum init_flags flags);
 
 extern int sysex_close(void);
 
 extern void sysex_set_timeout(int timeout_time);
+/* As above, in milliseconds whatever the transport */
+extern void sysex_set_timeout_ms(int ms);
+extern void sysex_set_pacing(int bytes_per_second);
+extern void sysex_set_max_size(int max_size);
+extern void sysex_set_bulk_budget(int bytes);
+/* How many links to the Juno to open, before init. Returns -1 if the
+ * transport can't have that many */
+extern int sysex_set_links(int num);
+extern void sysex_set_link_pacing(int link, int bytes_per_second);
+
+/* Another Juno on the same transport, on ports named after NAME. Returns
+ * its device number, or -1 if the transport can't have another */
+extern int sysex_add_device(const char *name);
+extern void sysex_remove_device(int device);
+/* Everything the calling thread does after this goes to DEVICE, 0 being
+ * the one sysex_init opened. Links are counted from the device's first */
+extern void sysex_use_device(int device);
+
+/* Between these, messages sent from the calling thread go on the bulk
+ * lane, behind anything on the realtime lane. They nest */
+extern void sysex_begin_bulk(void);
+extern void sysex_end_bulk(void);
+extern unsigned int sysex_dropped(void);
 
+/* Microseconds, on the same clock as the times below */
+extern uint64_t sysex_get_time(void);
+
+/* Waits for everything queued so far */
 extern void sysex_wait_write(void);
+/* Waits for one message, as returned by the send calls */
+extern void sysex_wait_ticket(uint32_t ticket);
+/* Waits for the last message sent from the calling thread on each lane of
+ * each link */
+extern void sysex_wait_sent(void);
 
-extern int sysex_send(uint8_t dev_id, uint32_t model_id, uint32_t sysex_addr,
-		uint32_t sysex_size, uint8_t *data);
+/* These return a ticket for sysex_wait_ticket, 0 if the data is too big */
+extern uint32_t sysex_send(uint8_t dev_id, uint32_t model_id,
+		uint32_t sysex_addr, uint32_t sysex_size, uint8_t *data);
+/* Goes out no earlier than TIME, 0 for straight away */
+extern uint32_t sysex_send_at(uint8_t dev_id, uint32_t model_id,
+		uint32_t sysex_addr, uint32_t sysex_size, uint8_t *data,
+		uint64_t time);
 extern int sysex_recv(uint8_t dev_id, uint32_t model_id, uint32_t sysex_addr,
 		uint32_t sysex_size, uint8_t **data);
+extern int sysex_recv_buf(uint8_t dev_id, uint32_t model_id,
+		uint32_t sysex_addr, uint32_t sysex_size, uint8_t *buf);
+
+typedef struct s_sysex_request {
+	uint32_t	sysex_addr;
+	uint32_t	sysex_size;
+	uint8_t		*buf;
+	int		received;
+	int		link;		/* Sent on */
+} Sysex_request;
+
+extern int sysex_recv_pipelined(uint8_t dev_id, uint32_t model_id,
+		Sysex_request *requests, int num, int window);
 
 extern int sysex_listen_event(uint8_t *command_id,
 		uint32_t *sysex_addr, uint8_t **data, int *sum);
+/* As above, storing when the message arrived in *TIME */
+extern int sysex_listen_event_time(uint8_t *command_id,
+		uint32_t *sysex_addr, uint8_t **data, int *sum,
+		uint64_t *time);
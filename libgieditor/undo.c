@@ -0,0 +1,305 @@
+/* Undo history
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#define LIBGIEDITOR_PRIVATE
+#include <libgieditor.h>
+#include "midi_addresses.h"
+#include "undo.h"
+
+#define allocate(t, num) __common_allocate(sizeof(t) * num, "libgieditor")
+#define NUM_ADDRESSES libgieditor_num_addresses
+
+/* Repeated single value edits of one address, closer together than this,
+ * are undone in one go (holding down an arrow key, say) */
+#define UNDO_COALESCE_MS	1000
+
+enum undo_flags {
+	UNDO_OLD_KNOWN		= 0x01,
+	UNDO_SINGLE		= 0x02,	/* The only value in its send */
+};
+
+/* One value written to the device. Entries written together share a
+ * group, and are undone and redone together. */
+typedef struct s_undo_entry {
+	uint32_t	sysex_addr;
+	uint32_t	old_value;
+	uint32_t	new_value;
+	uint32_t	group;
+	uint32_t	time;		/* Milliseconds, monotonic */
+	uint8_t		sysex_size;
+	uint8_t		flags;
+} Undo_entry;
+
+/* A ring of CAPACITY entries, the oldest at START. The first APPLIED of
+ * the COUNT entries are in effect, the rest have been undone and can be
+ * redone until the next edit. Only access with undo_lock */
+static Undo_entry *ring;
+static int capacity, start, count, applied;
+static uint32_t last_group, open_group;
+static int group_depth;
+static pthread_mutex_t undo_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Set while replaying or pasting, so those writes aren't recorded again */
+static __thread int undo_suspended;
+
+#define ENTRY(i) (&ring[(start + (i)) % capacity])
+
+static uint32_t now_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void libgieditor_undo_enable(int max_entries) {
+	pthread_mutex_lock(&undo_lock);
+	free(ring);
+	ring = NULL;
+	capacity = start = count = applied = 0;
+	if (max_entries > 0) {
+	    ring = allocate(Undo_entry, max_entries);
+	    capacity = max_entries;
+	}
+	pthread_mutex_unlock(&undo_lock);
+}
+
+int undo_enabled(void) {
+	return ring && !undo_suspended;
+}
+
+void undo_suspend(void) {
+	undo_suspended++;
+}
+
+void undo_resume(void) {
+	undo_suspended--;
+}
+
+void libgieditor_undo_begin_group(void) {
+	pthread_mutex_lock(&undo_lock);
+	if (group_depth++ == 0) open_group = ++last_group;
+	pthread_mutex_unlock(&undo_lock);
+}
+
+void libgieditor_undo_end_group(void) {
+	pthread_mutex_lock(&undo_lock);
+	if (group_depth > 0) group_depth--;
+	pthread_mutex_unlock(&undo_lock);
+}
+
+static void drop_oldest_group(void) {
+	uint32_t group = ENTRY(0)->group;
+
+	while (count && ENTRY(0)->group == group) {
+	    start = (start + 1) % capacity;
+	    count--;
+	    applied--;
+	}
+}
+
+/* Called with undo_lock held */
+static void push_entry(uint32_t sysex_addr, uint32_t sysex_size,
+		uint32_t old_value, int old_known, uint32_t new_value,
+		uint32_t group, uint32_t time, int single) {
+	Undo_entry *entry;
+
+	/* A new edit makes anything undone unreachable */
+	count = applied;
+	if (count == capacity) drop_oldest_group();
+
+	entry = ENTRY(count);
+	entry->sysex_addr = sysex_addr;
+	entry->sysex_size = sysex_size;
+	entry->old_value = old_value;
+	entry->new_value = new_value;
+	entry->group = group;
+	entry->time = time;
+	entry->flags = (old_known ? UNDO_OLD_KNOWN : 0) |
+		(single ? UNDO_SINGLE : 0);
+	count++;
+	applied++;
+}
+
+/* Picks the group for a send. SINGLE if it holds just one value */
+static uint32_t send_group(uint32_t sysex_addr, int single, uint32_t time) {
+	Undo_entry *last;
+
+	if (group_depth) return open_group;
+
+	if (single && applied) {
+	    last = ENTRY(applied - 1);
+	    if ((last->flags & UNDO_SINGLE) && last->sysex_addr == sysex_addr
+			&& time - last->time < UNDO_COALESCE_MS)
+		return last->group;
+	}
+	return ++last_group;
+}
+
+/* Addresses within a class follow each other in the table */
+static midi_address *next_address(midi_address *m_address) {
+	uint32_t sysex_addr = libgieditor_add_addresses(m_address->sysex_addr,
+			m_address->sysex_size);
+
+	if (m_address < &libgieditor_address_table()[NUM_ADDRESSES - 1] &&
+		    m_address[1].sysex_addr == sysex_addr)
+	    return m_address + 1;
+	return libgieditor_match_midi_address(sysex_addr);
+}
+
+/* Records a DT1 block about to be sent. Old values come from the address
+ * table, where they're known if they have been fetched, and the table then
+ * takes the new ones, so the next send over them records these as old. */
+void undo_record(uint32_t sysex_addr, uint32_t sysex_size, uint8_t *data) {
+	midi_address *m_address;
+	uint32_t offset = 0, group, time = now_ms(), new_value;
+	int single;
+
+	m_address = libgieditor_match_midi_address(sysex_addr);
+	if (!m_address) return;
+	single = m_address->sysex_size == sysex_size;
+
+	pthread_mutex_lock(&undo_lock);
+	group = send_group(sysex_addr, single, time);
+	single = single && !group_depth;
+	while (m_address && offset + m_address->sysex_size <= sysex_size) {
+	    new_value = libgieditor_get_sysex_value(data + offset,
+			    m_address->sysex_size);
+	    push_entry(m_address->sysex_addr, m_address->sysex_size,
+			    m_address->value,
+			    m_address->flags & M_ADDRESS_FETCHED,
+			    new_value, group, time, single);
+	    m_address->value = new_value;
+	    m_address->flags |= M_ADDRESS_FETCHED;
+	    offset += m_address->sysex_size;
+	    m_address = next_address(m_address);
+	}
+	pthread_mutex_unlock(&undo_lock);
+}
+
+/* For writes whose old values are no longer in the address table by the
+ * time they're sent. M_ADDRESS is the table entry. */
+void undo_record_value(midi_address *m_address, uint32_t new_value) {
+	uint32_t group, time = now_ms();
+
+	pthread_mutex_lock(&undo_lock);
+	group = group_depth ? open_group : ++last_group;
+	push_entry(m_address->sysex_addr, m_address->sysex_size,
+			m_address->value, m_address->flags & M_ADDRESS_FETCHED,
+			new_value, group, time, 0);
+	pthread_mutex_unlock(&undo_lock);
+}
+
+typedef struct s_replay_value {
+	midi_address	    m_address;
+	int		    order;
+} Replay_value;
+
+static int replay_sort(const void *va, const void *vb) {
+	const Replay_value *a = va, *b = vb;
+
+	if (a->m_address.sysex_addr != b->m_address.sysex_addr)
+	    return a->m_address.sysex_addr > b->m_address.sysex_addr ? 1 : -1;
+	return a->order - b->order;
+}
+
+/* Writes back one group, as few DT1 blocks as the addresses allow. An
+ * address written more than once in the group is set to its value before
+ * the first write (undoing) or after the last (redoing). */
+static int replay(int undo) {
+	Replay_value *values;
+	midi_address *m_addresses, *m_address;
+	uint32_t group;
+	int i, first, last, num = 0, num_values = 0;
+
+	pthread_mutex_lock(&undo_lock);
+	if (!ring || (undo ? !applied : applied == count)) {
+	    pthread_mutex_unlock(&undo_lock);
+	    return 0;
+	}
+
+	if (undo) {
+	    last = applied - 1;
+	    group = ENTRY(last)->group;
+	    for (first = last; first > 0 && ENTRY(first - 1)->group == group;)
+		first--;
+	    applied = first;
+	} else {
+	    first = applied;
+	    group = ENTRY(first)->group;
+	    for (last = first; last + 1 < count &&
+			    ENTRY(last + 1)->group == group;) last++;
+	    applied = last + 1;
+	}
+
+	values = allocate(Replay_value, (last - first + 1));
+	for (i = first; i <= last; i++) {
+	    if (undo && !(ENTRY(i)->flags & UNDO_OLD_KNOWN)) continue;
+	    values[num].m_address.sysex_addr = ENTRY(i)->sysex_addr;
+	    values[num].m_address.sysex_size = ENTRY(i)->sysex_size;
+	    values[num].m_address.flags = 0;
+	    values[num].m_address.class = NULL;
+	    values[num].m_address.value = undo ?
+		    ENTRY(i)->old_value : ENTRY(i)->new_value;
+	    values[num].order = undo ? i : -i;
+	    num++;
+	}
+	pthread_mutex_unlock(&undo_lock);
+
+	qsort(values, num, sizeof(Replay_value), replay_sort);
+	m_addresses = allocate(midi_address, (num ? num : 1));
+	for (i = 0; i < num; i++) {
+	    if (num_values && m_addresses[num_values - 1].sysex_addr ==
+			    values[i].m_address.sysex_addr) continue;
+	    m_addresses[num_values++] = values[i].m_address;
+	}
+	free(values);
+
+	if (num_values) {
+	    undo_suspend();
+	    libgieditor_send_bulk_sysex(m_addresses, num_values);
+	    undo_resume();
+	}
+
+	for (i = 0; i < num_values; i++) {
+	    m_address = libgieditor_match_midi_address(
+			    m_addresses[i].sysex_addr);
+	    if (!m_address) continue;
+	    m_address->value = m_addresses[i].value;
+	    m_address->flags |= M_ADDRESS_FETCHED;
+	}
+	free(m_addresses);
+	return num_values;
+}
+
+int libgieditor_undo(void) {
+	return replay(1);
+}
+
+int libgieditor_redo(void) {
+	return replay(0);
+}
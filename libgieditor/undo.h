@@ -0,0 +1,31 @@
+/* Undo history hooks
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Called from the send path in libgieditor.c. Needs libgieditor.h */
+
+/* Nonzero if history is on, and not suspended on this thread */
+extern int undo_enabled(void);
+extern void undo_suspend(void);
+extern void undo_resume(void);
+
+extern void undo_record(uint32_t sysex_addr, uint32_t sysex_size,
+		uint8_t *data);
+extern void undo_record_value(midi_address *m_address, uint32_t new_value);
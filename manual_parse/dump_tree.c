@@ -44,6 +44,24 @@ int ln;
 static int num_addresses;
 static int num_classes;
 
+/* The leaf addresses, gathered from the tree and then put in address
+ * order, so that each one's index in the table is its parameter ID */
+typedef struct s_address_entry {
+	uint32_t	sysex_addr;
+	uint32_t	sysex_size;
+	char		*class_cname;
+	int		seq;
+} Address_entry;
+
+static Address_entry *entries;
+static int max_entries;
+
+/* Each distinct member name once, for libgieditor_midi_names */
+static const char **names;
+static uint32_t *name_offsets;
+static int num_names, max_names;
+static uint32_t names_size;
+
 Midi_tree midi_tree;
 
 static inline uint32_t parse_address(int b1, int b2, int b3, int b4) {
@@ -248,14 +266,60 @@ static void print_address_entry(Address_line address) {
 	    parents = parents->parent;
 	}
 
-	printf("\t{\n");
-	printf("\t\t.sysex_addr = 0x%x,\n", sysex_addr);
-	printf("\t\t.sysex_size = 0x%x,\n", 
-			address->info.two_byte_address.sysex_size);
-	printf("\t\t.class = &%s,\n", address->parent->private_class->cname);
-	printf("\t},\n");
+	if (num_addresses == max_entries) {
+	    max_entries = max_entries ? max_entries * 2 : 1024;
+	    entries = realloc(entries, max_entries * sizeof(Address_entry));
+	    if (!entries) {
+		common_log(1, "Error: out of memory");
+		exit(1);
+	    }
+	}
+	entries[num_addresses].sysex_addr = sysex_addr;
+	entries[num_addresses].sysex_size =
+		address->info.two_byte_address.sysex_size;
+	entries[num_addresses].class_cname =
+		address->parent->private_class->cname;
+	entries[num_addresses].seq = num_addresses;
 	num_addresses++;
 }
+
+static inline uint32_t linear_address(uint32_t sysex_addr) {
+	return (sysex_addr >> 24 & 0x7f) << 21 |
+		(sysex_addr >> 16 & 0x7f) << 14 |
+		(sysex_addr >> 8 & 0x7f) << 7 | (sysex_addr & 0x7f);
+}
+
+/* Repeats keep the order they were found in */
+static int entry_sort(const void *va, const void *vb) {
+	const Address_entry *a = va, *b = vb;
+	uint32_t addr_a = linear_address(a->sysex_addr);
+	uint32_t addr_b = linear_address(b->sysex_addr);
+
+	if (addr_a != addr_b) return addr_a > addr_b ? 1 : -1;
+	return a->seq > b->seq ? 1 : -1;
+}
+
+static void dump_addresses(void) {
+	int i;
+
+	qsort(entries, num_addresses, sizeof(Address_entry), entry_sort);
+
+	printf("midi_address libgieditor_midi_addresses[] = {\n");
+	for (i = 0; i < num_addresses; i++) {
+	    printf("\t{\t/* %i */\n", i);
+	    printf("\t\t.sysex_addr = 0x%x,\n", entries[i].sysex_addr);
+	    printf("\t\t.sysex_size = 0x%x,\n", entries[i].sysex_size);
+	    printf("\t\t.class = &%s,\n", entries[i].class_cname);
+	    printf("\t},\n");
+	}
+	printf("};\n");
+
+	/* Searched for an address's ID without touching the whole table */
+	printf("const uint32_t libgieditor_midi_linear_addrs[] = {\n");
+	for (i = 0; i < num_addresses; i++)
+	    printf("\t0x%x,\n", linear_address(entries[i].sysex_addr));
+	printf("};\n");
+}
 	
 /* Recursive */
 static void span_addresses(Address_line address) {
@@ -291,6 +355,37 @@ static int make_class_c_names(Classes classes) {
 	return class_c_name_iterator;
 }
 
+/* The offset of NAME in libgieditor_midi_names, adding it if it's new */
+static uint32_t intern_name(const char *name) {
+	int i;
+
+	for (i = 0; i < num_names; i++)
+	    if (!strcmp(names[i], name)) return name_offsets[i];
+
+	if (num_names == max_names) {
+	    max_names = max_names ? max_names * 2 : 256;
+	    names = realloc(names, max_names * sizeof(char *));
+	    name_offsets = realloc(name_offsets, max_names * sizeof(uint32_t));
+	    if (!names || !name_offsets) {
+		common_log(1, "Error: out of memory");
+		exit(1);
+	    }
+	}
+	names[num_names] = name;
+	name_offsets[num_names] = names_size;
+	names_size += strlen(name) + 1;
+	return name_offsets[num_names++];
+}
+
+static void dump_names(void) {
+	int i;
+
+	printf("\nconst char libgieditor_midi_names[] =\n");
+	for (i = 0; i < num_names; i++)
+	    printf("\t\"%s\\0\"\t/* %u */\n", names[i], name_offsets[i]);
+	printf("\t\"\";\n");
+}
+
 static void dump_class(Class class) {
 	Class parents;
 	int num_members = 0;
@@ -309,8 +404,8 @@ static void dump_class(Class class) {
 	    address = addresses->first;
 	    if (address->type != IGNORE) {
 		printf("\t\t{\n");
-		printf("\t\t\t.name = \"%s\",\n",
-				get_address_description(address));
+		printf("\t\t\t.name_offset = %u,\n", intern_name(
+				get_address_description(address)));
 		printf("\t\t\t.sysex_addr_base = 0x%x,\n",
 			    get_address_sysex_addr(address));
 		if (address->type != TWOBYTE)
@@ -388,20 +483,21 @@ int main(void) {
 
 	printf("};\n");
 
-	/* Build a bottom up array mapping addresses to classes */
+	/* Build a bottom up array mapping addresses to classes, in address
+	 * order */
 	header("extern midi_address libgieditor_midi_addresses[];\n");
-	printf("midi_address libgieditor_midi_addresses[] = {\n");
+	header("extern const uint32_t libgieditor_midi_linear_addrs[];\n");
 
 	toplevel_addresses = get_class_address_list(midi_tree->first);
 	while (toplevel_addresses) {
 	    span_addresses(toplevel_addresses->first);
 	    toplevel_addresses = toplevel_addresses->rest;
 	}
-
-	printf("};\n");
+	dump_addresses();
 
 	/* Build a top down linked list mapping classes */
 	span_classes_down(midi_tree);
+	dump_names();
 
 	printf("\nconst unsigned int libgieditor_num_addresses = %u;\n", 
 			num_addresses);
@@ -0,0 +1,138 @@
+/* gi_backup
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libgieditor.h"
+
+#define CLIENT_NAME	"gi_backup"
+#define DEFAULT_WINDOW	8
+
+static void usage(char *name) {
+	fprintf(stderr, "Usage: %s [-r] [-j journal] [-w window] "
+			"backup <file>\n", name);
+	fprintf(stderr, "       %s [-w window] restore <file>\n", name);
+	fprintf(stderr, "       %s journal <journal>\n", name);
+	fprintf(stderr, "       %s changes <journal>\n", name);
+	fprintf(stderr, "  -r\tresume an interrupted backup\n");
+	fprintf(stderr, "  -j\tonly reread what the journal has seen change "
+			"since the last backup\n");
+	fprintf(stderr, "  -w\trequests kept in flight (default %d)\n",
+			DEFAULT_WINDOW);
+}
+
+static void print_progress(int done, int total, const char *name,
+		void *arg) {
+	fprintf(stderr, "\r%3d/%d %-32s", done, total, name);
+	if (done == total) fprintf(stderr, "\n");
+}
+
+static int print_changes(char *journal) {
+	const char **names;
+	int i, num;
+
+	num = libgieditor_journal_changes(journal, &names);
+	if (num < 0) {
+	    fprintf(stderr, "Couldn't read %s\n", journal);
+	    return 1;
+	}
+	for (i = 0; i < num; i++) printf("%s\n", names[i]);
+	free(names);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	int c, resume = 0, window = DEFAULT_WINDOW, retval;
+	char *journal = NULL;
+
+	while ((c = getopt(argc, argv, "rj:w:")) != -1) {
+	    switch (c) {
+		case 'r': resume = 1; break;
+		case 'j': journal = optarg; break;
+		case 'w': window = atoi(optarg); break;
+		default:
+		    usage(argv[0]);
+		    return 1;
+	    }
+	}
+
+	if (optind != argc - 2 || (strcmp(argv[optind], "backup") &&
+			strcmp(argv[optind], "restore") &&
+			strcmp(argv[optind], "journal") &&
+			strcmp(argv[optind], "changes"))) {
+	    usage(argv[0]);
+	    return 1;
+	}
+
+	if (!strcmp(argv[optind], "changes"))
+	    return print_changes(argv[optind + 1]);
+
+	if (libgieditor_init(CLIENT_NAME,
+				LIBGIEDITOR_READ | LIBGIEDITOR_WRITE) < 0) {
+	    fprintf(stderr, "Library initialisation failed, aborting\n");
+	    fprintf(stderr, "Check that jackd is running.\n");
+	    return 1;
+	}
+	libgieditor_set_read_window(window);
+
+	if (!strcmp(argv[optind], "journal")) {
+	    /* Runs until killed */
+	    libgieditor_set_timeout(-1);
+	    retval = libgieditor_journal(argv[optind + 1]);
+	} else if (!strcmp(argv[optind], "backup") && journal) {
+	    retval = libgieditor_backup_incremental(argv[optind + 1],
+			    journal, print_progress, NULL);
+	} else if (!strcmp(argv[optind], "backup")) {
+	    retval = libgieditor_backup(argv[optind + 1], resume,
+			    print_progress, NULL);
+	} else {
+	    retval = libgieditor_restore(argv[optind + 1],
+			    print_progress, NULL);
+	}
+	libgieditor_close();
+
+	switch (retval) {
+	    case 0:
+		return 0;
+	    case -1:
+		fprintf(stderr, "\nCouldn't open %s\n", argv[optind + 1]);
+		break;
+	    case -2:
+		fprintf(stderr, "\n%s is damaged or can't be written\n",
+				argv[optind + 1]);
+		break;
+	    case -4:
+		/* Restores are diffed, so running one again picks up where
+		 * it stopped */
+		fprintf(stderr, "\nThe Juno stopped answering, run again%s "
+				"to carry on\n", strcmp(argv[optind], "backup") ?
+				"" : " with -r");
+		break;
+	    default:
+		fprintf(stderr, "%d areas didn't verify\n", retval);
+		break;
+	}
+	return 1;
+}
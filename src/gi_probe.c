@@ -0,0 +1,295 @@
+/* gi_probe
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "libgieditor.h"
+
+#define CLIENT_NAME	"gi_probe"
+#define DEFAULT_REPEATS	20
+#define PROBE_TIMEOUT	500		/* ms, while probing */
+#define MIN_TIMEOUT	100		/* ms, in the profile */
+#define MAX_REGIONS	8
+#define MAX_PROBE_SIZE	499		/* the reply must fit in 512 bytes */
+#define SETTLE_TIME	50000		/* us, after a burst */
+#define NOTES_SIZE	8192
+
+/* Bytes in a DT1 besides the data */
+#define DT1_OVERHEAD	13
+
+/* The temporary patch, the temporary studio set and the first user patch */
+static const uint32_t default_regions[] = {
+	0x10000000, 0x18000000, 0x20000000 };
+
+static const int sizes[] = {
+	1, 8, 16, 32, 64, 96, 120, 128, 160, 192, 224, 256, 320, 384, 448,
+	MAX_PROBE_SIZE };
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+/* Bytes per second to try DT1 bursts at, fastest first. 0 is unpaced */
+static const int rates[] = { 0, 25600, 12800, 6400, 3125, 1600 };
+#define NUM_RATES (sizeof(rates) / sizeof(rates[0]))
+
+/* The ingest test writes the temporary patch name, one character per DT1,
+ * BURST_ROUNDS times over, then checks the last round arrived */
+#define NAME_ADDR	0x10000000
+#define BURST_ROUNDS	8
+
+static char notes[NOTES_SIZE];
+static int notes_len;
+
+static void usage(char *name) {
+	fprintf(stderr, "Usage: %s [-n repeats] [-a address]... [-x] "
+			"[-o profile]\n", name);
+	fprintf(stderr, "Measures how the Juno answers requests of each size, "
+			"and how fast it takes\nwrites, and saves a profile "
+			"the other programmes load.\n");
+	fprintf(stderr, "  -n\trequests of each size (default %d)\n",
+			DEFAULT_REPEATS);
+	fprintf(stderr, "  -a\tan address region to read, in hex (default the "
+			"temporary patch,\n\ttemporary studio set and first "
+			"user patch)\n");
+	fprintf(stderr, "  -x\tdon't test writes (they change the temporary "
+			"patch name, then put it back)\n");
+	fprintf(stderr, "  -o\twhere to write the profile\n");
+}
+
+/* Printed, and kept for the profile's comments */
+static void report(const char *fmt, ...) {
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	va_start(ap, fmt);
+	if (notes_len < NOTES_SIZE) notes_len += vsnprintf(notes + notes_len,
+			NOTES_SIZE - notes_len, fmt, ap);
+	va_end(ap);
+	fflush(stdout);
+}
+
+static int compare_times(const void *va, const void *vb) {
+	uint64_t a = *(const uint64_t *) va, b = *(const uint64_t *) vb;
+
+	return a == b ? 0 : a > b ? 1 : -1;
+}
+
+static uint64_t percentile(uint64_t *sorted, int num, int pct) {
+	return sorted[(num - 1) * pct / 100];
+}
+
+#define MS(us) ((us) / 1000.0)
+
+/* Reads SIZE bytes at ADDR REPEATS times, adding the round trips to TIMES.
+ * Returns how many came back whole */
+static int probe_size(uint32_t addr, int size, int repeats, uint64_t *times,
+		int *num_times) {
+	uint8_t buf[MAX_PROBE_SIZE];
+	uint64_t start, rtt[repeats];
+	int i, ok = 0;
+
+	for (i = 0; i < repeats; i++) {
+	    start = libgieditor_get_time();
+	    if (libgieditor_get_sysex_buf(addr, size, buf) < 0) continue;
+	    rtt[ok++] = libgieditor_get_time() - start;
+	}
+
+	if (ok) {
+	    memcpy(times + *num_times, rtt, ok * sizeof(uint64_t));
+	    *num_times += ok;
+	    qsort(rtt, ok, sizeof(uint64_t), compare_times);
+	    report("  0x%08X %3d bytes: p50 %6.2fms  p90 %6.2fms  "
+			    "p99 %6.2fms  max %6.2fms  (%d/%d)\n", addr, size,
+			    MS(percentile(rtt, ok, 50)),
+			    MS(percentile(rtt, ok, 90)),
+			    MS(percentile(rtt, ok, 99)),
+			    MS(rtt[ok - 1]), ok, repeats);
+	} else report("  0x%08X %3d bytes: no whole replies\n", addr, size);
+	return ok;
+}
+
+/* Sends the burst at RATE bytes per second. Returns 0 if all of the last
+ * round reads back, -1 if not, -2 if it can't be read at all */
+static int probe_rate(int rate, int trial) {
+	uint8_t expected[MAX_SET_NAME_SIZE], buf[MAX_SET_NAME_SIZE], c;
+	uint64_t start, elapsed;
+	int k, wrong = 0, burst = BURST_ROUNDS * MAX_SET_NAME_SIZE;
+
+	libgieditor_set_pacing(rate);
+	start = libgieditor_get_time();
+	for (k = 0; k < burst; k++) {
+	    c = 'A' + (k / MAX_SET_NAME_SIZE + trial) % 26;
+	    expected[k % MAX_SET_NAME_SIZE] = c;
+	    libgieditor_send_sysex(NAME_ADDR + k % MAX_SET_NAME_SIZE, 1, &c);
+	}
+	libgieditor_wait_sent();
+	elapsed = libgieditor_get_time() - start;
+
+	/* Give it a moment to finish with the last few */
+	usleep(SETTLE_TIME);
+	if (libgieditor_get_sysex_buf(NAME_ADDR, MAX_SET_NAME_SIZE, buf) < 0)
+	    return -2;
+	for (k = 0; k < MAX_SET_NAME_SIZE; k++)
+	    if (buf[k] != expected[k]) wrong++;
+
+	report("  %5d bytes/s%s: sent at %6.0f bytes/s, %d of the last %d "
+			"writes lost\n", rate, rate ? "" : " (unpaced)",
+			burst * (DT1_OVERHEAD + 1) * 1e6 / (elapsed ? elapsed : 1),
+			wrong, MAX_SET_NAME_SIZE);
+	return wrong ? -1 : 0;
+}
+
+static int make_parent_dirs(const char *filename) {
+	char *path = strdup(filename), *c;
+
+	for (c = strchr(path + 1, '/'); c; c = strchr(c + 1, '/')) {
+	    *c = '\0';
+	    if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+		free(path);
+		return -1;
+	    }
+	    *c = '/';
+	}
+	free(path);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	uint32_t regions[MAX_REGIONS];
+	uint8_t saved_name[MAX_SET_NAME_SIZE];
+	uint64_t *times;
+	DeviceProfile profile = { -1, -1, -1, -1 };
+	char *filename = NULL;
+	int c, i, j, repeats = DEFAULT_REPEATS, num_regions = 0;
+	int test_writes = 1, num_times = 0, region_block, retval;
+
+	while ((c = getopt(argc, argv, "n:a:xo:")) != -1) {
+	    switch (c) {
+		case 'n': repeats = atoi(optarg); break;
+		case 'a':
+		    if (num_regions == MAX_REGIONS) break;
+		    regions[num_regions++] = strtoul(optarg, NULL, 16);
+		    break;
+		case 'x': test_writes = 0; break;
+		case 'o': filename = optarg; break;
+		default:
+		    usage(argv[0]);
+		    return 1;
+	    }
+	}
+	if (optind != argc || repeats < 1) {
+	    usage(argv[0]);
+	    return 1;
+	}
+	if (!num_regions) {
+	    num_regions = sizeof(default_regions) / sizeof(uint32_t);
+	    memcpy(regions, default_regions, sizeof(default_regions));
+	}
+
+	/* Start from the defaults, not from a previous profile */
+	setenv(PROFILE_ENV, "", 1);
+	if (libgieditor_init(CLIENT_NAME,
+				LIBGIEDITOR_READ | LIBGIEDITOR_WRITE) < 0) {
+	    fprintf(stderr, "Library initialisation failed, aborting\n");
+	    fprintf(stderr, "Check that jackd is running.\n");
+	    return 1;
+	}
+	libgieditor_set_timeout_ms(PROBE_TIMEOUT);
+
+	report("Round trips, RQ1 to DT1:\n");
+	times = malloc(num_regions * NUM_SIZES * repeats * sizeof(uint64_t));
+	for (i = 0; i < num_regions; i++) {
+	    region_block = 0;
+	    for (j = 0; j < NUM_SIZES; j++) {
+		if (probe_size(regions[i], sizes[j], repeats, times,
+				    &num_times) < repeats) break;
+		region_block = sizes[j];
+	    }
+	    /* A region that can't be read at all says nothing */
+	    if (!region_block) continue;
+	    profile.regions[profile.num_regions].sysex_addr = regions[i];
+	    profile.regions[profile.num_regions++].block_size = region_block;
+	    report("Block size for 0x%08X: %d\n", regions[i], region_block);
+	    if (profile.block_size < 0 || region_block < profile.block_size)
+		profile.block_size = region_block;
+	}
+
+	if (!num_times) {
+	    fprintf(stderr, "The Juno didn't answer. Check the connections, "
+			    "and the device ID.\n");
+	    libgieditor_close();
+	    return 1;
+	}
+
+	qsort(times, num_times, sizeof(uint64_t), compare_times);
+	report("All: p50 %.2fms  p90 %.2fms  p99 %.2fms  max %.2fms\n",
+			MS(percentile(times, num_times, 50)),
+			MS(percentile(times, num_times, 90)),
+			MS(percentile(times, num_times, 99)),
+			MS(times[num_times - 1]));
+	profile.timeout_ms = 4 * percentile(times, num_times, 99) / 1000 + 50;
+	if (profile.timeout_ms < MIN_TIMEOUT) profile.timeout_ms = MIN_TIMEOUT;
+	free(times);
+
+	if (test_writes && libgieditor_get_sysex_buf(NAME_ADDR,
+				MAX_SET_NAME_SIZE, saved_name) == 0) {
+	    report("DT1 bursts of %d one byte writes:\n",
+			    BURST_ROUNDS * MAX_SET_NAME_SIZE);
+	    for (i = 0; i < NUM_RATES; i++) {
+		retval = probe_rate(rates[i], i);
+		if (retval == 0) {
+		    profile.pacing = rates[i];
+		    break;
+		}
+		if (retval == -2) break;
+	    }
+	    if (profile.pacing < 0) {
+		report("Writes were lost at every rate tried\n");
+		profile.pacing = rates[NUM_RATES - 1];
+	    }
+	    libgieditor_set_pacing(profile.pacing);
+	    libgieditor_send_sysex(NAME_ADDR, MAX_SET_NAME_SIZE, saved_name);
+	    libgieditor_wait_sent();
+	}
+	libgieditor_close();
+
+	if (profile.block_size > 0)
+	    profile.bulk_budget = profile.block_size + DT1_OVERHEAD;
+
+	report("Default block size %d, timeout %dms, pacing %d bytes/s\n",
+			profile.block_size, profile.timeout_ms, profile.pacing);
+
+	if (!filename) filename = libgieditor_default_profile();
+	if (make_parent_dirs(filename) < 0 ||
+			libgieditor_save_profile(filename, &profile, notes) < 0) {
+	    fprintf(stderr, "Couldn't write %s\n", filename);
+	    return 1;
+	}
+	printf("Wrote %s\n", filename);
+	return 0;
+}
@@ -0,0 +1,167 @@
+/* gi_stat
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "rt_stats.h"
+
+#define MAX_CLIENTS	16
+#define CLEAR_SCREEN	"\033[H\033[2J"
+
+/* The previous reading of each client, for rates */
+typedef struct s_client {
+	char		shm_name[RT_STATS_NAME_SIZE + 32];
+	Rt_stats	last;
+	int		seen;
+} Client;
+
+static Client clients[MAX_CLIENTS];
+static const char *filter;
+static int interval = 1;
+
+static void usage(char *name) {
+	fprintf(stderr, "Usage: %s [-i seconds] [-n count] [client]\n", name);
+	fprintf(stderr, "Shows what the editors' Jack process callbacks are "
+			"doing. Start them with %s=1\n", STATS_ENV);
+	fprintf(stderr, "  -i\tseconds between updates (default 1)\n");
+	fprintf(stderr, "  -n\tstop after this many updates\n");
+}
+
+static Client *find_client(const char *shm_name) {
+	int i;
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+	    if (clients[i].seen && !strcmp(clients[i].shm_name, shm_name))
+		return &clients[i];
+	}
+	for (i = 0; i < MAX_CLIENTS; i++) {
+	    if (!clients[i].seen) {
+		strncpy(clients[i].shm_name, shm_name,
+				sizeof(clients[i].shm_name) - 1);
+		memset(&clients[i].last, 0, sizeof(Rt_stats));
+		return &clients[i];
+	    }
+	}
+	return NULL;
+}
+
+static void print_histogram(Rt_stats *stats) {
+	int i;
+
+	printf("  cycle us ");
+	for (i = 0; i < RT_STATS_BUCKETS; i++) {
+	    if (!stats->hist[i]) continue;
+	    if (i == 0) printf(" <2:");
+	    else if (i == RT_STATS_BUCKETS - 1) printf(" %u+:", 1u << i);
+	    else printf(" %u-%u:", 1u << i, 1u << (i + 1));
+	    printf("%llu", (unsigned long long) stats->hist[i]);
+	}
+	printf("\n");
+}
+
+static void print_client(const char *shm_name, void *arg) {
+	const Rt_stats *shared;
+	Rt_stats stats, *last;
+	Client *client;
+	int i;
+
+	shared = rt_stats_map(shm_name);
+	if (!shared) return;
+	rt_stats_read(shared, &stats);
+	rt_stats_unmap(shared);
+
+	if (filter && !strstr(stats.name, filter)) return;
+	client = find_client(shm_name);
+	if (!client) return;
+	last = &client->last;
+	if (!client->seen) *last = stats;
+	client->seen = 2;
+
+	printf("%s (%d)\n", stats.name, stats.pid);
+	printf("  cycles %llu  avg %lluus  last %uus  max %uus  "
+			"period %uus  overruns %u  xruns %llu\n",
+			(unsigned long long) stats.cycles,
+			(unsigned long long) (stats.cycles ?
+				stats.busy_us / stats.cycles : 0),
+			stats.last_us, stats.max_us, stats.period_us,
+			stats.overruns, (unsigned long long) stats.xruns);
+	printf("  events in %llu (%llu/s)  out %llu (%llu/s)  "
+			"lock contended %llu  ack waits %llu\n",
+			(unsigned long long) stats.events_in,
+			(unsigned long long) (stats.events_in -
+				last->events_in) / interval,
+			(unsigned long long) stats.events_out,
+			(unsigned long long) (stats.events_out -
+				last->events_out) / interval,
+			(unsigned long long) stats.contended,
+			(unsigned long long) stats.ack_deferred);
+	if (stats.queue_names[0][0]) {
+	    printf("  queues");
+	    for (i = 0; i < RT_STATS_QUEUES && stats.queue_names[i][0]; i++)
+		printf("  %s %u (max %u)", stats.queue_names[i],
+				stats.depth[i], stats.max_depth[i]);
+	    printf("\n");
+	}
+	print_histogram(&stats);
+
+	*last = stats;
+}
+
+int main(int argc, char **argv) {
+	int c, i, count = 0, updates = 0, num;
+	int tty = isatty(STDOUT_FILENO);
+
+	while ((c = getopt(argc, argv, "i:n:")) != -1) {
+	    switch (c) {
+		case 'i': interval = atoi(optarg); break;
+		case 'n': count = atoi(optarg); break;
+		default:
+		    usage(argv[0]);
+		    return 1;
+	    }
+	}
+	if (optind < argc - 1 || interval < 1) {
+	    usage(argv[0]);
+	    return 1;
+	}
+	if (optind == argc - 1) filter = argv[optind];
+
+	while (1) {
+	    if (tty) printf(CLEAR_SCREEN);
+	    /* Forget clients that have gone */
+	    for (i = 0; i < MAX_CLIENTS; i++)
+		if (clients[i].seen) clients[i].seen--;
+
+	    num = rt_stats_list(print_client, NULL);
+	    if (num <= 0) printf("No clients are keeping statistics. "
+			    "Start them with %s=1\n", STATS_ENV);
+	    fflush(stdout);
+
+	    if (count && ++updates >= count) break;
+	    sleep(interval);
+	}
+	return 0;
+}
@@ -0,0 +1,692 @@
+/* gieditord
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Opens the Juno once and shares it between the other programmes, which
+ * connect with GIEDITOR_TRANSPORT=daemon. Each client gets a thread to read
+ * its requests and another to wait for its writes. Replies are matched to
+ * the RQ1s that asked for them by address, so they only go to those
+ * clients, and the same request from two clients at once only goes to the
+ * Juno once. Whatever comes back from the Juno is kept for a while, and
+ * RQ1s for bytes all kept recently enough are answered without asking the
+ * Juno. A client's DT1 isn't kept, as the Juno may not take it, but drops
+ * what was kept of the bytes it writes. The Juno doesn't say when it
+ * changes patch, which is why they're only kept for a while. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <glib.h>
+
+#include "libgieditor.h"
+#include "midi_transport.h"
+#include "gieditord.h"
+
+#define CLIENT_NAME		"gieditord"
+#define DEFAULT_CACHE_MS	2000
+#define DEFAULT_REQUEST_MS	1000	/* Until a reply is given up on */
+#define POLL_MS			100	/* Between looks for expired ones */
+#define MAX_WAITS		64
+#define MAX_SUBSCRIPTIONS	8
+#define CLIENT_NAME_SIZE	32
+
+#define ROLAND_HEADER_SIZE	7	/* Up to and including the command */
+#define SYSEX_ADDRESS_OFFSET	7
+#define SYSEX_DATA_OFFSET	11
+#define SYSEX_NOT_DATA_BYTES	13
+#define RQ1_SIZE		17
+#define MIDI_CMD_RQ1		0x11
+#define MIDI_CMD_DT1		0x12
+
+/* Cached bytes go in blocks of 128, as the 7 bit addresses do */
+#define CACHE_BLOCK_SIZE	128
+
+typedef struct s_client *Client;
+struct s_client {
+	int		fd;
+	char		name[CLIENT_NAME_SIZE];
+	int		num_subscriptions;
+	struct {
+	    uint32_t	from, to;	/* Linear, TO is just past the end */
+	} subscriptions[MAX_SUBSCRIPTIONS];
+	/* The transport's ticket for the last message sent on each lane */
+	Sysex_ticket	last_sent[SYSEX_LANES];
+	unsigned int	delivered;	/* Last route_event to reach it */
+
+	/* For the waiter, with daemon_lock */
+	struct {
+	    uint8_t	lane;
+	    Sysex_ticket ticket, sent;
+	} waits[MAX_WAITS];
+	int		num_waits;
+	int		closing;
+	pthread_cond_t	wait_ready;
+	pthread_t	waiter;
+
+	Client		next;
+};
+
+/* An RQ1 still waiting for its reply */
+typedef struct s_request *Request;
+struct s_request {
+	Client		client;
+	uint32_t	from, to;
+	uint64_t	time;
+	Request		next;
+};
+
+typedef struct s_cache_block {
+	uint8_t		data[CACHE_BLOCK_SIZE];
+	uint64_t	time[CACHE_BLOCK_SIZE];	/* 0 if never seen */
+} Cache_block;
+
+/* All only accessed with daemon_lock */
+static Client clients;
+static Request requests;
+static GHashTable *cache;
+static unsigned int route_count;
+
+static const Midi_transport *transport = &midi_jack_transport;
+static uint64_t cache_us = DEFAULT_CACHE_MS * 1000;
+static uint64_t request_us = DEFAULT_REQUEST_MS * 1000;
+static int verbose;
+static volatile sig_atomic_t running = 1;
+
+static pthread_mutex_t daemon_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void usage(char *name) {
+	fprintf(stderr, "Usage: %s [-s socket] [-t transport] [-c ms] [-v]\n",
+			name);
+	fprintf(stderr, "Shares the Juno between the other programmes, which "
+			"reach it with\n%s=daemon.\n", TRANSPORT_ENV);
+	fprintf(stderr, "  -s\twhere to listen (default $%s, or %s in "
+			"$XDG_RUNTIME_DIR)\n", DAEMON_SOCKET_ENV,
+			DAEMON_SOCKET_NAME);
+	fprintf(stderr, "  -t\thow to reach the Juno, \"jack\" (the default)"
+#ifdef HAVE_ALSA
+			" or \"alsa[:device]\""
+#endif
+			"\n");
+	fprintf(stderr, "  -c\thow long to answer from what the Juno last "
+			"sent, 0 for never\n\t(default %d)\n",
+			DEFAULT_CACHE_MS);
+	fprintf(stderr, "  -v\tsay when clients come and go\n");
+}
+
+static void signal_handler(int unused) {
+	running = 0;
+}
+
+/* Anything sysex.c takes but gieditord itself */
+static int set_transport(const char *spec) {
+	const Midi_transport *found = midi_transport_find(spec);
+
+	if (!found || found == &midi_daemon_transport) return -1;
+	transport = found;
+	return 0;
+}
+
+static uint32_t read_word(const uint8_t *c) {
+	return c[0] << 24 | c[1] << 16 | c[2] << 8 | c[3];
+}
+
+#define message_address(data) \
+	libgieditor_linear_addr(read_word((data) + SYSEX_ADDRESS_OFFSET))
+
+static int is_roland(const uint8_t *data, int size, uint8_t command) {
+	return size >= SYSEX_NOT_DATA_BYTES && data[1] == 0x41 &&
+		data[ROLAND_HEADER_SIZE - 1] == command;
+}
+
+static int send_msg(Client client, uint8_t type, uint8_t lane,
+		uint32_t ticket, uint32_t arg, const uint8_t *data, int size,
+		int flags) {
+	uint8_t buf[sizeof(Daemon_msg) + DAEMON_MAX_DATA];
+	Daemon_msg *msg = (Daemon_msg *) buf;
+
+	if (size > DAEMON_MAX_DATA) return -1;
+	msg->type = type;
+	msg->lane = lane;
+	msg->size = size;
+	msg->ticket = ticket;
+	msg->arg = arg;
+	if (size) memcpy(buf + sizeof(Daemon_msg), data, size);
+
+	if (send(client->fd, buf, sizeof(Daemon_msg) + size,
+				MSG_NOSIGNAL | flags) < 0) return -1;
+	return 0;
+}
+
+/* Called with daemon_lock held. A client that isn't keeping up misses it,
+ * rather than holding up everyone else */
+static void deliver(Client client, const uint8_t *data, int size) {
+	if (client->delivered == route_count) return;
+	client->delivered = route_count;
+	send_msg(client, DAEMON_EVENT, 0, 0, 0, data, size, MSG_DONTWAIT);
+}
+
+/* Called with daemon_lock held */
+static void cache_store(uint32_t from, const uint8_t *data, int size,
+		uint64_t now) {
+	Cache_block *block = NULL;
+	uint32_t addr;
+	int i;
+
+	if (!cache_us) return;
+	for (i = 0; i < size; i++) {
+	    addr = from + i;
+	    if (!block || addr % CACHE_BLOCK_SIZE == 0) {
+		block = g_hash_table_lookup(cache,
+				GUINT_TO_POINTER(addr / CACHE_BLOCK_SIZE));
+		if (!block) {
+		    block = calloc(1, sizeof(Cache_block));
+		    g_hash_table_insert(cache,
+				    GUINT_TO_POINTER(addr / CACHE_BLOCK_SIZE),
+				    block);
+		}
+	    }
+	    block->data[addr % CACHE_BLOCK_SIZE] = data[i];
+	    block->time[addr % CACHE_BLOCK_SIZE] = now;
+	}
+}
+
+/* Called with daemon_lock held. Forgets SIZE bytes from FROM, which a
+ * client has just sent the Juno. They're only kept again once the Juno
+ * says what it made of them, since it may not have taken them */
+static void cache_forget(uint32_t from, int size) {
+	Cache_block *block = NULL;
+	uint32_t addr;
+	int i;
+
+	for (i = 0; i < size; i++) {
+	    addr = from + i;
+	    if (!block || addr % CACHE_BLOCK_SIZE == 0) {
+		block = g_hash_table_lookup(cache,
+				GUINT_TO_POINTER(addr / CACHE_BLOCK_SIZE));
+	    }
+	    if (block) block->time[addr % CACHE_BLOCK_SIZE] = 0;
+	}
+}
+
+/* Called with daemon_lock held. Copies SIZE bytes from FROM into DATA if
+ * they have all been seen recently enough */
+static int cache_fetch(uint32_t from, uint8_t *data, int size,
+		uint64_t now) {
+	Cache_block *block = NULL;
+	uint32_t addr;
+	int i;
+
+	if (!cache_us) return -1;
+	for (i = 0; i < size; i++) {
+	    addr = from + i;
+	    if (!block || addr % CACHE_BLOCK_SIZE == 0) {
+		block = g_hash_table_lookup(cache,
+				GUINT_TO_POINTER(addr / CACHE_BLOCK_SIZE));
+		if (!block) return -1;
+	    }
+	    if (!block->time[addr % CACHE_BLOCK_SIZE] ||
+			    now - block->time[addr % CACHE_BLOCK_SIZE] > cache_us)
+		return -1;
+	    data[i] = block->data[addr % CACHE_BLOCK_SIZE];
+	}
+	return 0;
+}
+
+/* Called with daemon_lock held. Answers the RQ1 in RQ from the cache, with
+ * the DT1 the Juno would have sent */
+static int answer_from_cache(Client client, const uint8_t *rq,
+		uint64_t now) {
+	uint8_t buf[DAEMON_MAX_DATA];
+	uint32_t size = libgieditor_linear_addr(
+			read_word(rq + SYSEX_DATA_OFFSET));
+	int i;
+
+	if (size + SYSEX_NOT_DATA_BYTES > sizeof(buf)) return -1;
+	if (cache_fetch(message_address(rq), buf + SYSEX_DATA_OFFSET, size,
+				now) < 0)
+	    return -1;
+
+	memcpy(buf, rq, SYSEX_DATA_OFFSET);
+	buf[ROLAND_HEADER_SIZE - 1] = MIDI_CMD_DT1;
+	i = SYSEX_DATA_OFFSET + size;
+	buf[i++] = libgieditor_checksum(size + 4, buf + SYSEX_ADDRESS_OFFSET);
+	buf[i++] = 0xf7;
+
+	route_count++;
+	deliver(client, buf, i);
+	return 0;
+}
+
+/* Called with daemon_lock held. Remembers the RQ1 in RQ, and returns
+ * whether it needs sending, which it doesn't if another client's is
+ * already on its way. A client asking twice is trying again */
+static int add_request(Client client, const uint8_t *rq, uint64_t now) {
+	Request request, *list;
+	int already = 0;
+
+	request = malloc(sizeof(struct s_request));
+	request->client = client;
+	request->from = message_address(rq);
+	request->to = request->from +
+		libgieditor_linear_addr(read_word(rq + SYSEX_DATA_OFFSET));
+	request->time = now;
+	request->next = NULL;
+
+	for (list = &requests; *list; list = &(*list)->next) {
+	    if ((*list)->client != client && (*list)->from == request->from &&
+			    (*list)->to == request->to) already = 1;
+	}
+	*list = request;
+	return !already;
+}
+
+/* Called with daemon_lock held. Forgets requests from CLIENT, or if it's
+ * NULL, any that have waited too long */
+static void forget_requests(Client client, uint64_t now) {
+	Request *list = &requests, old;
+
+	while (*list) {
+	    if (client ? (*list)->client == client :
+			    now - (*list)->time > request_us) {
+		old = *list;
+		*list = old->next;
+		free(old);
+	    } else list = &(*list)->next;
+	}
+}
+
+static int subscribed(Client client, uint32_t from, uint32_t to) {
+	int i;
+
+	for (i = 0; i < client->num_subscriptions; i++) {
+	    if (client->subscriptions[i].from < to &&
+			    from < client->subscriptions[i].to) return 1;
+	}
+	return 0;
+}
+
+/* Something from the Juno. A DT1 goes to whoever asked for it, if anyone
+ * did, and otherwise to whoever subscribed to its addresses. Anything else
+ * goes to all subscribers */
+static void route_event(const uint8_t *data, int size) {
+	uint64_t now = transport->get_time();
+	uint32_t from, to;
+	Request *list, old;
+	Client client;
+	int asked = 0;
+
+	pthread_mutex_lock(&daemon_lock);
+	route_count++;
+
+	if (!is_roland(data, size, MIDI_CMD_DT1)) {
+	    for (client = clients; client; client = client->next)
+		if (client->num_subscriptions) deliver(client, data, size);
+	    pthread_mutex_unlock(&daemon_lock);
+	    return;
+	}
+
+	from = message_address(data);
+	to = from + size - SYSEX_NOT_DATA_BYTES;
+	cache_store(from, data + SYSEX_DATA_OFFSET, to - from, now);
+
+	list = &requests;
+	while (*list) {
+	    if ((*list)->from <= from && from < (*list)->to) {
+		deliver((*list)->client, data, size);
+		asked = 1;
+		if (to >= (*list)->to) {
+		    old = *list;
+		    *list = old->next;
+		    free(old);
+		    continue;
+		}
+	    }
+	    list = &(*list)->next;
+	}
+
+	if (!asked) {
+	    for (client = clients; client; client = client->next)
+		if (subscribed(client, from, to)) deliver(client, data, size);
+	}
+	pthread_mutex_unlock(&daemon_lock);
+}
+
+/* A message for the Juno. RQ1s may be answered here, or already be on
+ * their way, and DT1s make what was kept of their bytes stale */
+static void client_send(Client client, Daemon_msg *msg, uint8_t *data) {
+	uint64_t now = transport->get_time();
+	Sysex_ticket ticket;
+	enum sysex_lane lane = msg->lane;
+
+	if (lane >= SYSEX_LANES || msg->size < 2) return;
+
+	pthread_mutex_lock(&daemon_lock);
+	if (is_roland(data, msg->size, MIDI_CMD_DT1)) {
+	    cache_forget(message_address(data),
+			    msg->size - SYSEX_NOT_DATA_BYTES);
+	} else if (msg->size == RQ1_SIZE &&
+			is_roland(data, msg->size, MIDI_CMD_RQ1)) {
+	    if (answer_from_cache(client, data, now) == 0 ||
+			    !add_request(client, data, now)) {
+		pthread_mutex_unlock(&daemon_lock);
+		return;
+	    }
+	}
+	pthread_mutex_unlock(&daemon_lock);
+
+	if (msg->type == DAEMON_SEND_ACK) {
+	    lane = SYSEX_LANE_REALTIME;
+	    ticket = transport->send_event_ack(msg->size, data);
+	} else ticket = transport->send_event(msg->size, data,
+			msg->arg ? now + msg->arg : 0, lane, 0);
+
+	pthread_mutex_lock(&daemon_lock);
+	client->last_sent[lane] = ticket;
+	pthread_mutex_unlock(&daemon_lock);
+}
+
+/* Waits for the Juno to have been sent everything the client had sent
+ * when it asked */
+static void *waiter_main(void *arg) {
+	Client client = arg;
+	Sysex_ticket ticket, sent;
+	uint8_t lane;
+
+	pthread_mutex_lock(&daemon_lock);
+	while (1) {
+	    while (!client->num_waits && !client->closing)
+		pthread_cond_wait(&client->wait_ready, &daemon_lock);
+	    if (client->closing) break;
+
+	    lane = client->waits[0].lane;
+	    ticket = client->waits[0].ticket;
+	    sent = client->waits[0].sent;
+	    memmove(&client->waits[0], &client->waits[1],
+			    --client->num_waits * sizeof(client->waits[0]));
+	    pthread_mutex_unlock(&daemon_lock);
+
+	    if (sent) transport->wait_ticket(sent);
+	    send_msg(client, DAEMON_WRITTEN, lane, ticket, 0, NULL, 0, 0);
+
+	    pthread_mutex_lock(&daemon_lock);
+	}
+	pthread_mutex_unlock(&daemon_lock);
+	return NULL;
+}
+
+static void client_wait(Client client, Daemon_msg *msg) {
+	if (msg->lane >= SYSEX_LANES) return;
+
+	pthread_mutex_lock(&daemon_lock);
+	/* It can only be waiting on each lane once per thread */
+	if (client->num_waits < MAX_WAITS) {
+	    client->waits[client->num_waits].lane = msg->lane;
+	    client->waits[client->num_waits].ticket = msg->ticket;
+	    client->waits[client->num_waits++].sent =
+		    client->last_sent[msg->lane];
+	    pthread_cond_signal(&client->wait_ready);
+	}
+	pthread_mutex_unlock(&daemon_lock);
+}
+
+static void client_subscribe(Client client, Daemon_msg *msg) {
+	int i;
+
+	pthread_mutex_lock(&daemon_lock);
+	i = client->num_subscriptions;
+	if (i < MAX_SUBSCRIPTIONS) {
+	    if (msg->arg == DAEMON_ALL_ADDRESSES) {
+		client->subscriptions[i].from = 0;
+		client->subscriptions[i].to = UINT32_MAX;
+	    } else {
+		client->subscriptions[i].from =
+			libgieditor_linear_addr(msg->ticket);
+		client->subscriptions[i].to =
+			client->subscriptions[i].from + msg->arg;
+	    }
+	    client->num_subscriptions++;
+	}
+	pthread_mutex_unlock(&daemon_lock);
+}
+
+static void remove_client(Client client) {
+	Client *list;
+
+	pthread_mutex_lock(&daemon_lock);
+	for (list = &clients; *list != client; list = &(*list)->next);
+	*list = client->next;
+	forget_requests(client, 0);
+	client->closing = 1;
+	pthread_cond_signal(&client->wait_ready);
+	pthread_mutex_unlock(&daemon_lock);
+
+	pthread_join(client->waiter, NULL);
+	if (verbose) fprintf(stderr, "%s left\n", client->name);
+	close(client->fd);
+	pthread_cond_destroy(&client->wait_ready);
+	free(client);
+}
+
+static void *client_main(void *arg) {
+	uint8_t buf[sizeof(Daemon_msg) + DAEMON_MAX_DATA];
+	Daemon_msg *msg = (Daemon_msg *) buf;
+	uint8_t *data = buf + sizeof(Daemon_msg);
+	Client client = arg;
+	ssize_t bytes;
+	int len;
+
+	while (1) {
+	    bytes = recv(client->fd, buf, sizeof(buf), 0);
+	    if (bytes < 0 && errno == EINTR) continue;
+	    if (bytes < (ssize_t) sizeof(Daemon_msg)) break;
+	    if (msg->size != bytes - sizeof(Daemon_msg)) continue;
+
+	    switch (msg->type) {
+		case DAEMON_HELLO:
+		    len = msg->size < CLIENT_NAME_SIZE ?
+			    msg->size : CLIENT_NAME_SIZE - 1;
+		    memcpy(client->name, data, len);
+		    client->name[len] = '\0';
+		    if (verbose) fprintf(stderr, "%s joined\n", client->name);
+		    send_msg(client, DAEMON_HELLO, 0, 0, DAEMON_VERSION,
+				    NULL, 0, 0);
+		    break;
+		case DAEMON_SEND:
+		case DAEMON_SEND_ACK:
+		    client_send(client, msg, data);
+		    break;
+		case DAEMON_WAIT:
+		    client_wait(client, msg);
+		    break;
+		case DAEMON_SUBSCRIBE:
+		    client_subscribe(client, msg);
+		    break;
+	    }
+	}
+
+	remove_client(client);
+	return NULL;
+}
+
+static void *accept_main(void *arg) {
+	int listen_fd = *(int *) arg, fd;
+	pthread_t thread;
+	Client client;
+
+	while (running) {
+	    fd = accept(listen_fd, NULL, NULL);
+	    if (fd < 0) {
+		if (errno == EINTR || errno == ECONNABORTED) continue;
+		break;
+	    }
+
+	    client = calloc(1, sizeof(struct s_client));
+	    client->fd = fd;
+	    strcpy(client->name, "(unnamed)");
+	    pthread_cond_init(&client->wait_ready, NULL);
+	    if (pthread_create(&client->waiter, NULL, waiter_main, client)) {
+		close(fd);
+		free(client);
+		continue;
+	    }
+
+	    pthread_mutex_lock(&daemon_lock);
+	    client->next = clients;
+	    clients = client;
+	    pthread_mutex_unlock(&daemon_lock);
+
+	    if (pthread_create(&thread, NULL, client_main, client)) {
+		remove_client(client);
+		continue;
+	    }
+	    pthread_detach(thread);
+	}
+	return NULL;
+}
+
+static int open_socket(const char *path) {
+	struct sockaddr_un addr;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (fd < 0) return -1;
+
+	/* Left behind by one that didn't close, unless it's still there */
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+	    close(fd);
+	    return -2;
+	}
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+			listen(fd, SOMAXCONN) < 0) {
+	    close(fd);
+	    return -1;
+	}
+	return fd;
+}
+
+/* $GIEDITOR_PROFILE, or the default, as libgieditor_init would */
+static void load_profile(void) {
+	DeviceProfile profile;
+	char *filename = getenv(PROFILE_ENV);
+
+	if (filename && !*filename) return;
+	filename = filename ? strdup(filename) : libgieditor_default_profile();
+	if (libgieditor_read_profile(filename, &profile) == 0) {
+	    if (profile.pacing >= 0 && transport->set_pacing)
+		transport->set_pacing(profile.pacing);
+	    if (profile.bulk_budget >= 0)
+		transport->set_bulk_budget(profile.bulk_budget);
+	    if (profile.timeout_ms > 0)
+		request_us = (uint64_t) profile.timeout_ms * 1000;
+	}
+	free(filename);
+}
+
+int main(int argc, char **argv) {
+	char *path = NULL;
+	pthread_t accept_thread;
+	uint8_t *data;
+	int c, fd, bytes;
+
+	while ((c = getopt(argc, argv, "s:t:c:v")) != -1) {
+	    switch (c) {
+		case 's': path = strdup(optarg); break;
+		case 't':
+		    if (set_transport(optarg) < 0) {
+			fprintf(stderr, "Unknown transport %s\n", optarg);
+			return 1;
+		    }
+		    break;
+		case 'c': cache_us = (uint64_t) atoi(optarg) * 1000; break;
+		case 'v': verbose = 1; break;
+		default:
+		    usage(argv[0]);
+		    return 1;
+	    }
+	}
+	if (optind != argc) {
+	    usage(argv[0]);
+	    return 1;
+	}
+	if (!path) path = daemon_socket_path();
+
+	fd = open_socket(path);
+	if (fd < 0) {
+	    if (fd == -2) fprintf(stderr, "Already running on %s\n", path);
+	    else fprintf(stderr, "Couldn't listen on %s\n", path);
+	    return 1;
+	}
+
+	if (transport->init(CLIENT_NAME, -1,
+				LIBGIEDITOR_READ | LIBGIEDITOR_WRITE) < 0) {
+	    fprintf(stderr, "Couldn't open the %s transport\n",
+			    transport->name);
+	    fprintf(stderr, "Check that jackd is running.\n");
+	    close(fd);
+	    unlink(path);
+	    return 1;
+	}
+	transport->set_timeout(transport->ms_to_timeout(POLL_MS));
+	load_profile();
+	cache = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+			free);
+
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+	if (pthread_create(&accept_thread, NULL, accept_main, &fd)) {
+	    transport->close();
+	    close(fd);
+	    unlink(path);
+	    return 1;
+	}
+	pthread_detach(accept_thread);
+	if (verbose) fprintf(stderr, "Listening on %s\n", path);
+
+	while (running) {
+	    bytes = transport->listen_event(0, &data, NULL);
+	    if (bytes > 0) route_event(data, bytes);
+	    free(data);
+
+	    pthread_mutex_lock(&daemon_lock);
+	    forget_requests(NULL, transport->get_time());
+	    pthread_mutex_unlock(&daemon_lock);
+	}
+
+	/* Clients see the socket close, and carry on without us */
+	unlink(path);
+	close(fd);
+	transport->close();
+	free(path);
+	return 0;
+}
@@ -32,6 +32,7 @@
 
 #include "libgieditor.h"
 #include "avr_api.h"
+#include "rt_stats.h"
 
 #define CLIENT_NAME "JackSyncer"
 #define CLIENT_CONTROLLER_NAME "JackSyncerAVR"
@@ -110,6 +111,7 @@ static jack_port_t *midi_in_port;
 static jack_port_t *midi_led_port;
 static jack_port_t *midi_rltm_port;
 static jack_port_t *midi_spp_port;
+static Rt_stats *stats;
 
 static pthread_mutex_t midi_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t read_data_ready = PTHREAD_COND_INITIALIZER;
@@ -204,6 +206,7 @@ static int process_callback(jack_nframes_t nframes, void *arg) {
 	uint8_t data[MIDI_CTL_SIZE];
 	uint8_t *buf;
 	int length;
+	uint64_t stats_begin = rt_stats_cycle_begin(stats);
 
 	void *midi_in_buf = jack_port_get_buffer(midi_in_port, nframes);
 	void *midi_led_buf = jack_port_get_buffer(midi_led_port, nframes);
@@ -214,7 +217,7 @@ static int process_callback(jack_nframes_t nframes, void *arg) {
 	jack_midi_clear_buffer(midi_rltm_buf);
 	jack_midi_clear_buffer(midi_spp_buf);
 
-	pthread_mutex_lock(&midi_lock);
+	rt_stats_lock(stats, &midi_lock);
 
 	if (!midictl_led_list)
 	    pthread_cond_signal(&write_data_ready);
@@ -226,6 +229,7 @@ static int process_callback(jack_nframes_t nframes, void *arg) {
 	    jack_midi_event_write(midi_rltm_buf, event_index++, buf, length);
 	    free(cur_rltm);
 	}
+	rt_stats_add(stats, events_out, event_index);
 	
 	event_index = 0;
 
@@ -236,6 +240,7 @@ static int process_callback(jack_nframes_t nframes, void *arg) {
 	    jack_midi_event_write(midi_spp_buf, event_index++, buf, length);
 	    free(cur_rltm);
 	}
+	rt_stats_add(stats, events_out, event_index);
 	
 	event_index = 0;
 
@@ -247,6 +252,7 @@ static int process_callback(jack_nframes_t nframes, void *arg) {
 				MIDI_CTL_SIZE);
 	    free(cur_midictl);
 	}
+	rt_stats_add(stats, events_out, event_index);
 
 	event_index = 0;
 
@@ -277,9 +283,17 @@ static int process_callback(jack_nframes_t nframes, void *arg) {
 	    }
 			
 	}
+	rt_stats_add(stats, events_in, event_index - 1);
 
 	pthread_mutex_unlock(&midi_lock);
 
+	rt_stats_cycle_end(stats, stats_begin, (uint64_t) nframes * 1000000 /
+			jack_get_sample_rate(jack_client));
+	return 0;
+}
+
+static int xrun_callback(void *arg) {
+	rt_stats_add(stats, xruns, 1);
 	return 0;
 }
 
@@ -405,6 +419,9 @@ static int jack_init(const char *client_name) {
 	if (jack_set_process_callback(jack_client, process_callback, 0) < 0)
 		return -1;
 
+	stats = rt_stats_open(client_name, NULL);
+	if (stats) jack_set_xrun_callback(jack_client, xrun_callback, 0);
+
 	if (do_sync) {
 	    if (jack_set_sync_callback(jack_client, sync_callback, 0) < 0)
 		return -1;
@@ -453,6 +470,7 @@ static int jack_close(void) {
 	    jack_port_unregister(jack_client, midi_rltm_port);
 	if (midi_spp_port)
 	    jack_port_unregister(jack_client, midi_spp_port);
+	rt_stats_close(stats);
 	return jack_client_close(jack_client);
 }
 
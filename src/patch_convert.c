@@ -0,0 +1,71 @@
+/* patch_convert
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ * 
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ * 
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libgieditor.h"
+
+static void usage(char *name) {
+	fprintf(stderr, "Usage: %s [-b|-k] <infile> <outfile>\n", name);
+	fprintf(stderr, "Converts saved patches between formats.\n");
+	fprintf(stderr, "  -b\twrite a binary snapshot (default)\n");
+	fprintf(stderr, "  -k\twrite a text keyfile\n");
+}
+
+int main(int argc, char **argv) {
+	enum patch_format format = PATCH_FORMAT_BINARY;
+	int arg = 1, retval;
+
+	if (argc == 4) {
+	    if (!strcmp(argv[1], "-b")) format = PATCH_FORMAT_BINARY;
+	    else if (!strcmp(argv[1], "-k")) format = PATCH_FORMAT_KEYFILE;
+	    else {
+		usage(argv[0]);
+		return 1;
+	    }
+	    arg++;
+	} else if (argc != 3) {
+	    usage(argv[0]);
+	    return 1;
+	}
+
+	retval = libgieditor_convert_patch_file(argv[arg], argv[arg + 1],
+			format);
+	switch (retval) {
+	    case 0:
+		return 0;
+	    case -1:
+		fprintf(stderr, "Couldn't open %s\n", argv[arg]);
+		break;
+	    case -2:
+		fprintf(stderr, "Couldn't convert %s to %s\n",
+				argv[arg], argv[arg + 1]);
+		break;
+	    default:
+		fprintf(stderr, "%s doesn't match its class layout\n",
+				argv[arg]);
+		break;
+	}
+	return 1;
+}
@@ -0,0 +1,199 @@
+/* patch_store
+ *
+ * Juno Gi Editor
+ *
+ * Copyright (C) 2012 Kim Taylor <kmtaylor@gmx.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation version 2 of the License.
+ *
+ *	This program is distributed in the hope that it will be useful, but
+ *	WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, write to the Free Software Foundation, Inc.,
+ *	675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libgieditor.h"
+
+static void usage(char *name) {
+	fprintf(stderr, "Usage: %s <store> <command> ...\n", name);
+	fprintf(stderr, "Commands:\n");
+	fprintf(stderr, "  import [-t tags] <file>...\n");
+	fprintf(stderr, "  find [-c class] [-n name] [-t tag] "
+			"[-p param=min[-max]]\n");
+	fprintf(stderr, "  tag <hash> <tag>\n");
+	fprintf(stderr, "  export <hash> <file>\n");
+	fprintf(stderr, "  params <address>...\n");
+	fprintf(stderr, "  similar -c class [-k count] [-f] <file>\n");
+}
+
+static int do_import(PatchStore *store, int argc, char **argv) {
+	char *tags = NULL;
+	const StoreEntry *entry;
+	int c, i, retval = 0;
+
+	while ((c = getopt(argc, argv, "t:")) != -1) {
+	    switch (c) {
+		case 't': tags = optarg; break;
+		default: return 1;
+	    }
+	}
+
+	for (i = optind; i < argc; i++) {
+	    entry = libgieditor_store_import_file(store, argv[i], tags);
+	    if (!entry) {
+		fprintf(stderr, "Couldn't import %s\n", argv[i]);
+		retval = 1;
+		continue;
+	    }
+	    printf("%s %s\n", entry->hash, argv[i]);
+	}
+	return retval;
+}
+
+static int do_find(PatchStore *store, int argc, char **argv) {
+	StoreQuery query = { NULL, NULL, NULL, -1, 0, UINT32_MAX };
+	const StoreEntry **results;
+	int c, i, num;
+	char *range;
+
+	while ((c = getopt(argc, argv, "c:n:t:p:")) != -1) {
+	    switch (c) {
+		case 'c':
+		    query.class = libgieditor_match_class_name(optarg);
+		    if (!query.class) {
+			fprintf(stderr, "Unknown class: %s\n", optarg);
+			return 1;
+		    }
+		    break;
+		case 'n': query.name = optarg; break;
+		case 't': query.tag = optarg; break;
+		case 'p':
+		    range = strchr(optarg, '=');
+		    if (!range) return 1;
+		    query.param = atoi(optarg);
+		    query.param_min = strtoul(range + 1, &range, 0);
+		    query.param_max = *range == '-' ?
+			    strtoul(range + 1, NULL, 0) : query.param_min;
+		    break;
+		default: return 1;
+	    }
+	}
+
+	num = libgieditor_store_query(store, &query, &results);
+	for (i = 0; i < num; i++) {
+	    printf("%s %-16s %s %s\n", results[i]->hash, results[i]->name,
+			    results[i]->class->name,
+			    results[i]->tags ? results[i]->tags : "");
+	}
+	free(results);
+	return 0;
+}
+
+static int do_similar(PatchStore *store, int argc, char **argv) {
+	SimilarityIndex *index;
+	SimilarMatch *matches;
+	MidiClass *class = NULL;
+	int c, i, k = 10, coarse = 0, depth = 0, num;
+
+	while ((c = getopt(argc, argv, "c:k:f")) != -1) {
+	    switch (c) {
+		case 'c':
+		    class = libgieditor_match_class_name(optarg);
+		    if (!class) {
+			fprintf(stderr, "Unknown class: %s\n", optarg);
+			return 1;
+		    }
+		    break;
+		case 'k': k = atoi(optarg); break;
+		case 'f': coarse = 1; break;
+		default: return 1;
+	    }
+	}
+	if (!class || optind != argc - 1 || k <= 0) return 1;
+
+	if (libgieditor_read_copy_data_from_file(argv[optind], &depth) < 0) {
+	    fprintf(stderr, "Couldn't read %s\n", argv[optind]);
+	    return 1;
+	}
+
+	index = libgieditor_similar_build(store, class, coarse);
+	if (!index) {
+	    fprintf(stderr, "No stored %s patches\n", class->name);
+	    return 1;
+	}
+
+	matches = malloc(sizeof(SimilarMatch) * k);
+	num = libgieditor_similar_query(index, k, matches);
+	if (num == -2) fprintf(stderr, "%s isn't a %s\n", argv[optind],
+			class->name);
+	for (i = 0; i < num; i++) {
+	    printf("%s %-16s %f\n", matches[i].entry->hash,
+			    matches[i].entry->name, matches[i].distance);
+	}
+	free(matches);
+	libgieditor_similar_free(index);
+	libgieditor_flush_copy_data(&depth);
+	return num < 0;
+}
+
+int main(int argc, char **argv) {
+	PatchStore *store;
+	uint32_t *params = NULL;
+	int i, num_params = 0, depth = 0, retval = 1;
+
+	if (argc < 3) {
+	    usage(argv[0]);
+	    return 1;
+	}
+
+	if (!strcmp(argv[2], "params")) {
+	    num_params = argc - 3;
+	    params = malloc(sizeof(uint32_t) * (num_params + 1));
+	    for (i = 0; i < num_params; i++)
+		params[i] = strtoul(argv[i + 3], NULL, 0);
+	}
+
+	store = libgieditor_store_open(argv[1], params, num_params);
+	free(params);
+	if (!store) {
+	    fprintf(stderr, "Couldn't open store %s\n", argv[1]);
+	    return 1;
+	}
+
+	/* Leave getopt looking at the command's own arguments */
+	argc -= 2;
+	argv += 2;
+	optind = 1;
+
+	if (!strcmp(argv[0], "import")) retval = do_import(store, argc, argv);
+	else if (!strcmp(argv[0], "find")) retval = do_find(store, argc, argv);
+	else if (!strcmp(argv[0], "tag") && argc == 3)
+	    retval = libgieditor_store_add_tag(store, argv[1], argv[2]) < 0;
+	else if (!strcmp(argv[0], "export") && argc == 3) {
+	    retval = libgieditor_store_load(store, argv[1], &depth) ||
+		libgieditor_write_copy_data_to_file(argv[2], &depth);
+	}
+	else if (!strcmp(argv[0], "similar"))
+	    retval = do_similar(store, argc, argv);
+	else if (!strcmp(argv[0], "params")) retval = 0;
+	else usage(argv[-2]);
+
+	if (retval) fprintf(stderr, "%s failed\n", argv[0]);
+	if (libgieditor_store_save(store) < 0)
+	    fprintf(stderr, "Couldn't write the store index\n");
+	libgieditor_store_close(store);
+	return retval;
+}
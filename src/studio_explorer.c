@@ -43,20 +43,12 @@
 #define allocate(type, num, func_name) \
 	__interface_allocate(((num) * sizeof(type)), func_name)
 
-typedef struct s_name_list name_list_t;
-struct s_name_list {
-	struct dirent *file_dirent;
-	char *name;
-	name_list_t *next;
-};
-
 struct priv_dirent {
 	struct dirent *file;
-	int name_wanted;
 };
 
 static int global_want_quit;
-static name_list_t *patch_names;
+static PatchManifest *manifest;
 static char *current_dir_init = STUDIO_DIR;
 static char *current_dir;
 
@@ -336,60 +328,23 @@ static int read_studio_set(int *copy_depth) {
 	return retval;
 }
 
-static void print_rhc(struct priv_dirent *cur_file, int *copy_depth,
+/* Names come from the directory manifest, which the background scan fills
+ * in, so files it hasn't got to yet are blank for now */
+static void print_rhc(struct priv_dirent *cur_file,
 		WINDOW *menu_sub_win, int skip, int i) {
-	char *print_string = NULL;
-	char *func_name = "print_rhc()";
-	name_list_t *cur_patch;
+	const ManifestEntry *entry = NULL;
 
-	if (!cur_file->name_wanted) { 
+	if (cur_file->file->d_type == DT_REG)
+	    entry = libgieditor_manifest_lookup(manifest,
+			    cur_file->file->d_name, 0);
+
+	if (!entry) {
 	    BLANK_LINE(i - skip);
 	    return;
 	}
 
-	/* First check if we've cached this patch */
-	cur_patch = patch_names;
-	while (cur_patch) {
-	    if (cur_patch->file_dirent == cur_file->file) {
-		print_string = cur_patch->name;
-		goto found;
-	    }
-	    cur_patch = cur_patch->next;
-	}
-
-	/* Not found, so add it to the cache */
-	if (!parse_file(cur_file->file, copy_depth))
-	    print_string = libgieditor_get_copy_patch_name();
-
-	if (!patch_names) {
-	    cur_patch = allocate(name_list_t, 1, func_name);
-	    patch_names = cur_patch;
-	} else {
-	    cur_patch = patch_names;
-	    while (cur_patch->next) cur_patch = cur_patch->next;
-	    cur_patch->next = allocate(name_list_t, 1, func_name);
-	    cur_patch = cur_patch->next;
-	}
-
-	cur_patch->next = NULL;
-	cur_patch->name = print_string;
-	cur_patch->file_dirent = cur_file->file;
-
-found:
-	if (print_string) PRINT_STRING(print_string, i - skip)
+	if (entry->name[0]) PRINT_STRING(entry->name, i - skip)
 	else PRINT_STRING("Invalid file", i - skip);
-
-	libgieditor_flush_copy_data(copy_depth);
-}
-
-static void flush_patches(void) {
-	name_list_t *cur_patch;
-	while (patch_names) {
-	    cur_patch = patch_names;
-	    patch_names = patch_names->next;
-	    if (cur_patch->name) free(cur_patch->name);
-	    free(cur_patch);
-	}
 }
 
 static void do_paste(int *copy_depth) {
@@ -482,6 +437,9 @@ static char *studio_explorer(char **headers, char *footer) {
 	struct dirent **dir_contents;
 	struct priv_dirent *cur_entry;
 	struct priv_dirent *dir_data;
+	PatchScan *scan;
+	char **scan_names;
+	int n_scan = 0;
 
 	n_members = scandir(current_dir, &dir_contents,
 			    file_filter, file_sorter);
@@ -496,7 +454,18 @@ static char *studio_explorer(char **headers, char *footer) {
 	    return NULL;
 	}
 	
-	cbreak(); clear();
+	/* Fill in the manifest in the background, new names show up as the
+	 * workers get to them */
+	manifest = libgieditor_manifest_open(current_dir);
+	scan_names = allocate(char *, n_members, func_name);
+	for (i = 0; i < n_members; i++) {
+	    if (dir_contents[i]->d_type == DT_REG)
+		scan_names[n_scan++] = dir_contents[i]->d_name;
+	}
+	scan = libgieditor_scan_start(manifest, scan_names, n_scan);
+	free(scan_names);
+
+	clear(); halfdelay(1);
 
 	long_names = allocate(char *, n_members, func_name);
 	dir_data = allocate(struct priv_dirent, n_members, func_name);
@@ -530,14 +499,24 @@ static char *studio_explorer(char **headers, char *footer) {
 	}
 
         mvprintw(LINES - 1, 0, footer);
+	mvprintw(LINES - 1, COLS - 12, " Scanning..");
 	post_menu(explorer_menu);
 
 	do {
+		if (scan) {
+		    while (libgieditor_scan_poll(scan)) damaged = 1;
+		    if (libgieditor_scan_done(scan)) {
+			libgieditor_scan_stop(scan);
+			scan = NULL;
+			mvprintw(LINES - 1, COLS - 12, "            ");
+			cbreak();
+		    }
+		}
 		if (damaged) {
-		    for (i = skip; i < n_members; i++) {
+		    for (i = skip; i < n_members &&
+				    i < skip + LINES - 5 - (2 * n_parents); i++) {
 			cur_entry = item_userptr(member_items[i]);
-			print_rhc(cur_entry, &copy_depth,
-					menu_sub_win, skip, i);
+			print_rhc(cur_entry, menu_sub_win, skip, i);
 		    }
 		    damaged = 0;
 		    if (!first_draw) wrefresh(menu_sub_win);
@@ -589,8 +568,14 @@ static char *studio_explorer(char **headers, char *footer) {
 			mvprintw(LINES - 1, COLS - 12, " Reading...");
 			update_panels();
 			doupdate();
-			if (!read_studio_set(&copy_depth))
+			if (!read_studio_set(&copy_depth)) {
 			    write_file(cur_entry->file->d_name, &copy_depth);
+			    /* Its size and time have changed, so the
+			     * manifest's entry is stale */
+			    libgieditor_manifest_lookup(manifest,
+					    cur_entry->file->d_name, 1);
+			    damaged = 1;
+			}
 			mvprintw(LINES - 1, COLS - 12, " Done      ");
 			break;
 		    case 'l':
@@ -626,20 +611,15 @@ static char *studio_explorer(char **headers, char *footer) {
 			want_break = 1;
 			want_restart = 1;
 			break;
-		    case 'g':
-			cur = current_item(explorer_menu);
-			cur_entry = item_userptr(cur);
-			if (cur_entry->file->d_type != DT_REG) break;
-			cur_entry->name_wanted = '1';
-			damaged = 1;
-			break;
 		    case 'q':
 			want_break = 1;
 			break;
 		}
 	} while( !want_break );
 	
-	flush_patches();
+	if (scan) libgieditor_scan_stop(scan);
+	libgieditor_manifest_save(manifest);
+	libgieditor_manifest_close(manifest);
 	for (i = 0; i < n_members; i++)
 	    free(dir_contents[i]);
 	free(dir_contents);
@@ -663,7 +643,7 @@ static void studio_explorer_menu_wrapper(void) {
         char *headers[1];
 	char *init_header = " Studio Explorer ";
 	char *footer =  
-	" (G)et Name, (R)efresh, (L)oad, (N)ew, (S)ave, (Q)uit. ";
+	" (R)efresh, (L)oad, (N)ew, (S)ave, (Q)uit. ";
 	int init = 1;
 	char *patch_name = "";
 
@@ -37,6 +37,7 @@
 #include "sysex_explorer.h"
 
 #define CLIENT_NAME "sysex_explorer"
+#define UNDO_ENTRIES 65536
 
 #define allocate(type, num, func_name) \
 	__interface_allocate(((num) * sizeof(type)), func_name)
@@ -586,7 +587,7 @@ static int update_value(uint32_t sysex_base_addr, uint32_t *sysex_value,
 	uint8_t *sysex_data;
 	midi_address *m_address;
 
-	if (strstr(m_class->name, "User Live Set")) return 2;
+	if (strstr(libgieditor_member_name(m_class), "User Live Set")) return 2;
 	if (m_class->class) return -1;
 
 	m_address = libgieditor_match_midi_address(sysex_addr);
@@ -628,7 +629,7 @@ static void print_rhc(uint32_t sysex_base_addr, MidiClassMember *tmp_member,
 		break;
 	    case 1:
 		if (isalnum(print_sysex_value & 0xff) &&
-		     strstr(tmp_member->name, "Name")) {
+		     strstr(libgieditor_member_name(tmp_member), "Name")) {
 		    PRINT_CHAR(print_sysex_value, i - skip);
 		} else {
 		    BLANK_CHAR(i - skip);
@@ -741,7 +742,8 @@ static void sysex_explorer(char **headers, char *footer, MidiClass *cur_class,
 
 	member_items = allocate(ITEM *, n_members + 1, func_name);
 	for (i = 0; i < n_members; i++) {
-	    long_names[i] = make_long_name(cur_class->members[i].name,
+	    long_names[i] = make_long_name(
+			    libgieditor_member_name(&cur_class->members[i]),
 			    menu_width);
 	    member_items[i] = new_item(long_names[i], NULL);
 	    set_item_userptr(member_items[i], (void *) &cur_class->members[i]);
@@ -853,7 +855,8 @@ static void sysex_explorer(char **headers, char *footer, MidiClass *cur_class,
 				allocate(char *, n_parents + 2, func_name);
 			for (i = 0; i < n_parents + 1; i++)
 				new_headers[i] = headers[i];
-			new_headers[n_parents + 1] = (char *) tmp_member->name;
+			new_headers[n_parents + 1] =
+				(char *) libgieditor_member_name(tmp_member);
 			sysex_explorer(new_headers, 
 				    footer, tmp_member->class,
 				    sysex_base_addr +
@@ -920,6 +923,22 @@ static void sysex_explorer(char **headers, char *footer, MidiClass *cur_class,
 			libgieditor_flush_copy_data(&copy_depth);
 			damaged = 1;
 			break;
+		    case 'z':
+			if (!libgieditor_undo()) {
+			    char *msg[1];
+			    msg[0] = "Nothing to undo";
+			    dialog_box(1, msg, dialog_continue);
+			}
+			damaged = 1;
+			break;
+		    case 'y':
+			if (!libgieditor_redo()) {
+			    char *msg[1];
+			    msg[0] = "Nothing to redo";
+			    dialog_box(1, msg, dialog_continue);
+			}
+			damaged = 1;
+			break;
 		    case 'w':
 			cur = current_item(explorer_menu);
 			tmp_member = item_userptr(cur);
@@ -988,7 +1007,7 @@ static void sysex_explorer_menu_wrapper(void) {
         char *headers[] = { "Sysex Explorer" };
 	char *footer =  
 	"(S)et value, Re(f)resh value, Refresh (A)ll, (N)ame, (Q)uit, "
-	"(C)opy, (P)aste, C(l)ear, (W)rite, (R)ead.";
+	"(C)opy, (P)aste, C(l)ear, (W)rite, (R)ead, Undo (Z), Redo (Y).";
 	sysex_explorer(headers, footer, &libgieditor_top_midi_class, 0);
 }
 
@@ -1074,7 +1093,7 @@ int main(void) {
 	    message[1] = "Please check that jackd is running.";
 	    dialog_box(2, message, dialog_continue);
 	    global_want_quit = 1;
-        }	
+        } else libgieditor_undo_enable(UNDO_ENTRIES);
 	
 	/* Post the menu */
         post_menu(main_menu);
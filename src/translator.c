@@ -31,6 +31,7 @@
 
 #include "libgieditor.h"
 #include "midi_addresses.h"
+#include "rt_stats.h"
 
 #define CLIENT_OUT_NAME "ControlTranslatorSysex"
 #define CLIENT_IN_NAME "ControlTranslatorCTL"
@@ -68,6 +69,8 @@ static jack_port_t *midi_ctl_in_port;
 static jack_port_t *midi_note_in_port;
 static jack_port_t *midi_led_port;
 static jack_port_t *midi_ctl_port;
+static Rt_stats *stats;
+static const char *queue_names[] = { "controls", "notes", NULL };
 
 static pthread_mutex_t midi_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t read_data_ready = PTHREAD_COND_INITIALIZER;
@@ -96,8 +99,10 @@ static int jack_callback(jack_nframes_t nframes, void *arg) {
 	jack_nframes_t event_index = 0;
 	Midictl_list cur_midictl;
 	uint8_t data[MIDI_CTL_SIZE];
+	uint64_t stats_begin = rt_stats_cycle_begin(stats);
+	uint32_t depth;
 
-	pthread_mutex_lock(&midi_lock);
+	rt_stats_lock(stats, &midi_lock);
 
 	void *midi_ctl_in_buf = jack_port_get_buffer(midi_ctl_in_port, nframes);
 	void *midi_note_in_buf =
@@ -119,6 +124,7 @@ static int jack_callback(jack_nframes_t nframes, void *arg) {
                                 MIDI_CTL_SIZE);
             free(cur_midictl);
         }
+	rt_stats_add(stats, events_out, event_index);
 
         event_index = 0;
 
@@ -130,6 +136,7 @@ static int jack_callback(jack_nframes_t nframes, void *arg) {
                                 MIDI_CTL_SIZE);
             free(cur_midictl);
         }
+	rt_stats_add(stats, events_out, event_index);
 
         event_index = 0;
 
@@ -141,6 +148,7 @@ static int jack_callback(jack_nframes_t nframes, void *arg) {
 		pthread_cond_signal(&read_data_ready);
 	    }
 	}
+	rt_stats_add(stats, events_in, event_index - 1);
 
 	event_index = 0;
 
@@ -152,9 +160,27 @@ static int jack_callback(jack_nframes_t nframes, void *arg) {
 		pthread_cond_signal(&note_data_ready);
 	    }
 	}
+	rt_stats_add(stats, events_in, event_index - 1);
+
+	/* Short lists, and only walked when someone's watching */
+	if (stats) {
+	    for (depth = 0, cur_midictl = midictl_in_list; cur_midictl;
+			    cur_midictl = cur_midictl->next) depth++;
+	    rt_stats_depth(stats, 0, depth);
+	    for (depth = 0, cur_midictl = midictl_note_list; cur_midictl;
+			    cur_midictl = cur_midictl->next) depth++;
+	    rt_stats_depth(stats, 1, depth);
+	}
 
 	pthread_mutex_unlock(&midi_lock);
 
+	rt_stats_cycle_end(stats, stats_begin, (uint64_t) nframes * 1000000 /
+			jack_get_sample_rate(jack_client));
+	return 0;
+}
+
+static int xrun_callback(void *arg) {
+	rt_stats_add(stats, xruns, 1);
 	return 0;
 }
 
@@ -185,6 +211,9 @@ static int jack_init(const char *client_name) {
 	
 	jack_set_process_callback(jack_client, jack_callback, 0);
 
+	stats = rt_stats_open(client_name, queue_names);
+	if (stats) jack_set_xrun_callback(jack_client, xrun_callback, 0);
+
 	if (jack_activate(jack_client)) return -1;
 
 	return 0;
@@ -233,6 +262,7 @@ static int jack_close(void) {
 	    jack_port_unregister(jack_client, midi_led_port);
 	if (midi_ctl_port)
 	    jack_port_unregister(jack_client, midi_ctl_port);
+	rt_stats_close(stats);
 	return jack_client_close(jack_client);
 }
 